@@ -73,6 +73,32 @@ gu_decode_double(uint64_t u)
 	return sign ? copysign(ret, -1.0) : ret;
 }
 
+uint64_t
+gu_encode_double(double d)
+{
+	bool sign = signbit(d);
+	uint64_t rawexp = 0;
+	uint64_t mantissa = 0;
+	if (isinf(d)) {
+		rawexp = 0x7ff;
+	} else if (isnan(d)) {
+		rawexp = 0x7ff;
+		mantissa = 1ULL << 51;
+	} else if (d != 0.0) {
+		int exp = 0;
+		double m = frexp(fabs(d), &exp);
+		// d = m * 2^exp, with 0.5 <= m < 1
+		if (exp + 1022 > 0) {
+			rawexp = exp + 1022;
+			mantissa = (uint64_t) ldexp(m, 53) & 0xfffffffffffff;
+		} else {
+			// subnormal
+			mantissa = (uint64_t) ldexp(m, exp + 1074);
+		}
+	}
+	return (uint64_t) sign << 63 | rawexp << 52 | mantissa;
+}
+
 extern inline size_t
 gu_tagged_tag(GuTagged t);
 
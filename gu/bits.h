@@ -150,6 +150,9 @@ gu_decode_2c64(uint64_t u, GuExn* err)
 double
 gu_decode_double(uint64_t u);
 
+uint64_t
+gu_encode_double(double d);
+
 
 
 #endif // GU_BITS_H_
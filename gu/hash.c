@@ -71,6 +71,8 @@ DEFINE_INTEGER_HASHER(int32_t, int32);
 DEFINE_INTEGER_HASHER(GuWord, word);
 DEFINE_INTEGER_HASHER(uint16_t, uint16);
 DEFINE_INTEGER_HASHER(uint8_t, uint8);
+DEFINE_INTEGER_HASHER(uint32_t, uint32);
+DEFINE_INTEGER_HASHER(uint64_t, uint64);
 
 
 static bool
@@ -366,6 +368,8 @@ GuTypeTable gu_hasher_instances[1] = {
 { gu_kind(int32_t), GU_CONST_INSTANCE(gu_int32_hasher) },
 { gu_kind(uint16_t), GU_CONST_INSTANCE(gu_uint16_hasher) },
 { gu_kind(uint8_t), GU_CONST_INSTANCE(gu_uint8_hasher) },
+{ gu_kind(uint32_t), GU_CONST_INSTANCE(gu_uint32_hasher) },
+{ gu_kind(uint64_t), GU_CONST_INSTANCE(gu_uint64_hasher) },
 { gu_kind(GuWord), GU_CONST_INSTANCE(gu_word_hasher) },
 { gu_kind(struct), GU_INSTANCE(gu_make_struct_hasher) },
 { gu_kind(GuVariant), GU_INSTANCE(gu_make_variant_hasher) },
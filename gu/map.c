@@ -282,6 +282,35 @@ gu_map_insert(GuMap* map, const void* key)
 	return &map->data.values[idx * map->value_size];
 }
 
+bool
+gu_map_remove(GuMap* map, const void* key)
+{
+	size_t idx;
+	bool found = gu_map_lookup(map, key, &idx);
+	if (!found) {
+		return false;
+	}
+	if (map->kind == GU_MAP_ADDR) {
+		((const void**)map->data.keys)[idx] = NULL;
+	} else {
+		memset(&map->data.keys[idx * map->key_size], 0, map->key_size);
+	}
+	if (map->data.zero_idx == idx) {
+		map->data.zero_idx = SIZE_MAX;
+	}
+	map->data.n_occupied--;
+	// The freed entry may be in the middle of the probe sequences of
+	// other keys, so they are all rehashed.
+	gu_map_resize(map);
+	return true;
+}
+
+size_t
+gu_map_count(GuMap* map)
+{
+	return map->data.n_occupied;
+}
+
 void
 gu_map_iter(GuMap* map, GuMapItor* itor, GuExn* err)
 {
@@ -90,6 +90,11 @@ gu_set_insert(GuSet* ht, const void* key)
 	*gu_map_put_p_ = (VAL);					\
 	GU_END
 
+// Removes the entry for `key`, if any, and returns whether there was one.
+// The remaining entries are rehashed, so this takes linear time.
+bool
+gu_map_remove(GuMap* ht, const void* key);
+
 void
 gu_map_iter(GuMap* ht, GuMapItor* itor, GuExn* err);
 
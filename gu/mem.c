@@ -138,6 +138,7 @@ struct GuPool {
 	uint16_t left_edge;
 	uint16_t right_edge;
 	uint16_t curr_size;
+	size_t total_size;
 	uint8_t init_buf[];
 };
 
@@ -149,6 +150,7 @@ gu_init_pool(GuSlice buf)
 	GuPool* pool = (GuPool*) buf.p;
 	pool->flags = 0;
 	pool->curr_size = buf.sz;
+	pool->total_size = buf.sz;
 	pool->curr_buf = (uint8_t*) pool;
 	pool->chunks = NULL;
 	pool->finalizers = NULL;
@@ -190,6 +192,7 @@ gu_pool_expand(GuPool* pool, size_t req)
 	pool->curr_buf = (uint8_t*) chunk;
 	pool->left_edge = offsetof(GuMemChunk, data);
 	pool->right_edge = pool->curr_size = slice.sz;
+	pool->total_size += slice.sz;
 	// size should always fit in uint16_t
 	gu_assert((size_t) pool->right_edge == slice.sz);
 }
@@ -262,6 +265,7 @@ gu_malloc_prefixed(GuPool* pool, size_t pre_align, size_t pre_size,
 		GuMemChunk* chunk = gu_mem_alloc(full_size);
 		chunk->next = pool->chunks;
 		pool->chunks = chunk;
+		pool->total_size += full_size;
 		uint8_t* addr = &chunk->data[full_size - size
 					     - offsetof(GuMemChunk, data)];
 		VG(VALGRIND_MEMPOOL_ALLOC(pool, addr - pre_size,
@@ -306,6 +310,12 @@ gu_pool_finally(GuPool* pool, GuFinalizer* finalizer)
 	pool->finalizers = node;
 }
 
+size_t
+gu_pool_size(GuPool* pool)
+{
+	return pool->total_size;
+}
+
 void
 gu_pool_free(GuPool* pool)
 {
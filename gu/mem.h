@@ -269,6 +269,14 @@ gu_pool_finally(GuPool* pool, GuFinalizer* fini);
  * finalizers are called in reverse order of registration.
  */
 
+/// Get the amount of memory reserved by a pool.
+size_t
+gu_pool_size(GuPool* pool);
+/**< The result is the total size of the chunks that the pool has obtained
+ * so far. Memory buffers owned by objects in the pool (see below) are not
+ * included.
+ */
+
 
 /** @name Destroying a pool
  *
@@ -0,0 +1,59 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#include "config.h"
+#include <gu/mutex.h>
+#include <gu/assert.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+struct GuMutex {
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_t mutex;
+#endif
+	GuFinalizer fin;
+};
+
+static void
+gu_mutex_finalize(GuFinalizer* fin)
+{
+#ifdef HAVE_PTHREAD_H
+	GuMutex* mutex = gu_container(fin, GuMutex, fin);
+	pthread_mutex_destroy(&mutex->mutex);
+#endif
+}
+
+GuMutex*
+gu_new_mutex(GuPool* pool)
+{
+	GuMutex* mutex = gu_new(GuMutex, pool);
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&mutex->mutex, NULL) != 0) {
+		gu_fatal("Mutex initialization failed");
+	}
+#endif
+	mutex->fin.fn = gu_mutex_finalize;
+	gu_pool_finally(pool, &mutex->fin);
+	return mutex;
+}
+
+void
+gu_mutex_lock(GuMutex* mutex)
+{
+#ifdef HAVE_PTHREAD_H
+	int err = pthread_mutex_lock(&mutex->mutex);
+	gu_assert(err == 0);
+	(void) err;
+#endif
+}
+
+void
+gu_mutex_unlock(GuMutex* mutex)
+{
+#ifdef HAVE_PTHREAD_H
+	int err = pthread_mutex_unlock(&mutex->mutex);
+	gu_assert(err == 0);
+	(void) err;
+#endif
+}
@@ -0,0 +1,33 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#ifndef GU_MUTEX_H_
+#define GU_MUTEX_H_
+
+#include <gu/mem.h>
+
+/** @file
+ *
+ * Mutual exclusion for data structures that are shared between threads.
+ *
+ * When the library is built without thread support, the operations are
+ * no-ops.
+ */
+
+/// A mutual exclusion lock.
+typedef struct GuMutex GuMutex;
+
+/// Create a new mutex.
+GuMutex*
+gu_new_mutex(GuPool* pool);
+/**< The mutex is destroyed when `pool` is freed. It must not be locked
+ * at that time. */
+
+/// Acquire a mutex, waiting until it becomes available.
+void
+gu_mutex_lock(GuMutex* mutex);
+
+/// Release a mutex that was acquired by the current thread.
+void
+gu_mutex_unlock(GuMutex* mutex);
+
+#endif // GU_MUTEX_H_
@@ -2,6 +2,7 @@
 
 #include <gu/seq.h>
 #include <gu/out.h>
+#include <gu/bits.h>
 
 #define GU_DEFAULT_BUFFER_SIZE 4096
 
@@ -189,6 +190,112 @@ gu_out_is_buffered(GuOut* out);
 extern inline bool
 gu_out_try_u8_(GuOut* restrict out, uint8_t u);
 
+static void
+gu_out_be(GuOut* out, uint64_t u, int n, GuExn* err)
+{
+	uint8_t buf[8];
+	for (int i = n - 1; i >= 0; i--) {
+		buf[i] = (uint8_t) u;
+		u >>= 8;
+	}
+	gu_out_bytes(out, gu_cslice(buf, n), err);
+}
+
+static void
+gu_out_le(GuOut* out, uint64_t u, int n, GuExn* err)
+{
+	uint8_t buf[8];
+	for (int i = 0; i < n; i++) {
+		buf[i] = (uint8_t) u;
+		u >>= 8;
+	}
+	gu_out_bytes(out, gu_cslice(buf, n), err);
+}
+
+void
+gu_out_u16le(GuOut* out, uint16_t u, GuExn* err)
+{
+	gu_out_le(out, u, 2, err);
+}
+
+void
+gu_out_u16be(GuOut* out, uint16_t u, GuExn* err)
+{
+	gu_out_be(out, u, 2, err);
+}
+
+void
+gu_out_s16le(GuOut* out, int16_t i, GuExn* err)
+{
+	gu_out_le(out, (uint16_t) i, 2, err);
+}
+
+void
+gu_out_s16be(GuOut* out, int16_t i, GuExn* err)
+{
+	gu_out_be(out, (uint16_t) i, 2, err);
+}
+
+void
+gu_out_u32le(GuOut* out, uint32_t u, GuExn* err)
+{
+	gu_out_le(out, u, 4, err);
+}
+
+void
+gu_out_u32be(GuOut* out, uint32_t u, GuExn* err)
+{
+	gu_out_be(out, u, 4, err);
+}
+
+void
+gu_out_s32le(GuOut* out, int32_t i, GuExn* err)
+{
+	gu_out_le(out, (uint32_t) i, 4, err);
+}
+
+void
+gu_out_s32be(GuOut* out, int32_t i, GuExn* err)
+{
+	gu_out_be(out, (uint32_t) i, 4, err);
+}
+
+void
+gu_out_u64le(GuOut* out, uint64_t u, GuExn* err)
+{
+	gu_out_le(out, u, 8, err);
+}
+
+void
+gu_out_u64be(GuOut* out, uint64_t u, GuExn* err)
+{
+	gu_out_be(out, u, 8, err);
+}
+
+void
+gu_out_s64le(GuOut* out, int64_t i, GuExn* err)
+{
+	gu_out_le(out, (uint64_t) i, 8, err);
+}
+
+void
+gu_out_s64be(GuOut* out, int64_t i, GuExn* err)
+{
+	gu_out_be(out, (uint64_t) i, 8, err);
+}
+
+void
+gu_out_f64le(GuOut* out, double d, GuExn* err)
+{
+	gu_out_le(out, gu_encode_double(d), 8, err);
+}
+
+void
+gu_out_f64be(GuOut* out, double d, GuExn* err)
+{
+	gu_out_be(out, gu_encode_double(d), 8, err);
+}
+
 
 
 
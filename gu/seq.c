@@ -84,7 +84,8 @@ gu_make_seq(size_t elem_size, size_t length, GuPool* pool)
 {
 	size_t size = elem_size * length;
 	if (0 < length && length <= GU_TAG_MAX) {
-		void* buf = gu_malloc(pool, size);
+		// The length is kept in the low bits of the address.
+		void* buf = gu_malloc_aligned(pool, size, gu_alignof(GuWord));
 		return (GuSeq) { gu_tagged(buf, length) };
 	} else if (size == 0) {
 		return gu_empty_seq();
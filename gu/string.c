@@ -18,8 +18,6 @@ struct GuStringBuf {
 	GuWriter* wtr;
 };
 
-typedef uint8_t GuShortData[sizeof(GuWord)];
-
 bool
 gu_string_is_null(GuString s)
 {
@@ -59,10 +57,9 @@ gu_utf8_string(GuCSlice buf, GuPool* pool)
 		p = gu_malloc_aligned(pool, 1 + buf.sz, 2);
 		p[0] = (uint8_t) buf.sz;
 	} else {
-		uint8_t* p =
-			gu_malloc_prefixed(pool,
-					   gu_alignof(size_t), sizeof(size_t),
-					   1, 1 + buf.sz);
+		p = gu_malloc_prefixed(pool,
+				       gu_alignof(size_t), sizeof(size_t),
+				       2, 1 + buf.sz);
 		((size_t*) p)[-1] = buf.sz;
 		p[0] = 0;
 	}
@@ -86,7 +83,7 @@ gu_string_is_stable(GuString s)
 	return ((s.w_ & 1) == 1);
 }
 
-static GuCSlice
+GuCSlice
 gu_string_open(GuString s, GuShortData* short_data)
 {
 	GuCSlice ret;
@@ -148,6 +145,14 @@ gu_string_write(GuString s, GuWriter* wtr, GuExn* err)
 	gu_utf8_write(data, wtr, err);
 }
 
+void
+gu_string_push_utf8(GuString s, GuByteBuf* buf)
+{
+	GuShortData short_data;
+	GuCSlice data = gu_string_open(s, &short_data);
+	gu_buf_push_n(buf, data.p, data.sz);
+}
+
 GuReader*
 gu_string_reader(GuString s, GuPool* pool)
 {
@@ -99,6 +99,13 @@ gu_string_write(GuString string, GuWriter* wtr, GuExn* err);
 GuReader*
 gu_string_reader(GuString string, GuPool* pool);
 
+/// Append the UTF-8 encoding of a string to a byte buffer.
+void
+gu_string_push_utf8(GuString string, GuByteBuf* buf);
+/**< The string is copied with a single `memcpy` and nothing is allocated
+ * from a pool.
+ */
+
 /** @name String buffers
  */
 
@@ -122,6 +129,17 @@ gu_string_buf_freeze(GuStringBuf* sb, GuPool* pool);
 bool
 gu_string_is_stable(GuString string);
 
+/// Storage for the bytes of a string that is packed into a single word.
+typedef uint8_t GuShortData[sizeof(GuWord)];
+
+/// Get the UTF-8 encoding of a string without copying it.
+GuCSlice
+gu_string_open(GuString string, GuShortData* short_data);
+/**< @return The bytes of `string`. If the string is short enough to be
+ * packed into the #GuString value itself, the bytes are unpacked into
+ * `short_data`, and the result is valid only as long as `short_data` is.
+ */
+
 
 
 
@@ -178,7 +196,7 @@ typedef GuType_GuMap GuType_GuStringMap;
 typedef GuMap GuStringMap;
 
 #define gu_new_string_map(VAL_T, DEFAULT, POOL)				\
-	gu_new_map(GuString, gu_string_hasher, (VAL_T), (DEFAULT), (POOL))
+	gu_new_map(GuString, gu_string_hasher, VAL_T, (DEFAULT), (POOL))
 
 #endif
 
@@ -26,6 +26,7 @@
 
 #include <gu/defs.h>
 #include <gu/mem.h>
+#include <gu/mutex.h>
 #include <gu/type.h>
 #include <gu/exn.h>
 #include <gu/seq.h>
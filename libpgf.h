@@ -15,10 +15,15 @@
  * you study the headers in the following order:
  *
  * - PGF reading: pgf/reader.h
+ * - PGF writing: pgf/writer.h
  * - Looking up concrete grammars from a PGF: pgf/pgf.h
  * - Parsing token streams: pgf/parser.h
  * - Representing abstract syntax trees: pgf/expr.h
+ * - Encoding abstract syntax trees compactly: pgf/codec.h
  * - Linearizing abstract syntax trees: pgf/linearize.h
+ * - Translating batches of sentences in parallel: pgf/translate.h
+ * - Replacing a grammar while it is in use: pgf/epoch.h
+ * - Removing the useless parts of a grammar: pgf/optimize.h
  * 
  * @author Lauri Alanko <lealanko@ling.helsinki.fi>
  *
@@ -34,8 +39,14 @@
 #include <libgu.h>
 #include <pgf/pgf.h>
 #include <pgf/expr.h>
+#include <pgf/codec.h>
 #include <pgf/reader.h>
+#include <pgf/writer.h>
 #include <pgf/parser.h>
+#include <pgf/tokenizer.h>
 #include <pgf/linearize.h>
+#include <pgf/translate.h>
+#include <pgf/epoch.h>
+#include <pgf/optimize.h>
 
 #endif // LIBPGF_H_
@@ -0,0 +1,434 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#include "data.h"
+#include "codec.h"
+#include <gu/map.h>
+#include <gu/string.h>
+#include <gu/assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+	PGF_CODEC_FUN,
+	/**< A function of the grammar, by id. */
+	PGF_CODEC_FUN_NAME,
+	/**< A function that is not in the grammar, by name. */
+	PGF_CODEC_APP,
+	/**< An application whose head is not a function. */
+	PGF_CODEC_STR,
+	PGF_CODEC_INT,
+	PGF_CODEC_FLT,
+	PGF_CODEC_META,
+	PGF_CODEC_VAR,
+	PGF_CODEC_ABS,
+	PGF_CODEC_IMPL_ABS,
+	PGF_CODEC_IMPL_ARG
+} PgfCodecKind;
+
+enum {
+	PGF_CODEC_KIND_BITS = 4,
+	PGF_CODEC_MAX_INLINE_ARGS = 14,
+	PGF_CODEC_ARGS_FOLLOW = 15,
+	PGF_CODEC_MAX_DEPTH = 4096,
+	/**< The deepest nesting of nodes that is decoded. */
+	PGF_CODEC_STRING_CHUNK = 4096
+	/**< Strings are read in chunks of at most this many bytes, so a
+	 * corrupt length costs no more memory than the input that is
+	 * actually there. */
+};
+
+struct PgfExprCodec {
+	PgfCId* funs;
+	/**< The functions of the grammar, sorted by their UTF-8
+	 * encodings. */
+	size_t n_funs;
+	GuMap* ids;
+	/**< Maps each function name to its index in `funs`. */
+};
+
+static const int pgf_codec_no_id = -1;
+
+typedef struct {
+	GuMapItor fn;
+	PgfExprCodec* codec;
+} PgfCodecFunsFn;
+
+static void
+pgf_codec_collect_fun_cb(GuMapItor* fn, const void* key, void* value,
+			 GuExn* err)
+{
+	PgfCodecFunsFn* clo = (PgfCodecFunsFn*) fn;
+	const PgfCId* cid = key;
+	clo->codec->funs[clo->codec->n_funs++] = *cid;
+}
+
+static int
+pgf_codec_cid_cmp(const void* p1, const void* p2)
+{
+	GuShortData short1, short2;
+	GuCSlice s1 = gu_string_open(*(const PgfCId*) p1, &short1);
+	GuCSlice s2 = gu_string_open(*(const PgfCId*) p2, &short2);
+	int cmp = memcmp(s1.p, s2.p, GU_MIN(s1.sz, s2.sz));
+	if (cmp == 0) {
+		cmp = (s1.sz > s2.sz) - (s1.sz < s2.sz);
+	}
+	return cmp;
+}
+
+PgfExprCodec*
+pgf_new_expr_codec(PgfPGF* pgf, GuPool* pool)
+{
+	PgfExprCodec* codec = gu_new(PgfExprCodec, pool);
+	size_t n_funs = gu_map_count(pgf->abstract.funs);
+	codec->funs = gu_new_n(PgfCId, GU_MAX(n_funs, 1), pool);
+	codec->n_funs = 0;
+	PgfCodecFunsFn clo = { { pgf_codec_collect_fun_cb }, codec };
+	gu_map_iter(pgf->abstract.funs, &clo.fn, gu_null_exn());
+	gu_assert(codec->n_funs == n_funs);
+	qsort(codec->funs, n_funs, sizeof(PgfCId), pgf_codec_cid_cmp);
+	codec->ids = gu_new_string_map(int, &pgf_codec_no_id, pool);
+	for (size_t i = 0; i < n_funs; i++) {
+		gu_map_put(codec->ids, &codec->funs[i], int, (int) i);
+	}
+	return codec;
+}
+
+//
+// Encoding
+//
+
+static void
+pgf_codec_write_uint(GuOut* out, uint32_t u, GuExn* err)
+{
+	while (u >= 0x80) {
+		gu_out_u8(out, (uint8_t) (u | 0x80), err);
+		u >>= 7;
+	}
+	gu_out_u8(out, (uint8_t) u, err);
+}
+
+static void
+pgf_codec_write_int(GuOut* out, int32_t i, GuExn* err)
+{
+	// Zigzag encoding keeps small negative numbers short.
+	uint32_t u = (uint32_t) i;
+	pgf_codec_write_uint(out, (u << 1) ^ (i < 0 ? UINT32_MAX : 0), err);
+}
+
+static void
+pgf_codec_write_head(GuOut* out, PgfCodecKind kind, size_t n_args,
+		     GuExn* err)
+{
+	if (n_args <= PGF_CODEC_MAX_INLINE_ARGS) {
+		gu_out_u8(out, kind | n_args << PGF_CODEC_KIND_BITS, err);
+		return;
+	}
+	gu_out_u8(out, kind | PGF_CODEC_ARGS_FOLLOW << PGF_CODEC_KIND_BITS,
+		  err);
+	pgf_codec_write_uint(out, (uint32_t) n_args, err);
+}
+
+static void
+pgf_codec_write_string(GuOut* out, GuString s, GuExn* err)
+{
+	GuShortData short_data;
+	GuCSlice bytes = gu_string_open(s, &short_data);
+	pgf_codec_write_uint(out, (uint32_t) bytes.sz, err);
+	gu_out_bytes(out, bytes, err);
+}
+
+static void
+pgf_codec_encode(PgfExprCodec* codec, PgfExpr expr, size_t n_args,
+		 GuOut* out, GuExn* err);
+
+// Encode the function at the head of the application spine `expr` with
+// its `n_args` arguments, followed by the arguments.
+static void
+pgf_codec_encode_spine(PgfExprCodec* codec, PgfExpr expr, size_t n_args,
+		       GuOut* out, GuExn* err)
+{
+	if (gu_variant_tag(expr) == PGF_EXPR_APP) {
+		PgfExprApp* eapp = gu_variant_data(expr);
+		pgf_codec_encode_spine(codec, eapp->fun, n_args + 1, out, err);
+		pgf_codec_encode(codec, eapp->arg, 0, out, err);
+	} else {
+		pgf_codec_encode(codec, expr, n_args, out, err);
+	}
+}
+
+static void
+pgf_codec_encode(PgfExprCodec* codec, PgfExpr expr, size_t n_args,
+		 GuOut* out, GuExn* err)
+{
+	if (!gu_ok(err)) {
+		return;
+	}
+	GuVariantInfo ei = gu_variant_open(expr);
+	if (ei.tag != PGF_EXPR_FUN && n_args > 0) {
+		// A spine that is not headed by a function is written as
+		// nested binary applications.
+		pgf_codec_write_head(out, PGF_CODEC_APP, 0, err);
+		for (size_t i = 1; i < n_args; i++) {
+			pgf_codec_write_head(out, PGF_CODEC_APP, 0, err);
+		}
+		pgf_codec_encode(codec, expr, 0, out, err);
+		return;
+	}
+	switch (ei.tag) {
+	case PGF_EXPR_FUN: {
+		PgfExprFun* efun = ei.data;
+		int id = gu_map_get(codec->ids, &efun->fun, int);
+		if (id < 0) {
+			pgf_codec_write_head(out, PGF_CODEC_FUN_NAME, n_args, err);
+			pgf_codec_write_string(out, efun->fun, err);
+		} else {
+			pgf_codec_write_head(out, PGF_CODEC_FUN, n_args, err);
+			pgf_codec_write_uint(out, (uint32_t) id, err);
+		}
+		break;
+	}
+	case PGF_EXPR_APP:
+		pgf_codec_encode_spine(codec, expr, 0, out, err);
+		break;
+	case PGF_EXPR_LIT: {
+		PgfExprLit* elit = ei.data;
+		GuVariantInfo li = gu_variant_open(elit->lit);
+		switch (li.tag) {
+		case PGF_LITERAL_STR: {
+			PgfLiteralStr* lstr = li.data;
+			pgf_codec_write_head(out, PGF_CODEC_STR, 0, err);
+			pgf_codec_write_string(out, lstr->val, err);
+			break;
+		}
+		case PGF_LITERAL_INT: {
+			PgfLiteralInt* lint = li.data;
+			pgf_codec_write_head(out, PGF_CODEC_INT, 0, err);
+			pgf_codec_write_int(out, lint->val, err);
+			break;
+		}
+		case PGF_LITERAL_FLT: {
+			PgfLiteralFlt* lflt = li.data;
+			pgf_codec_write_head(out, PGF_CODEC_FLT, 0, err);
+			gu_out_f64be(out, lflt->val, err);
+			break;
+		}
+		default:
+			gu_impossible();
+		}
+		break;
+	}
+	case PGF_EXPR_META: {
+		PgfExprMeta* emeta = ei.data;
+		pgf_codec_write_head(out, PGF_CODEC_META, 0, err);
+		pgf_codec_write_int(out, emeta->id, err);
+		break;
+	}
+	case PGF_EXPR_VAR: {
+		PgfExprVar* evar = ei.data;
+		pgf_codec_write_head(out, PGF_CODEC_VAR, 0, err);
+		pgf_codec_write_int(out, evar->var, err);
+		break;
+	}
+	case PGF_EXPR_ABS: {
+		PgfExprAbs* eabs = ei.data;
+		pgf_codec_write_head(out,
+				     eabs->bind_type == PGF_BIND_TYPE_IMPLICIT
+				     ? PGF_CODEC_IMPL_ABS : PGF_CODEC_ABS,
+				     0, err);
+		pgf_codec_write_string(out, eabs->id, err);
+		pgf_codec_encode(codec, eabs->body, 0, out, err);
+		break;
+	}
+	case PGF_EXPR_IMPL_ARG: {
+		PgfExprImplArg* eimpl = ei.data;
+		pgf_codec_write_head(out, PGF_CODEC_IMPL_ARG, 0, err);
+		pgf_codec_encode(codec, eimpl->expr, 0, out, err);
+		break;
+	}
+	case PGF_EXPR_TYPED:
+		gu_raise(err, PgfWriteExn);
+		break;
+	default:
+		gu_impossible();
+	}
+}
+
+void
+pgf_expr_encode(PgfExprCodec* codec, PgfExpr expr, GuOut* out, GuExn* err)
+{
+	pgf_codec_encode(codec, expr, 0, out, err);
+}
+
+//
+// Decoding
+//
+
+static uint32_t
+pgf_codec_read_uint(GuIn* in, GuExn* err)
+{
+	uint32_t u = 0;
+	int shift = 0;
+	uint8_t b = 0;
+	do {
+		b = gu_in_u8(in, err);
+		gu_return_on_exn(err, 0);
+		if (shift > 28) {
+			gu_raise(err, PgfReadExn);
+			return 0;
+		}
+		u |= (uint32_t) (b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	return u;
+}
+
+static int32_t
+pgf_codec_read_int(GuIn* in, GuExn* err)
+{
+	uint32_t u = pgf_codec_read_uint(in, err);
+	return (int32_t) ((u >> 1) ^ -(u & 1));
+}
+
+static GuString
+pgf_codec_read_string(GuIn* in, GuPool* pool, GuExn* err)
+{
+	size_t len = pgf_codec_read_uint(in, err);
+	gu_return_on_exn(err, gu_null_string);
+	GuPool* tmp_pool = gu_new_pool();
+	GuBuf* bytes = gu_new_buf(uint8_t, tmp_pool);
+	while (len > 0 && gu_ok(err)) {
+		size_t n = GU_MIN(len, PGF_CODEC_STRING_CHUNK);
+		uint8_t* p = gu_buf_extend_n(bytes, n);
+		gu_in_bytes(in, gu_slice(p, n), err);
+		len -= n;
+	}
+	GuString s = gu_null_string;
+	if (gu_ok(err)) {
+		s = gu_utf8_string(gu_cslice(gu_buf_data(bytes),
+					     gu_buf_length(bytes)), pool);
+	}
+	gu_pool_free(tmp_pool);
+	return s;
+}
+
+static PgfExpr
+pgf_codec_decode(PgfExprCodec* codec, GuIn* in, int depth,
+		 GuPool* pool, GuExn* err)
+{
+	if (depth > PGF_CODEC_MAX_DEPTH) {
+		gu_raise(err, PgfReadExn);
+		return gu_null_variant;
+	}
+	uint8_t head = gu_in_u8(in, err);
+	gu_return_on_exn(err, gu_null_variant);
+	PgfCodecKind kind = head & ((1 << PGF_CODEC_KIND_BITS) - 1);
+	size_t n_args = head >> PGF_CODEC_KIND_BITS;
+	if (n_args == PGF_CODEC_ARGS_FOLLOW) {
+		n_args = pgf_codec_read_uint(in, err);
+		gu_return_on_exn(err, gu_null_variant);
+	}
+	if (n_args > 0 && kind != PGF_CODEC_FUN &&
+	    kind != PGF_CODEC_FUN_NAME) {
+		gu_raise(err, PgfReadExn);
+		return gu_null_variant;
+	}
+	PgfExpr expr = gu_null_variant;
+	switch (kind) {
+	case PGF_CODEC_FUN: {
+		uint32_t id = pgf_codec_read_uint(in, err);
+		gu_return_on_exn(err, gu_null_variant);
+		if (id >= codec->n_funs) {
+			gu_raise(err, PgfReadExn);
+			return gu_null_variant;
+		}
+		expr = gu_new_variant_i(pool, PGF_EXPR_FUN, PgfExprFun,
+					.fun = codec->funs[id]);
+		break;
+	}
+	case PGF_CODEC_FUN_NAME: {
+		GuString name = pgf_codec_read_string(in, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		expr = gu_new_variant_i(pool, PGF_EXPR_FUN, PgfExprFun,
+					.fun = name);
+		break;
+	}
+	case PGF_CODEC_APP: {
+		PgfExpr fun = pgf_codec_decode(codec, in, depth + 1, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		PgfExpr arg = pgf_codec_decode(codec, in, depth + 1, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		return gu_new_variant_i(pool, PGF_EXPR_APP, PgfExprApp,
+					.fun = fun, .arg = arg);
+	}
+	case PGF_CODEC_STR: {
+		GuString val = pgf_codec_read_string(in, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		PgfLiteral lit = gu_new_variant_i(pool, PGF_LITERAL_STR,
+						  PgfLiteralStr, .val = val);
+		return gu_new_variant_i(pool, PGF_EXPR_LIT, PgfExprLit,
+					.lit = lit);
+	}
+	case PGF_CODEC_INT: {
+		int32_t val = pgf_codec_read_int(in, err);
+		gu_return_on_exn(err, gu_null_variant);
+		PgfLiteral lit = gu_new_variant_i(pool, PGF_LITERAL_INT,
+						  PgfLiteralInt, .val = val);
+		return gu_new_variant_i(pool, PGF_EXPR_LIT, PgfExprLit,
+					.lit = lit);
+	}
+	case PGF_CODEC_FLT: {
+		double val = gu_in_f64be(in, err);
+		gu_return_on_exn(err, gu_null_variant);
+		PgfLiteral lit = gu_new_variant_i(pool, PGF_LITERAL_FLT,
+						  PgfLiteralFlt, .val = val);
+		return gu_new_variant_i(pool, PGF_EXPR_LIT, PgfExprLit,
+					.lit = lit);
+	}
+	case PGF_CODEC_META: {
+		int32_t id = pgf_codec_read_int(in, err);
+		gu_return_on_exn(err, gu_null_variant);
+		return gu_new_variant_i(pool, PGF_EXPR_META, PgfExprMeta,
+					.id = id);
+	}
+	case PGF_CODEC_VAR: {
+		int32_t var = pgf_codec_read_int(in, err);
+		gu_return_on_exn(err, gu_null_variant);
+		return gu_new_variant_i(pool, PGF_EXPR_VAR, PgfExprVar,
+					.var = var);
+	}
+	case PGF_CODEC_ABS:
+	case PGF_CODEC_IMPL_ABS: {
+		GuString id = pgf_codec_read_string(in, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		PgfExpr body = pgf_codec_decode(codec, in, depth + 1, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		return gu_new_variant_i(pool, PGF_EXPR_ABS, PgfExprAbs,
+					.bind_type = kind == PGF_CODEC_ABS
+					? PGF_BIND_TYPE_EXPLICIT
+					: PGF_BIND_TYPE_IMPLICIT,
+					.id = id, .body = body);
+	}
+	case PGF_CODEC_IMPL_ARG: {
+		PgfExpr arg = pgf_codec_decode(codec, in, depth + 1, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		return gu_new_variant_i(pool, PGF_EXPR_IMPL_ARG,
+					PgfExprImplArg, .expr = arg);
+	}
+	default:
+		gu_raise(err, PgfReadExn);
+		return gu_null_variant;
+	}
+	for (size_t i = 0; i < n_args; i++) {
+		PgfExpr arg = pgf_codec_decode(codec, in, depth + 1, pool, err);
+		gu_return_on_exn(err, gu_null_variant);
+		expr = gu_new_variant_i(pool, PGF_EXPR_APP, PgfExprApp,
+					.fun = expr, .arg = arg);
+	}
+	return expr;
+}
+
+PgfExpr
+pgf_expr_decode(PgfExprCodec* codec, GuIn* in, GuPool* pool, GuExn* err)
+{
+	return pgf_codec_decode(codec, in, 0, pool, err);
+}
@@ -0,0 +1,63 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#ifndef PGF_CODEC_H_
+#define PGF_CODEC_H_
+
+#include <libgu.h>
+#include <pgf/pgf.h>
+#include <pgf/expr.h>
+
+/// Binary encoding of abstract syntax trees
+/** @file
+ *
+ * An expression codec writes and reads abstract syntax trees in a compact
+ * binary format. The functions of the tree are written as integer ids that
+ * are local to a grammar, so a tree must be decoded with a codec for the
+ * same abstract grammar as the one it was encoded with.
+ *
+ * Each node begins with a byte whose low four bits give the kind of the
+ * node. For an application of a function to arguments, the high four bits
+ * give the number of arguments, which then follow the function. Numbers
+ * are written as base-128 varints, literals in their native form, and
+ * strings as their UTF-8 length and bytes. Typed expressions cannot be
+ * encoded.
+ */
+
+/// An encoder and decoder of trees
+typedef struct PgfExprCodec PgfExprCodec;
+
+/// Create a codec for the trees of a grammar
+PgfExprCodec*
+pgf_new_expr_codec(PgfPGF* pgf, GuPool* pool);
+/**<
+ * The ids of the functions are their indices in the list of the abstract
+ * functions of `pgf` sorted by name, so they are the same for every codec
+ * of the same abstract grammar.
+ *
+ * @pool
+ */
+
+/// Encode a tree
+void
+pgf_expr_encode(PgfExprCodec* codec, PgfExpr expr, GuOut* out, GuExn* err);
+/**<
+ * Functions that are not in the grammar are written by name.
+ *
+ * @throws PgfWriteExn if the tree contains a typed expression.
+ */
+
+/// Decode a tree
+PgfExpr
+pgf_expr_decode(PgfExprCodec* codec, GuIn* in, GuPool* pool, GuExn* err);
+/**<
+ * Exactly the bytes of one tree are consumed from `in`, so several trees
+ * can be decoded from one stream one after another. The function names of
+ * the tree are shared with the grammar.
+ *
+ * @pool
+ *
+ * @throws PgfReadExn if the input is not a valid encoding, or if the tree
+ * is nested more than 4096 levels deep.
+ */
+
+#endif // PGF_CODEC_H_
@@ -28,6 +28,60 @@ pgf_literal_cat(PgfLiteral lit)
 	}
 }
 
+static bool
+pgf_ccat_ids_eq(PgfCCatIds ids1, PgfCCatIds ids2)
+{
+	size_t len = gu_seq_length(ids1);
+	if (gu_seq_length(ids2) != len) {
+		return false;
+	}
+	for (size_t i = 0; i < len; i++) {
+		if (gu_seq_get(ids1, PgfCCatId, i)
+		    != gu_seq_get(ids2, PgfCCatId, i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool
+pgf_production_eq(PgfProduction p1, PgfProduction p2)
+{
+	GuVariantInfo i1 = gu_variant_open(p1);
+	GuVariantInfo i2 = gu_variant_open(p2);
+	if (i1.tag != i2.tag) {
+		return false;
+	}
+	switch (i1.tag) {
+	case PGF_PRODUCTION_APPLY: {
+		PgfProductionApply* papp1 = i1.data;
+		PgfProductionApply* papp2 = i2.data;
+		size_t n_args = gu_seq_length(papp1->args);
+		if (papp1->fun != papp2->fun
+		    || gu_seq_length(papp2->args) != n_args) {
+			return false;
+		}
+		for (size_t i = 0; i < n_args; i++) {
+			PgfPArg* parg1 = gu_seq_index(papp1->args, PgfPArg, i);
+			PgfPArg* parg2 = gu_seq_index(papp2->args, PgfPArg, i);
+			if (parg1->ccat != parg2->ccat
+			    || !pgf_ccat_ids_eq(parg1->hypos, parg2->hypos)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	case PGF_PRODUCTION_COERCE: {
+		PgfProductionCoerce* pcoerce1 = i1.data;
+		PgfProductionCoerce* pcoerce2 = i2.data;
+		return pcoerce1->coerce == pcoerce2->coerce;
+	}
+	default:
+		gu_impossible();
+		return false;
+	}
+}
+
 PgfCtntId
 pgf_cnccat_ctnt_id_(PgfCncCat* cnccat, GuString ctnt)
 {
@@ -79,21 +133,16 @@ GU_DEFINE_TYPE(PgfSymbolIdx, struct,
 	       GU_MEMBER(PgfSymbolIdx, r, int32_t));
 
 
-GU_DEFINE_TYPE(
-	PgfSymbol, GuVariant,
-	GU_CONSTRUCTOR(
-		PGF_SYMBOL_CAT, PgfSymbolIdx),
-	GU_CONSTRUCTOR(
-		PGF_SYMBOL_LIT, PgfSymbolIdx),
-	GU_CONSTRUCTOR(
-		PGF_SYMBOL_VAR, PgfSymbolIdx),
-	GU_CONSTRUCTOR_S(
-		PGF_SYMBOL_KS, PgfSymbolKS,
-		GU_MEMBER(PgfSymbolKS, tokens, PgfTokens)),
-	GU_CONSTRUCTOR_S(
-		PGF_SYMBOL_KP, PgfSymbolKP,
-		GU_MEMBER(PgfSymbolKP, default_form, PgfTokens),
-		GU_MEMBER(PgfSymbolKP, alts, PgfAlternatives)));
+GU_DEFINE_TYPE(PgfSymbolKS, struct,
+	       GU_MEMBER(PgfSymbolKS, tokens, PgfTokens));
+
+GU_DEFINE_TYPE(PgfSymbolKP, struct,
+	       GU_MEMBER(PgfSymbolKP, default_form, PgfTokens),
+	       GU_MEMBER(PgfSymbolKP, alts, PgfAlternatives));
+
+GU_DEFINE_TYPE(PgfSymbol, struct,
+	       GU_MEMBER(PgfSymbol, word,
+			 GU_SIZE_OPTIMIZED(uint64_t, uint32_t)));
 
 GU_DEFINE_TYPE(
 	PgfCncCat, struct,
@@ -236,11 +285,27 @@ GU_DEFINE_TYPE(PgfCncCatMap, GuAddrMap,
 	       &gu_null_struct);
 	       
 
+#ifdef GU_OPTIMIZE_SIZE
+typedef GuSeq PgfSymbolKSs, PgfSymbolKPs;
+
+static GU_DEFINE_TYPE(PgfSymbolKSs, GuSeq, gu_type(PgfSymbolKS));
+
+static GU_DEFINE_TYPE(PgfSymbolKPs, GuSeq, gu_type(PgfSymbolKP));
+
+GU_DEFINE_TYPE(
+	PgfConcr, struct, 
+	GU_MEMBER(PgfConcr, cflags, PgfFlagsP),
+	GU_MEMBER_P(PgfConcr, printnames, PgfPrintNames),
+	GU_MEMBER_P(PgfConcr, cnccats, PgfCncCatMap),
+	GU_MEMBER(PgfConcr, symbol_kss, PgfSymbolKSs),
+	GU_MEMBER(PgfConcr, symbol_kps, PgfSymbolKPs));
+#else
 GU_DEFINE_TYPE(
 	PgfConcr, struct, 
 	GU_MEMBER(PgfConcr, cflags, PgfFlagsP),
 	GU_MEMBER_P(PgfConcr, printnames, PgfPrintNames),
 	GU_MEMBER_P(PgfConcr, cnccats, PgfCncCatMap));
+#endif
 
 
 GU_DEFINE_TYPE(
@@ -25,8 +25,9 @@ typedef struct PgfAbstr PgfAbstr;
 typedef struct PgfFunDecl PgfFunDecl;
 
 typedef int PgfLength;
-typedef struct GuVariant PgfSymbol;
-extern GU_DECLARE_TYPE(PgfSymbol, GuVariant);
+typedef struct PgfSymbol PgfSymbol;
+typedef GU_SIZE_OPTIMIZED(uint64_t, uint32_t) PgfSymbolWord;
+extern GU_DECLARE_TYPE(PgfSymbol, struct);
 typedef struct PgfAlternative PgfAlternative;
 typedef GuSeq PgfAlternatives;
 typedef struct PgfCncFun PgfCncFun;
@@ -35,7 +36,9 @@ typedef int32_t PgfFId;
 
 
 typedef GuSeq PgfSequence; // -> PgfSymbol
+extern GU_DECLARE_TYPE(PgfSequence, GuSeq);
 
+extern GU_DECLARE_TYPE(PgfCncFun, struct);
 typedef PgfCncFun* PgfFunId; // key to PgfCncFuns
 extern GU_DECLARE_TYPE(PgfFunId, shared);
 typedef GuSeq PgfCncFuns; 
@@ -56,6 +59,7 @@ typedef struct PgfCatFun PgfCatFun;
 typedef GuSeq PgfCatFuns;			      
 typedef struct PgfCncCat PgfCncCat;
 extern GU_DECLARE_TYPE(PgfCncCat, struct);
+typedef struct PgfConcrLayout PgfConcrLayout;
 typedef GuVariant PgfPatt;
 typedef GuSeq PgfPatts;
 			      
@@ -107,6 +111,12 @@ struct PgfPGF {
 	PgfAbstr abstract;
 	PgfCIdMap* concretes; // |-> PgfConcr*
 	GuPool* pool;
+
+	GuMap* implicit_cats; // PgfCat* |-> bool
+	/**< The categories that are not declared in the abstract syntax
+	 * but that the reader has added to `abstract.cats` because a
+	 * concrete grammar has a concrete category for them, e.g. the
+	 * literal categories `String` and `Int`. */
 };
 
 struct PgfFunDecl {
@@ -196,6 +206,14 @@ pgf_ccat_set_fid(PgfCCat* ccat, PgfFId fid)
 	GU_SIZE_OPTIMIZED(ccat->fid = fid, (void) (ccat && fid));
 }
 
+/// The number of productions of a ccat. Ccats that the reader has only
+/// seen as arguments have no production sequence at all.
+static inline size_t
+pgf_ccat_n_prods(const PgfCCat* ccat)
+{
+	return gu_seq_is_null(ccat->prods) ? 0 : gu_seq_length(ccat->prods);
+}
+
 extern PgfCCat pgf_ccat_string, pgf_ccat_int, pgf_ccat_float, pgf_ccat_var;
 
 typedef PgfCIdMap PgfPrintNames;
@@ -204,6 +222,8 @@ extern GU_DECLARE_TYPE(PgfPrintNames, GuStringMap);
 typedef GuMap PgfCncCatMap;
 extern GU_DECLARE_TYPE(PgfCncCatMap, GuAddrMap);
 
+extern GU_DECLARE_TYPE(PgfCat, struct);
+
 typedef PgfCat PgfCatId;
 extern GU_DECLARE_TYPE(PgfCatId, alias);
 
@@ -215,6 +235,41 @@ struct PgfConcr {
 	PgfPrintNames* printnames;
 	PgfCncCatMap* cnccats;
 	PgfCCats extra_ccats;
+
+	PgfConcrLayout* layout;
+	/**< How the concrete grammar was numbered in the file that it
+	 * was read from, or NULL if it was not kept by
+	 * #pgf_read_pgf_keep_layout or has been changed since. */
+
+#ifdef GU_OPTIMIZE_SIZE
+	GuSeq symbol_kss; // PgfSymbolKS
+	GuSeq symbol_kps; // PgfSymbolKP
+	/**< The data of the KS and KP symbols of the sequences, which
+	 * refer to it by index. */
+#endif
+};
+
+/// The numbering of a concrete grammar in a PGF file.
+/** The reader resolves the indices of the file into pointers and forgets
+ * the parts that are not reachable. Keeping the indices lets the writer
+ * reproduce the file exactly. */
+struct PgfConcrLayout {
+	PgfSequences sequences;
+	/**< All the sequences of the file, in their order. */
+
+	PgfCncFuns cncfuns;
+	/**< All the concrete functions of the file, in their order. */
+
+	GuMap* lindefs; // PgfFId |-> PgfFunIds
+
+	GuMap* ccats; // PgfFId |-> PgfCCat*
+	/**< Every ccat that the file mentions, including those that it
+	 * only refers to. */
+
+	GuMap* firsts; // PgfCncCat* |-> PgfFId
+	/**< The first fid of the range of each concrete category. */
+
+	int32_t totalcats;
 };
 
 extern GU_DECLARE_TYPE(PgfConcr, struct);
@@ -254,6 +309,120 @@ typedef struct PgfSymbolKP
 	 * symbol. */
 } PgfSymbolKP;
 
+extern GU_DECLARE_TYPE(PgfSymbolIdx, struct);
+extern GU_DECLARE_TYPE(PgfSymbolKS, struct);
+extern GU_DECLARE_TYPE(PgfSymbolKP, struct);
+
+/// A symbol of a sequence, packed into a single word.
+/** The low bits hold the #PgfSymbolTag. A CAT, LIT or VAR symbol keeps
+ * its indices in the word itself, so a sequence is a dense array that the
+ * parser and the linearizer scan without following a pointer for every
+ * symbol.
+ *
+ * Normally the word has 64 bits: `d` is above the tag and `r` in the
+ * upper half, and the word of a KS or KP symbol is the address of its
+ * #PgfSymbolKS or #PgfSymbolKP, which must be aligned to
+ * #PGF_SYMBOL_ALIGN.
+ *
+ * With GU_OPTIMIZE_SIZE the word has 32 bits: `d` has 8 bits and `r` the
+ * remaining 21, and the word of a KS or KP symbol holds the index of its
+ * data in `symbol_kss` or `symbol_kps` of the concrete grammar. */
+struct PgfSymbol {
+	PgfSymbolWord word;
+};
+
+#define PGF_SYMBOL_TAG_BITS 3
+
+#define PGF_SYMBOL_ALIGN (1 << PGF_SYMBOL_TAG_BITS)
+
+#define PGF_SYMBOL_D_BITS GU_SIZE_OPTIMIZED((32 - PGF_SYMBOL_TAG_BITS), 8)
+
+#define PGF_SYMBOL_R_SHIFT \
+	GU_SIZE_OPTIMIZED(32, (PGF_SYMBOL_TAG_BITS + PGF_SYMBOL_D_BITS))
+
+/// The largest `d` that fits in a symbol.
+#define PGF_SYMBOL_MAX_D ((INT32_C(1) << PGF_SYMBOL_D_BITS) - 1)
+
+/// The largest `r` that fits in a symbol.
+#define PGF_SYMBOL_MAX_R \
+	GU_SIZE_OPTIMIZED(INT32_MAX, (INT32_C(1) << (32 - PGF_SYMBOL_R_SHIFT)) - 1)
+
+static inline PgfSymbolTag
+pgf_symbol_tag(PgfSymbol sym)
+{
+	return (PgfSymbolTag) (sym.word & (PGF_SYMBOL_ALIGN - 1));
+}
+
+static inline int32_t
+pgf_symbol_d(PgfSymbol sym)
+{
+	return (int32_t) ((sym.word >> PGF_SYMBOL_TAG_BITS) & PGF_SYMBOL_MAX_D);
+}
+
+static inline int32_t
+pgf_symbol_r(PgfSymbol sym)
+{
+	return (int32_t) (sym.word >> PGF_SYMBOL_R_SHIFT);
+}
+
+static inline PgfSymbolKS*
+pgf_symbol_ks(PgfConcr* concr, PgfSymbol sym)
+{
+#ifdef GU_OPTIMIZE_SIZE
+	return gu_seq_index(concr->symbol_kss, PgfSymbolKS,
+			    sym.word >> PGF_SYMBOL_TAG_BITS);
+#else
+	(void) concr;
+	PgfSymbolWord tag_mask = PGF_SYMBOL_ALIGN - 1;
+	return (PgfSymbolKS*) (uintptr_t) (sym.word & ~tag_mask);
+#endif
+}
+
+static inline PgfSymbolKP*
+pgf_symbol_kp(PgfConcr* concr, PgfSymbol sym)
+{
+#ifdef GU_OPTIMIZE_SIZE
+	return gu_seq_index(concr->symbol_kps, PgfSymbolKP,
+			    sym.word >> PGF_SYMBOL_TAG_BITS);
+#else
+	(void) concr;
+	PgfSymbolWord tag_mask = PGF_SYMBOL_ALIGN - 1;
+	return (PgfSymbolKP*) (uintptr_t) (sym.word & ~tag_mask);
+#endif
+}
+
+/// Make a CAT, LIT or VAR symbol. `d` and `r` must be at most
+/// #PGF_SYMBOL_MAX_D and #PGF_SYMBOL_MAX_R.
+static inline PgfSymbol
+pgf_symbol_idx(PgfSymbolTag tag, int32_t d, int32_t r)
+{
+	PgfSymbol sym = {
+		(PgfSymbolWord) (uint32_t) r << PGF_SYMBOL_R_SHIFT |
+		(PgfSymbolWord) (uint32_t) d << PGF_SYMBOL_TAG_BITS | tag
+	};
+	return sym;
+}
+
+#ifdef GU_OPTIMIZE_SIZE
+/// The largest index of KS or KP data that fits in a symbol.
+#define PGF_SYMBOL_MAX_REF ((UINT32_C(1) << (32 - PGF_SYMBOL_TAG_BITS)) - 1)
+
+/// Make a KS or KP symbol from the index of its data.
+static inline PgfSymbol
+pgf_symbol_ref(PgfSymbolTag tag, size_t idx)
+{
+	PgfSymbol sym = { (PgfSymbolWord) idx << PGF_SYMBOL_TAG_BITS | tag };
+	return sym;
+}
+#else
+/// Make a KS or KP symbol from its data.
+static inline PgfSymbol
+pgf_symbol_ptr(PgfSymbolTag tag, const void* data)
+{
+	PgfSymbol sym = { (PgfSymbolWord) (uintptr_t) data | tag };
+	return sym;
+}
+#endif
 
 
 
@@ -0,0 +1,110 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#include <pgf/epoch.h>
+#include <gu/mutex.h>
+#include <gu/assert.h>
+
+struct PgfEpoch {
+	PgfPGF* pgf;
+	void* data;
+	GuPool* pool;
+	GuMutex* mutex;
+	/**< Protects `refs`. */
+	size_t refs;
+};
+
+PgfEpoch*
+pgf_new_epoch(PgfPGF* pgf, void* data, GuPool* pool)
+{
+	PgfEpoch* epoch = gu_new(PgfEpoch, pool);
+	epoch->pgf = pgf;
+	epoch->data = data;
+	epoch->pool = pool;
+	epoch->mutex = gu_new_mutex(pool);
+	epoch->refs = 1;
+	return epoch;
+}
+
+PgfPGF*
+pgf_epoch_pgf(PgfEpoch* epoch)
+{
+	return epoch->pgf;
+}
+
+void*
+pgf_epoch_data(PgfEpoch* epoch)
+{
+	return epoch->data;
+}
+
+static void
+pgf_epoch_retain(PgfEpoch* epoch)
+{
+	gu_mutex_lock(epoch->mutex);
+	gu_assert(epoch->refs > 0);
+	epoch->refs++;
+	gu_mutex_unlock(epoch->mutex);
+}
+
+void
+pgf_epoch_release(PgfEpoch* epoch)
+{
+	gu_mutex_lock(epoch->mutex);
+	gu_assert(epoch->refs > 0);
+	size_t refs = --epoch->refs;
+	gu_mutex_unlock(epoch->mutex);
+	if (refs == 0) {
+		// No one else can reach the epoch any more, so the mutex can
+		// be destroyed with the pool.
+		gu_pool_free(epoch->pool);
+	}
+}
+
+
+struct PgfGrammarHandle {
+	GuMutex* mutex;
+	/**< Protects `current`. */
+	PgfEpoch* current;
+	GuFinalizer fin;
+};
+
+static void
+pgf_grammar_handle_finalize(GuFinalizer* fin)
+{
+	PgfGrammarHandle* handle =
+		gu_container(fin, PgfGrammarHandle, fin);
+	pgf_epoch_release(handle->current);
+}
+
+PgfGrammarHandle*
+pgf_new_grammar_handle(PgfEpoch* epoch, GuPool* pool)
+{
+	PgfGrammarHandle* handle = gu_new(PgfGrammarHandle, pool);
+	handle->mutex = gu_new_mutex(pool);
+	handle->current = epoch;
+	handle->fin.fn = pgf_grammar_handle_finalize;
+	gu_pool_finally(pool, &handle->fin);
+	return handle;
+}
+
+PgfEpoch*
+pgf_grammar_handle_acquire(PgfGrammarHandle* handle)
+{
+	// The handle holds a reference to the current epoch, so it can't
+	// be freed while we are retaining it.
+	gu_mutex_lock(handle->mutex);
+	PgfEpoch* epoch = handle->current;
+	pgf_epoch_retain(epoch);
+	gu_mutex_unlock(handle->mutex);
+	return epoch;
+}
+
+void
+pgf_grammar_handle_publish(PgfGrammarHandle* handle, PgfEpoch* epoch)
+{
+	gu_mutex_lock(handle->mutex);
+	PgfEpoch* old = handle->current;
+	handle->current = epoch;
+	gu_mutex_unlock(handle->mutex);
+	pgf_epoch_release(old);
+}
@@ -0,0 +1,93 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#ifndef PGF_EPOCH_H_
+#define PGF_EPOCH_H_
+
+#include <libgu.h>
+#include <pgf/pgf.h>
+
+/// Replacing a grammar while it is in use
+/** @file
+ *
+ * A grammar and everything built from it, such as parsers and
+ * linearizers, normally live in a pool of the caller, so the grammar can
+ * only be replaced once nothing uses it any more. For a long-running
+ * service this means stopping all traffic.
+ *
+ * An epoch is a version of a grammar whose pool is reference-counted. A
+ * #PgfGrammarHandle always refers to the current epoch. Each request
+ * acquires the current epoch when it begins and releases it when it is
+ * done. Publishing a new epoch doesn't wait for anything: requests that
+ * have already begun go on with the old epoch, new requests see the new
+ * one, and the pool of the old epoch is freed when its last user releases
+ * it.
+ */
+
+/// A reference-counted version of a grammar
+typedef struct PgfEpoch PgfEpoch;
+
+/// Create a new epoch.
+PgfEpoch*
+pgf_new_epoch(PgfPGF* pgf, void* data, GuPool* pool);
+/**<
+ * @param pgf The grammar of the epoch.
+ *
+ * @param data Anything else that belongs to the epoch, e.g. the parsers
+ * and linearizers of `pgf`.
+ *
+ * @param pool The pool from which `pgf` and `data` have been allocated.
+ * The epoch takes it over: it is freed when the last reference to the
+ * epoch is released, and must not be freed by anyone else.
+ *
+ * @return A new epoch with a single reference, owned by the caller.
+ */
+
+/// Get the grammar of an epoch.
+PgfPGF*
+pgf_epoch_pgf(PgfEpoch* epoch);
+
+/// Get the data of an epoch.
+void*
+pgf_epoch_data(PgfEpoch* epoch);
+
+/// Release a reference to an epoch.
+void
+pgf_epoch_release(PgfEpoch* epoch);
+/**< If this was the last reference, the pool of the epoch is freed. */
+
+
+/// A handle to the current epoch of a grammar
+typedef struct PgfGrammarHandle PgfGrammarHandle;
+
+/// Create a new grammar handle.
+PgfGrammarHandle*
+pgf_new_grammar_handle(PgfEpoch* epoch, GuPool* pool);
+/**<
+ * @param epoch The initial epoch. The handle takes over the caller's
+ * reference to it.
+ *
+ * @pool
+ *
+ * When `pool` is freed, the handle releases its reference to the current
+ * epoch.
+ */
+
+/// Acquire the current epoch.
+PgfEpoch*
+pgf_grammar_handle_acquire(PgfGrammarHandle* handle);
+/**< @return The current epoch, with a new reference that the caller must
+ * release with #pgf_epoch_release. The epoch is not freed before that,
+ * even if a new epoch is published in the meantime. */
+
+/// Make an epoch the current one.
+void
+pgf_grammar_handle_publish(PgfGrammarHandle* handle, PgfEpoch* epoch);
+/**<
+ * @param epoch The new epoch. The handle takes over the caller's reference
+ * to it.
+ *
+ * The handle releases its reference to the previous epoch, which is freed
+ * at once if no one else has acquired it.
+ */
+
+#endif // PGF_EPOCH_H_
@@ -2,8 +2,11 @@
 
 #include "expr.h"
 #include <gu/intern.h>
+#include <gu/map.h>
 #include <gu/assert.h>
 #include <ctype.h>
+#include <stdio.h>
+#include <string.h>
 
 
 PgfExpr
@@ -144,6 +147,8 @@ struct PgfExprParser {
 	GuIntern* intern;
 	GuExn* err;
 	GuPool* expr_pool;
+	PgfExprFactory* factory;
+	/**< The factory of the expressions, or `NULL`. */
 	const char* lookahead;
 	int next_char; // 0 = EOF
 };
@@ -263,6 +268,9 @@ pgf_expr_parser_term(PgfExprParser* parser)
 	} else if (pgf_expr_parser_token_is_id(la)) {
 		pgf_expr_parser_consume(parser);
 		GuString s = gu_str_string(la, parser->expr_pool);
+		if (parser->factory != NULL) {
+			return pgf_expr_factory_fun(parser->factory, s);
+		}
 		return gu_new_variant_i(parser->expr_pool,
 					PGF_EXPR_FUN,
 					PgfExprFun,
@@ -284,6 +292,10 @@ pgf_expr_parser_expr(PgfExprParser* parser)
 		if (gu_variant_is_null(arg)) {
 			return expr;
 		}
+		if (parser->factory != NULL) {
+			expr = pgf_expr_factory_app(parser->factory, expr, arg);
+			continue;
+		}
 		expr = gu_new_variant_i(parser->expr_pool,
 					PGF_EXPR_APP,
 					PgfExprApp,
@@ -293,8 +305,9 @@ pgf_expr_parser_expr(PgfExprParser* parser)
 
 
 
-PgfExpr
-pgf_read_expr(GuReader* rdr, GuPool* pool, GuExn* exn)
+static PgfExpr
+pgf_expr_read(GuReader* rdr, PgfExprFactory* factory, GuPool* pool,
+	      GuExn* exn)
 {
 	GuPool* tmp_pool = gu_new_pool();
 	GuExn* eof_exn = gu_exn(exn, GuEOF, tmp_pool);
@@ -302,6 +315,7 @@ pgf_read_expr(GuReader* rdr, GuPool* pool, GuExn* exn)
 	parser->rdr = rdr;
 	parser->intern = gu_new_intern(pool, tmp_pool);
 	parser->expr_pool = pool;
+	parser->factory = factory;
 	parser->err = eof_exn;
 	parser->lookahead = NULL;
 	parser->next_char = -1;
@@ -317,6 +331,12 @@ pgf_read_expr(GuReader* rdr, GuPool* pool, GuExn* exn)
 	return expr;
 }
 
+PgfExpr
+pgf_read_expr(GuReader* rdr, GuPool* pool, GuExn* exn)
+{
+	return pgf_expr_read(rdr, NULL, pool, exn);
+}
+
 static void
 pgf_expr_print_with_paren(PgfExpr expr, bool need_paren,
 			  GuWriter* wtr, GuExn* err)
@@ -362,3 +382,388 @@ void
 pgf_expr_print(PgfExpr expr, GuWriter* wtr, GuExn* err) {
 	pgf_expr_print_with_paren(expr, false, wtr, err);
 }
+
+
+//
+// Reading and printing contiguous UTF-8 text
+//
+
+typedef struct PgfExprScanner PgfExprScanner;
+
+struct PgfExprScanner {
+	const uint8_t* p;
+	const uint8_t* end;
+	PgfExprFactory* factory;
+	GuPool* pool;
+	bool error;
+};
+
+static inline bool
+pgf_expr_scanner_id_start(uint8_t c)
+{
+	return c >= 0x80 || isalpha(c);
+}
+
+static inline bool
+pgf_expr_scanner_id_char(uint8_t c)
+{
+	return c >= 0x80 || isalnum(c) || c == '_';
+}
+
+static void
+pgf_expr_scanner_skip_space(PgfExprScanner* scan)
+{
+	while (scan->p < scan->end && isspace(*scan->p)) {
+		scan->p++;
+	}
+}
+
+static PgfExpr
+pgf_expr_scanner_expr(PgfExprScanner* scan);
+
+static PgfExpr
+pgf_expr_scanner_term(PgfExprScanner* scan)
+{
+	pgf_expr_scanner_skip_space(scan);
+	if (scan->p == scan->end) {
+		return gu_null_variant;
+	}
+	uint8_t c = *scan->p;
+	if (c == '(') {
+		scan->p++;
+		PgfExpr expr = pgf_expr_scanner_expr(scan);
+		pgf_expr_scanner_skip_space(scan);
+		if (gu_variant_is_null(expr)
+		    || scan->p == scan->end || *scan->p != ')') {
+			scan->error = true;
+			return gu_null_variant;
+		}
+		scan->p++;
+		return expr;
+	} else if (pgf_expr_scanner_id_start(c)) {
+		const uint8_t* begin = scan->p++;
+		while (scan->p < scan->end
+		       && pgf_expr_scanner_id_char(*scan->p)) {
+			scan->p++;
+		}
+		GuString s = gu_utf8_string(gu_cslice(begin, scan->p - begin),
+					    scan->pool);
+		if (scan->factory != NULL) {
+			return pgf_expr_factory_fun(scan->factory, s);
+		}
+		return gu_new_variant_i(scan->pool,
+					PGF_EXPR_FUN,
+					PgfExprFun,
+					s);
+	}
+	return gu_null_variant;
+}
+
+static PgfExpr
+pgf_expr_scanner_expr(PgfExprScanner* scan)
+{
+	PgfExpr expr = pgf_expr_scanner_term(scan);
+	if (gu_variant_is_null(expr)) {
+		return expr;
+	}
+	while (!scan->error) {
+		PgfExpr arg = pgf_expr_scanner_term(scan);
+		if (gu_variant_is_null(arg)) {
+			break;
+		}
+		if (scan->factory != NULL) {
+			expr = pgf_expr_factory_app(scan->factory, expr, arg);
+			continue;
+		}
+		expr = gu_new_variant_i(scan->pool,
+					PGF_EXPR_APP,
+					PgfExprApp,
+					expr, arg);
+	}
+	return expr;
+}
+
+PgfExpr
+pgf_expr_scan(GuCSlice* text, PgfExprFactory* factory,
+	      GuPool* pool, GuExn* err)
+{
+	PgfExprScanner scan = {
+		.p = text->p,
+		.end = text->p + text->sz,
+		.factory = factory,
+		.pool = pool,
+		.error = false
+	};
+	PgfExpr expr = pgf_expr_scanner_expr(&scan);
+	if (!scan.error) {
+		pgf_expr_scanner_skip_space(&scan);
+		if (scan.p < scan.end && *scan.p == ';'
+		    && !gu_variant_is_null(expr)) {
+			scan.p++;
+		} else if (scan.p < scan.end) {
+			// An empty expression is only allowed at the end,
+			// so that a stray `;` is not taken for it.
+			scan.error = true;
+		}
+	}
+	if (scan.error) {
+		gu_raise(err, PgfReadExn);
+		return gu_null_variant;
+	}
+	text->sz -= scan.p - text->p;
+	text->p = scan.p;
+	return expr;
+}
+
+static void
+pgf_expr_push_utf8_with_paren(PgfExpr expr, bool need_paren,
+			      GuByteBuf* buf)
+{
+	GuVariantInfo ei = gu_variant_open(expr);
+	switch (ei.tag) {
+	case PGF_EXPR_FUN: {
+		PgfExprFun* fun = ei.data;
+		gu_string_push_utf8(fun->fun, buf);
+		break;
+	}
+	case PGF_EXPR_APP: {
+		PgfExprApp* app = ei.data;
+		if (need_paren) {
+			gu_buf_push(buf, uint8_t, '(');
+		}
+		pgf_expr_push_utf8_with_paren(app->fun, false, buf);
+		gu_buf_push(buf, uint8_t, ' ');
+		pgf_expr_push_utf8_with_paren(app->arg, true, buf);
+		if (need_paren) {
+			gu_buf_push(buf, uint8_t, ')');
+		}
+		break;
+	}
+	case PGF_EXPR_META: {
+		PgfExprMeta* meta = ei.data;
+		char num[16];
+		int len = snprintf(num, sizeof(num), "?%d", meta->id);
+		gu_buf_push_n(buf, (const uint8_t*) num, len);
+		break;
+	}
+	case PGF_EXPR_ABS:
+	case PGF_EXPR_LIT:
+	case PGF_EXPR_VAR:
+	case PGF_EXPR_TYPED:
+	case PGF_EXPR_IMPL_ARG:
+		gu_impossible();
+		break;
+	default:
+		gu_impossible();
+	}
+}
+
+void
+pgf_expr_push_utf8(PgfExpr expr, GuByteBuf* buf)
+{
+	pgf_expr_push_utf8_with_paren(expr, false, buf);
+}
+
+
+//
+// Hash-consing
+//
+
+typedef struct PgfExprKey PgfExprKey;
+
+// The contents of a hash-consed node. The children of an application are
+// compared by address, since they are hash-consed themselves.
+struct PgfExprKey {
+	int tag;
+	int lit_tag;
+	PgfExpr fun;
+	PgfExpr arg;
+	GuString str;
+	int ival;
+	double fval;
+};
+
+static GuHash
+pgf_expr_key_hash(GuHasher* self, GuHash h, const void* p)
+{
+	const PgfExprKey* key = p;
+	h = h * 31 + (GuHash) key->tag;
+	h = h * 31 + (GuHash) key->lit_tag;
+	h = h * 31 + gu_hash_ptr(gu_variant_to_ptr(key->fun));
+	h = h * 31 + gu_hash_ptr(gu_variant_to_ptr(key->arg));
+	h = h * 31 + gu_string_hash(key->str);
+	h = h * 31 + (GuHash) key->ival;
+	return gu_hash_bytes(h, (const uint8_t*) &key->fval,
+			     sizeof(key->fval));
+}
+
+static bool
+pgf_expr_key_eq(GuEq* self, const void* p1, const void* p2)
+{
+	const PgfExprKey* key1 = p1;
+	const PgfExprKey* key2 = p2;
+	return key1->tag == key2->tag &&
+		key1->lit_tag == key2->lit_tag &&
+		pgf_expr_is_same(key1->fun, key2->fun) &&
+		pgf_expr_is_same(key1->arg, key2->arg) &&
+		gu_string_eq(key1->str, key2->str) &&
+		key1->ival == key2->ival &&
+		memcmp(&key1->fval, &key2->fval, sizeof(key1->fval)) == 0;
+}
+
+static GU_DEFINE_HASHER(pgf_expr_key_hasher,
+			pgf_expr_key_hash, pgf_expr_key_eq);
+
+struct PgfExprFactory {
+	GuPool* pool;
+	GuMap* exprs;
+	/**< Maps each #PgfExprKey to its node. */
+};
+
+PgfExprFactory*
+pgf_new_expr_factory(GuPool* pool)
+{
+	PgfExprFactory* ef = gu_new(PgfExprFactory, pool);
+	ef->pool = pool;
+	ef->exprs = gu_new_map(PgfExprKey, pgf_expr_key_hasher,
+			       PgfExpr, &gu_null_variant, pool);
+	return ef;
+}
+
+static PgfExprKey
+pgf_expr_key(int tag)
+{
+	PgfExprKey key;
+	memset(&key, 0, sizeof(key));
+	key.tag = tag;
+	key.lit_tag = -1;
+	key.fun = gu_null_variant;
+	key.arg = gu_null_variant;
+	key.str = gu_null_string;
+	return key;
+}
+
+PgfExpr
+pgf_expr_factory_fun(PgfExprFactory* ef, PgfCId fun)
+{
+	PgfExprKey key = pgf_expr_key(PGF_EXPR_FUN);
+	key.str = fun;
+	PgfExpr expr = gu_map_get(ef->exprs, &key, PgfExpr);
+	if (gu_variant_is_null(expr)) {
+		key.str = gu_string_copy(fun, ef->pool);
+		expr = gu_new_variant_i(ef->pool, PGF_EXPR_FUN, PgfExprFun,
+					.fun = key.str);
+		gu_map_put(ef->exprs, &key, PgfExpr, expr);
+	}
+	return expr;
+}
+
+PgfExpr
+pgf_expr_factory_app(PgfExprFactory* ef, PgfExpr fun, PgfExpr arg)
+{
+	PgfExprKey key = pgf_expr_key(PGF_EXPR_APP);
+	key.fun = fun;
+	key.arg = arg;
+	PgfExpr expr = gu_map_get(ef->exprs, &key, PgfExpr);
+	if (gu_variant_is_null(expr)) {
+		expr = gu_new_variant_i(ef->pool, PGF_EXPR_APP, PgfExprApp,
+					.fun = fun, .arg = arg);
+		gu_map_put(ef->exprs, &key, PgfExpr, expr);
+	}
+	return expr;
+}
+
+PgfExpr
+pgf_expr_factory_lit(PgfExprFactory* ef, PgfLiteral lit)
+{
+	PgfExprKey key = pgf_expr_key(PGF_EXPR_LIT);
+	GuVariantInfo i = gu_variant_open(lit);
+	key.lit_tag = i.tag;
+	switch (i.tag) {
+	case PGF_LITERAL_STR:
+		key.str = ((PgfLiteralStr*) i.data)->val;
+		break;
+	case PGF_LITERAL_INT:
+		key.ival = ((PgfLiteralInt*) i.data)->val;
+		break;
+	case PGF_LITERAL_FLT:
+		key.fval = ((PgfLiteralFlt*) i.data)->val;
+		break;
+	default:
+		gu_impossible();
+	}
+	PgfExpr expr = gu_map_get(ef->exprs, &key, PgfExpr);
+	if (gu_variant_is_null(expr)) {
+		PgfLiteral elit = gu_null_variant;
+		switch (i.tag) {
+		case PGF_LITERAL_STR:
+			key.str = gu_string_copy(key.str, ef->pool);
+			elit = gu_new_variant_i(ef->pool, PGF_LITERAL_STR,
+						PgfLiteralStr,
+						.val = key.str);
+			break;
+		case PGF_LITERAL_INT:
+			elit = gu_new_variant_i(ef->pool, PGF_LITERAL_INT,
+						PgfLiteralInt,
+						.val = key.ival);
+			break;
+		case PGF_LITERAL_FLT:
+			elit = gu_new_variant_i(ef->pool, PGF_LITERAL_FLT,
+						PgfLiteralFlt,
+						.val = key.fval);
+			break;
+		}
+		expr = gu_new_variant_i(ef->pool, PGF_EXPR_LIT, PgfExprLit,
+					.lit = elit);
+		gu_map_put(ef->exprs, &key, PgfExpr, expr);
+	}
+	return expr;
+}
+
+PgfExpr
+pgf_expr_factory_meta(PgfExprFactory* ef, PgfMetaId id)
+{
+	PgfExprKey key = pgf_expr_key(PGF_EXPR_META);
+	key.ival = id;
+	PgfExpr expr = gu_map_get(ef->exprs, &key, PgfExpr);
+	if (gu_variant_is_null(expr)) {
+		expr = gu_new_variant_i(ef->pool, PGF_EXPR_META, PgfExprMeta,
+					.id = id);
+		gu_map_put(ef->exprs, &key, PgfExpr, expr);
+	}
+	return expr;
+}
+
+PgfExpr
+pgf_expr_factory_intern(PgfExprFactory* ef, PgfExpr expr)
+{
+	GuVariantInfo ei = gu_variant_open(expr);
+	switch (ei.tag) {
+	case PGF_EXPR_FUN: {
+		PgfExprFun* efun = ei.data;
+		return pgf_expr_factory_fun(ef, efun->fun);
+	}
+	case PGF_EXPR_APP: {
+		PgfExprApp* eapp = ei.data;
+		PgfExpr fun = pgf_expr_factory_intern(ef, eapp->fun);
+		PgfExpr arg = pgf_expr_factory_intern(ef, eapp->arg);
+		return pgf_expr_factory_app(ef, fun, arg);
+	}
+	case PGF_EXPR_LIT: {
+		PgfExprLit* elit = ei.data;
+		return pgf_expr_factory_lit(ef, elit->lit);
+	}
+	case PGF_EXPR_META: {
+		PgfExprMeta* emeta = ei.data;
+		return pgf_expr_factory_meta(ef, emeta->id);
+	}
+	default:
+		return expr;
+	}
+}
+
+PgfExpr
+pgf_expr_factory_read(PgfExprFactory* ef, GuReader* rdr, GuExn* err)
+{
+	return pgf_expr_read(rdr, ef, ef->pool, err);
+}
@@ -149,4 +149,96 @@ pgf_read_expr(GuReader* rdr, GuPool* pool, GuExn* err);
 void
 pgf_expr_print(PgfExpr expr, GuWriter* wtr, GuExn* err);
 
+/// A factory of hash-consed expressions
+typedef struct PgfExprFactory PgfExprFactory;
+/**<
+ * An expression factory builds each distinct function, application,
+ * literal and metavariable node only once. Two expressions built by the
+ * same factory are structurally equal exactly when they are the same
+ * #PgfExpr value, so they can be compared with #pgf_expr_is_same and
+ * hashed by address, and readings that share subtrees share memory.
+ *
+ * A factory is not thread-safe.
+ */
+
+/// Create a new expression factory.
+PgfExprFactory*
+pgf_new_expr_factory(GuPool* pool);
+/**<
+ * @pool The pool from which the expressions of the factory are
+ * allocated.
+ */
+
+/// Get the expression for the function `fun`.
+PgfExpr
+pgf_expr_factory_fun(PgfExprFactory* ef, PgfCId fun);
+
+/// Get the application of `fun` to `arg`.
+PgfExpr
+pgf_expr_factory_app(PgfExprFactory* ef, PgfExpr fun, PgfExpr arg);
+/**< `fun` and `arg` should have been built by `ef`. Other expressions
+ * are accepted, but applications of them are only shared when the
+ * very same expressions are used again. */
+
+/// Get the expression for the literal `lit`.
+PgfExpr
+pgf_expr_factory_lit(PgfExprFactory* ef, PgfLiteral lit);
+
+/// Get the expression for the metavariable `id`.
+PgfExpr
+pgf_expr_factory_meta(PgfExprFactory* ef, PgfMetaId id);
+
+/// Get the hash-consed equivalent of an expression.
+PgfExpr
+pgf_expr_factory_intern(PgfExprFactory* ef, PgfExpr expr);
+/**< Abstractions, variables and typed and implicit arguments are not
+ * hash-consed and are returned as they are. */
+
+/// Check whether two hash-consed expressions are equal.
+static inline bool
+pgf_expr_is_same(PgfExpr e1, PgfExpr e2)
+{
+	return gu_variant_to_ptr(e1) == gu_variant_to_ptr(e2);
+}
+
+/// Read a hash-consed expression.
+PgfExpr
+pgf_expr_factory_read(PgfExprFactory* ef, GuReader* rdr, GuExn* err);
+/**< Like #pgf_read_expr, but the expression is built by `ef`. */
+
+/// Read an expression from the beginning of a UTF-8 text.
+PgfExpr
+pgf_expr_scan(GuCSlice* text, PgfExprFactory* factory,
+	      GuPool* pool, GuExn* err);
+/**<
+ * Accepts the same syntax as #pgf_read_expr, but scans the bytes of
+ * `text` directly instead of decoding characters from a #GuReader, and
+ * copies each identifier in one piece. This is the fast path for
+ * reading large treebanks that are already in memory.
+ *
+ * @param text The text to read. On success it is advanced past the
+ * expression and the `;` that terminates it, if any, so that a sequence
+ * of expressions separated by `;` can be read by calling this function
+ * repeatedly until it returns `gu_null_variant`.
+ *
+ * @param factory The factory that builds the expression, or `NULL` to
+ * allocate a fresh expression from `pool`.
+ *
+ * @pool
+ *
+ * @return The expression, or `gu_null_variant` if `text` contains only
+ * whitespace.
+ *
+ * @throws PgfReadExn if the text is not a well-formed expression, e.g.
+ * if a `;` is not preceded by an expression. `text` is then left
+ * unchanged.
+ */
+
+/// Print an expression into a UTF-8 byte buffer.
+void
+pgf_expr_push_utf8(PgfExpr expr, GuByteBuf* buf);
+/**< The output is the same as that of #pgf_expr_print, but the bytes of
+ * function names are appended to `buf` directly, without going through a
+ * #GuWriter. */
+
 #endif /* EXPR_H_ */
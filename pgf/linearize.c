@@ -11,6 +11,8 @@
 #include <gu/assert.h>
 #include <gu/generic.h>
 #include <pgf/expr.h>
+#include <stdlib.h>
+#include <stdio.h>
 
 typedef GuStringMap PgfLinInfer;
 typedef GuSeq PgfProdSeq;
@@ -22,16 +24,10 @@ typedef struct PgfLinInferEntry PgfLinInferEntry;
 struct PgfLinInferEntry {
 	PgfCCat* cat;
 	PgfCncFun* fun;
+	PgfPArgs args;
 };
 
-static GU_DEFINE_TYPE(
-	PgfLinInferEntry, struct,
-	GU_MEMBER_P(PgfLinInferEntry, cat, PgfCCat)
-	// ,GU_MEMBER(PgfLinInferEntry, fun, ...)
-	);
-
 typedef GuBuf PgfLinInfers;
-static GU_DEFINE_TYPE(PgfLinInfers, GuBuf, gu_type(PgfLinInferEntry));
 
 typedef GuMap PgfCncProds;
 static GU_DEFINE_TYPE(PgfCncProds, GuMap,
@@ -43,13 +39,32 @@ static GU_DEFINE_TYPE(PgfLinProds, GuStringMap, gu_ptr_type(PgfCncProds),
 		      &gu_null_struct);
 
 
-typedef GuMap PgfInferMap;
-static GU_DEFINE_TYPE(PgfInferMap, GuMap,
-		      gu_type(PgfCCatIds), NULL,
-		      gu_ptr_type(PgfLinInfers), &gu_null_struct);
+typedef struct PgfLinDispatch PgfLinDispatch;
+typedef struct PgfLinDispatchEdge PgfLinDispatchEdge;
+
+struct PgfLinDispatchEdge {
+	PgfCCat* cat;
+	PgfLinDispatch* next;
+};
+
+/// A decision tree over the argument categories of a function's productions
+struct PgfLinDispatch {
+	PgfLinDispatchEdge* edges;
+	/**< The categories of the next argument, sorted by address, each
+	 * with the decision tree for the remaining arguments. */
+	size_t n_edges;
+	PgfLinInfers* entries;
+	/**< The productions whose argument categories are the ones on
+	 * the path to this node. */
+	GuMap* build_edges;
+	/**< Maps the categories of the next argument to their subtrees
+	 * while the linearizer is being created. */
+};
+
+static GU_DEFINE_TYPE(PgfLinDispatch, abstract, _);
 
 typedef GuStringMap PgfFunIndices;
-static GU_DEFINE_TYPE(PgfFunIndices, GuStringMap, gu_ptr_type(PgfInferMap),
+static GU_DEFINE_TYPE(PgfFunIndices, GuStringMap, gu_ptr_type(PgfLinDispatch),
 		      &gu_null_struct);
 
 typedef GuBuf PgfCCatBuf;
@@ -60,78 +75,312 @@ static GU_DEFINE_TYPE(PgfCoerceIdx, GuMap,
 		      gu_type(PgfCCat), NULL,
 		      gu_ptr_type(PgfCCatBuf), &gu_null_struct);
 
+typedef GuMap PgfSupercatIdx;
+static GU_DEFINE_TYPE(PgfSupercatIdx, GuMap,
+		      gu_type(PgfCCat), NULL,
+		      gu_type(PgfCCatIds), &gu_null_seq);
+
+typedef struct PgfKPTrie PgfKPTrie;
+
+/// A trie of the prefixes that select the alternatives of a #PgfSymbolKP
+struct PgfKPTrie {
+	int alt;
+	/**< The index of the first alternative that has a prefix ending
+	 * at this node, or -1 if there is none. */
+	size_t n_children;
+	uint8_t* bytes;
+	/**< The bytes on the edges to the children. */
+	PgfKPTrie* children;
+};
+
 struct PgfLzr {
 	PgfConcr* cnc;
 	GuPool* pool;
-	GuHasher* ccat_ids_hasher;
 	PgfFunIndices* fun_indices;
 	PgfCoerceIdx* coerce_idx;
+	PgfSupercatIdx* supercat_idx;
+	/**< Maps each category that can be coerced to another one to
+	 * all the categories that it can be coerced to, directly or
+	 * transitively, including itself. The categories are sorted by
+	 * address. */
+	GuMap* kp_tries;
+	/**< Maps each prefix-dependent symbol of the grammar to the
+	 * #PgfKPTrie of the prefixes of its alternatives. */
 };
 
 GU_DEFINE_TYPE(
 	PgfLzr, struct,
 	GU_MEMBER_P(PgfLzr, cnc, PgfConcr),
 	GU_MEMBER_P(PgfLzr, fun_indices, PgfFunIndices),
-	GU_MEMBER_P(PgfLzr, coerce_idx, PgfCoerceIdx));
+	GU_MEMBER_P(PgfLzr, coerce_idx, PgfCoerceIdx),
+	GU_MEMBER_P(PgfLzr, supercat_idx, PgfSupercatIdx));
 
 
 
 
+static PgfLinDispatch*
+pgf_lzr_new_dispatch(GuPool* pool, GuPool* tmp_pool)
+{
+	PgfLinDispatch* disp = gu_new(PgfLinDispatch, pool);
+	disp->edges = NULL;
+	disp->n_edges = 0;
+	disp->entries = NULL;
+	disp->build_edges = gu_new_addr_map(PgfCCat, PgfLinDispatch*,
+					    &gu_null_struct, tmp_pool);
+	return disp;
+}
+
 static void
 pgf_lzr_add_infer_entry(PgfLzr* lzr,
-			PgfInferMap* infer_table,
+			PgfLinDispatch* disp,
 			PgfCCat* cat,
-			PgfProductionApply* papply)
+			PgfProductionApply* papply,
+			GuPool* tmp_pool)
 {
 	PgfPArgs args = papply->args;
 	size_t n_args = gu_seq_length(args);
-	PgfCCatIds arg_cats = gu_new_seq(PgfCCatId, n_args, lzr->pool);
+	gu_debug("%d,%d,%d -> %d, %s",
+		 n_args > 0 ? gu_seq_get(args, PgfPArg, 0).ccat->fid : -1,
+		 n_args > 1 ? gu_seq_get(args, PgfPArg, 1).ccat->fid : -1,
+		 n_args > 2 ? gu_seq_get(args, PgfPArg, 2).ccat->fid : -1,
+		 cat->fid, papply->fun->fun);
 	for (size_t i = 0; i < n_args; i++) {
 		// XXX: What about the hypos in the args?
-		gu_seq_set(arg_cats, PgfCCatId, i, gu_seq_get(args, PgfPArg, i).ccat);
+		PgfCCat* arg_cat = gu_seq_get(args, PgfPArg, i).ccat;
+		PgfLinDispatch* next =
+			gu_map_get(disp->build_edges, arg_cat, PgfLinDispatch*);
+		if (!next) {
+			next = pgf_lzr_new_dispatch(lzr->pool, tmp_pool);
+			gu_map_put(disp->build_edges, arg_cat,
+				   PgfLinDispatch*, next);
+		}
+		disp = next;
 	}
-	gu_debug("%d,%d,%d -> %d, %s",
-		 n_args > 0 ? gu_seq_get(arg_cats, PgfCCatId, 0)->fid : -1,
-		 n_args > 1 ? gu_seq_get(arg_cats, PgfCCatId, 1)->fid : -1,
-		 n_args > 2 ? gu_seq_get(arg_cats, PgfCCatId, 2)->fid : -1,
-		 cat->fid, papply->fun->fun);
-	PgfLinInfers* entries =
-		gu_map_get(infer_table, &arg_cats, PgfLinInfers*);
-	if (!entries) {
-		entries = gu_new_buf(PgfLinInferEntry, lzr->pool);
-		gu_map_put(infer_table, &arg_cats, PgfLinInfers*, entries);
-	} else {
-		// XXX: arg_cats is duplicate, we ought to free it
-		// Display warning?
+	if (!disp->entries) {
+		disp->entries = gu_new_buf(PgfLinInferEntry, lzr->pool);
 	}
-
 	PgfLinInferEntry entry = {
 		.cat = cat,
-		.fun = papply->fun
+		.fun = papply->fun,
+		.args = args
 	};
-	gu_buf_push(entries, PgfLinInferEntry, entry);
+	gu_buf_push(disp->entries, PgfLinInferEntry, entry);
+}
+
+static int
+pgf_lin_dispatch_edge_cmp(const void* p1, const void* p2)
+{
+	uintptr_t a1 = (uintptr_t) ((const PgfLinDispatchEdge*) p1)->cat;
+	uintptr_t a2 = (uintptr_t) ((const PgfLinDispatchEdge*) p2)->cat;
+	return (a1 > a2) - (a1 < a2);
+}
+
+typedef struct {
+	GuMapItor fn;
+	PgfLinDispatch* disp;
+} PgfLzrCompileFn;
+
+static void
+pgf_lzr_compile_dispatch(PgfLinDispatch* disp, GuPool* pool);
+
+static void
+pgf_lzr_compile_edge_cb(GuMapItor* fn, const void* key, void* value,
+			GuExn* err)
+{
+	PgfLzrCompileFn* clo = (PgfLzrCompileFn*) fn;
+	PgfLinDispatch* next = *(PgfLinDispatch**) value;
+	PgfLinDispatchEdge* edge = &clo->disp->edges[clo->disp->n_edges++];
+	edge->cat = (PgfCCat*) key;
+	edge->next = next;
+}
+
+// Turn the edge maps of a decision tree into sorted arrays.
+static void
+pgf_lzr_compile_dispatch(PgfLinDispatch* disp, GuPool* pool)
+{
+	size_t n_edges = gu_map_count(disp->build_edges);
+	disp->edges = gu_new_n(PgfLinDispatchEdge, GU_MAX(n_edges, 1), pool);
+	disp->n_edges = 0;
+	PgfLzrCompileFn clo = { { pgf_lzr_compile_edge_cb }, disp };
+	gu_map_iter(disp->build_edges, &clo.fn, gu_null_exn());
+	gu_assert(disp->n_edges == n_edges);
+	disp->build_edges = NULL;
+	qsort(disp->edges, disp->n_edges, sizeof(PgfLinDispatchEdge),
+	      pgf_lin_dispatch_edge_cmp);
+	for (size_t i = 0; i < disp->n_edges; i++) {
+		pgf_lzr_compile_dispatch(disp->edges[i].next, pool);
+	}
+}
+
+typedef struct {
+	GuMapItor fn;
+	GuPool* pool;
+} PgfLzrCompileFunFn;
+
+static void
+pgf_lzr_compile_fun_cb(GuMapItor* fn, const void* key, void* value,
+		       GuExn* err)
+{
+	PgfLzrCompileFunFn* clo = (PgfLzrCompileFunFn*) fn;
+	PgfLinDispatch* disp = *(PgfLinDispatch**) value;
+	pgf_lzr_compile_dispatch(disp, clo->pool);
 }
 			
 
+//
+// Prefix-dependent symbols
+//
+
+typedef struct PgfKPPrefix PgfKPPrefix;
+
+struct PgfKPPrefix {
+	GuSlice bytes;
+	int alt;
+};
+
+static int
+pgf_kp_prefix_cmp(const void* p1, const void* p2)
+{
+	const PgfKPPrefix* pfx1 = p1;
+	const PgfKPPrefix* pfx2 = p2;
+	int cmp = memcmp(pfx1->bytes.p, pfx2->bytes.p,
+			 GU_MIN(pfx1->bytes.sz, pfx2->bytes.sz));
+	if (cmp == 0) {
+		cmp = (pfx1->bytes.sz > pfx2->bytes.sz) -
+			(pfx1->bytes.sz < pfx2->bytes.sz);
+	}
+	return cmp;
+}
+
+// Build a trie node from `pfxs`, which are sorted and share their first
+// `depth` bytes.
 static void
-pgf_lzr_index(PgfLzr* lzr, PgfCCat* cat, PgfProduction prod)
+pgf_lzr_build_kp_trie(PgfKPTrie* node, PgfKPPrefix* pfxs, size_t n_pfxs,
+		      size_t depth, GuPool* pool)
+{
+	node->alt = -1;
+	size_t i = 0;
+	for (; i < n_pfxs && pfxs[i].bytes.sz == depth; i++) {
+		if (node->alt < 0 || pfxs[i].alt < node->alt) {
+			node->alt = pfxs[i].alt;
+		}
+	}
+	size_t n_children = 0;
+	for (size_t j = i; j < n_pfxs; j++) {
+		if (j == i || pfxs[j].bytes.p[depth] !=
+		    pfxs[j - 1].bytes.p[depth]) {
+			n_children++;
+		}
+	}
+	node->n_children = n_children;
+	node->bytes = gu_new_n(uint8_t, GU_MAX(n_children, 1), pool);
+	node->children = gu_new_n(PgfKPTrie, GU_MAX(n_children, 1), pool);
+	for (size_t c = 0; c < n_children; c++) {
+		uint8_t byte = pfxs[i].bytes.p[depth];
+		size_t j = i + 1;
+		while (j < n_pfxs && pfxs[j].bytes.p[depth] == byte) {
+			j++;
+		}
+		node->bytes[c] = byte;
+		pgf_lzr_build_kp_trie(&node->children[c], &pfxs[i], j - i,
+				      depth + 1, pool);
+		i = j;
+	}
+}
+
+static void
+pgf_lzr_index_kp(PgfLzr* lzr, PgfSymbolKP* kp, GuPool* tmp_pool)
+{
+	if (gu_map_has(lzr->kp_tries, kp)) {
+		return;
+	}
+	GuBuf* pfxs = gu_new_buf(PgfKPPrefix, tmp_pool);
+	size_t n_alts = gu_seq_length(kp->alts);
+	for (size_t i = 0; i < n_alts; i++) {
+		PgfAlternative* alt = gu_seq_index(kp->alts, PgfAlternative, i);
+		size_t n_prefixes = gu_seq_length(alt->prefixes);
+		for (size_t j = 0; j < n_prefixes; j++) {
+			GuString prefix = gu_seq_get(alt->prefixes, GuString, j);
+			PgfKPPrefix pfx = {
+				gu_string_utf8(prefix, tmp_pool), (int) i
+			};
+			gu_buf_push(pfxs, PgfKPPrefix, pfx);
+		}
+	}
+	size_t n_pfxs = gu_buf_length(pfxs);
+	qsort(gu_buf_data(pfxs), n_pfxs, sizeof(PgfKPPrefix),
+	      pgf_kp_prefix_cmp);
+	PgfKPTrie* trie = gu_new(PgfKPTrie, lzr->pool);
+	pgf_lzr_build_kp_trie(trie, gu_buf_data(pfxs), n_pfxs, 0, lzr->pool);
+	gu_map_put(lzr->kp_tries, kp, PgfKPTrie*, trie);
+}
+
+static void
+pgf_lzr_index_kps(PgfLzr* lzr, PgfCncFun* fun, GuPool* tmp_pool)
+{
+	size_t n_lins = gu_seq_length(fun->lins);
+	for (size_t l = 0; l < n_lins; l++) {
+		PgfSequence seq = gu_seq_get(fun->lins, PgfSequence, l);
+		size_t nsyms = gu_seq_length(seq);
+		for (size_t i = 0; i < nsyms; i++) {
+			PgfSymbol sym = gu_seq_get(seq, PgfSymbol, i);
+			if (pgf_symbol_tag(sym) == PGF_SYMBOL_KP) {
+				pgf_lzr_index_kp(lzr, pgf_symbol_kp(lzr->cnc, sym),
+						 tmp_pool);
+			}
+		}
+	}
+}
+
+// Return the form that `kp` takes when it is followed by `next`, which
+// is null at the end of the linearization.
+static PgfTokens
+pgf_lzr_kp_form(PgfLzr* lzr, PgfSymbolKP* kp, PgfToken next)
+{
+	PgfKPTrie* node = gu_map_get(lzr->kp_tries, kp, PgfKPTrie*);
+	if (node == NULL || gu_string_is_null(next)) {
+		return kp->default_form;
+	}
+	GuShortData short_data;
+	GuCSlice bytes = gu_string_open(next, &short_data);
+	int alt = node->alt;
+	for (size_t i = 0; i < bytes.sz && node->n_children > 0; i++) {
+		uint8_t* edge = memchr(node->bytes, bytes.p[i],
+				       node->n_children);
+		if (edge == NULL) {
+			break;
+		}
+		node = &node->children[edge - node->bytes];
+		if (node->alt >= 0 && (alt < 0 || node->alt < alt)) {
+			alt = node->alt;
+		}
+	}
+	if (alt < 0) {
+		return kp->default_form;
+	}
+	return gu_seq_index(kp->alts, PgfAlternative, alt)->form;
+}
+
+
+static void
+pgf_lzr_index(PgfLzr* lzr, PgfCCat* cat, PgfProduction prod,
+	      GuPool* tmp_pool)
 {
 	void* data = gu_variant_data(prod);
 	switch (gu_variant_tag(prod)) {
 	case PGF_PRODUCTION_APPLY: {
 		PgfProductionApply* papply = data;
-		PgfInferMap* infer =
+		PgfLinDispatch* disp =
 			gu_map_get(lzr->fun_indices, &papply->fun->fun,
-				   PgfInferMap*);
+				   PgfLinDispatch*);
 		gu_debug("index: %s -> %d", papply->fun->fun, cat->fid);
-		if (!infer) {
-			infer = gu_new_map(PgfCCatIds*, lzr->ccat_ids_hasher,
-					   PgfLinInfers*, &gu_null_struct,
-					   lzr->pool);
+		if (!disp) {
+			disp = pgf_lzr_new_dispatch(lzr->pool, tmp_pool);
 			gu_map_put(lzr->fun_indices,
-				   &papply->fun->fun, PgfInferMap*, infer);
+				   &papply->fun->fun, PgfLinDispatch*, disp);
 		}
-		pgf_lzr_add_infer_entry(lzr, infer, cat, papply);
+		pgf_lzr_add_infer_entry(lzr, disp, cat, papply, tmp_pool);
+		pgf_lzr_index_kps(lzr, papply->fun, tmp_pool);
 		break;
 	}
 	case PGF_PRODUCTION_COERCE: {
@@ -154,7 +403,7 @@ pgf_lzr_index(PgfLzr* lzr, PgfCCat* cat, PgfProduction prod)
 }
 
 static void
-pgf_lzr_index_ccat(PgfLzr* lzr, PgfCCat* cat)
+pgf_lzr_index_ccat(PgfLzr* lzr, PgfCCat* cat, GuPool* tmp_pool)
 {
 	gu_debug("ccat: %d", cat->fid);
 	if (gu_seq_is_null(cat->prods)) {
@@ -163,13 +412,14 @@ pgf_lzr_index_ccat(PgfLzr* lzr, PgfCCat* cat)
 	size_t n_prods = gu_seq_length(cat->prods);
 	for (size_t i = 0; i < n_prods; i++) {
 		PgfProduction prod = gu_seq_get(cat->prods, PgfProduction, i);
-		pgf_lzr_index(lzr, cat, prod);
+		pgf_lzr_index(lzr, cat, prod, tmp_pool);
 	}
 }
 
 typedef struct {
 	GuMapItor fn;
 	PgfLzr* lzr;
+	GuPool* tmp_pool;
 } PgfLzrIndexFn;
 
 static void
@@ -184,12 +434,69 @@ pgf_lzr_index_cnccat_cb(GuMapItor* fn, const void* key, void* value,
 	for (size_t i = 0; i < n_ccats; i++) {
 		PgfCCat* cat = gu_seq_get(cnccat->cats, PgfCCatId, i);
 		if (cat) {
-			pgf_lzr_index_ccat(clo->lzr, cat);
+			pgf_lzr_index_ccat(clo->lzr, cat, clo->tmp_pool);
 		}
 	}
 	gu_exit("<-");
 }
 
+static int
+pgf_ccat_addr_cmp(const void* p1, const void* p2)
+{
+	uintptr_t a1 = (uintptr_t) *(PgfCCat* const*) p1;
+	uintptr_t a2 = (uintptr_t) *(PgfCCat* const*) p2;
+	return (a1 > a2) - (a1 < a2);
+}
+
+typedef struct {
+	GuMapItor fn;
+	PgfLzr* lzr;
+} PgfLzrCloseFn;
+
+static void
+pgf_lzr_close_coerce_cb(GuMapItor* fn, const void* key, void* value,
+			GuExn* err)
+{
+	PgfLzrCloseFn* clo = (PgfLzrCloseFn*) fn;
+	PgfLzr* lzr = clo->lzr;
+	PgfCCat* cat = (PgfCCat*) key;
+	GuPool* tmp_pool = gu_new_pool();
+	GuSet* seen = gu_new_addr_set(PgfCCat, tmp_pool);
+	PgfCCatBuf* found = gu_new_buf(PgfCCat*, tmp_pool);
+	PgfCCatBuf* stack = gu_new_buf(PgfCCat*, tmp_pool);
+	gu_set_insert(seen, cat);
+	gu_buf_push(stack, PgfCCat*, cat);
+	while (gu_buf_length(stack) > 0) {
+		PgfCCat* super = gu_buf_pop(stack, PgfCCat*);
+		gu_buf_push(found, PgfCCat*, super);
+		PgfCCatBuf* supers =
+			gu_map_get(lzr->coerce_idx, super, PgfCCatBuf*);
+		size_t n_supers = supers ? gu_buf_length(supers) : 0;
+		for (size_t i = 0; i < n_supers; i++) {
+			PgfCCat* s = gu_buf_get(supers, PgfCCat*, i);
+			if (!gu_set_has(seen, s)) {
+				gu_set_insert(seen, s);
+				gu_buf_push(stack, PgfCCat*, s);
+			}
+		}
+	}
+	size_t n_found = gu_buf_length(found);
+	PgfCCatIds closure = gu_new_seq(PgfCCatId, n_found, lzr->pool);
+	memcpy(gu_seq_data(closure), gu_buf_data(found),
+	       n_found * sizeof(PgfCCat*));
+	qsort(gu_seq_data(closure), n_found, sizeof(PgfCCat*),
+	      pgf_ccat_addr_cmp);
+	gu_map_put(lzr->supercat_idx, cat, PgfCCatIds, closure);
+	gu_pool_free(tmp_pool);
+}
+
+// Return the categories that `cat` can be coerced to, including itself,
+// sorted by address, or a null sequence if `cat` cannot be coerced.
+static PgfCCatIds
+pgf_lzr_supercats(PgfLzr* lzr, PgfCCat* cat)
+{
+	return gu_map_get(lzr->supercat_idx, cat, PgfCCatIds);
+}
 
 PgfLzr*
 pgf_new_lzr(PgfConcr* cnc, GuPool* pool)
@@ -199,34 +506,27 @@ pgf_new_lzr(PgfConcr* cnc, GuPool* pool)
 	lzr->pool = pool;
 	lzr->fun_indices = gu_map_type_new(PgfFunIndices, pool);
 	lzr->coerce_idx = gu_map_type_new(PgfCoerceIdx, pool);
+	lzr->supercat_idx = gu_map_type_new(PgfSupercatIdx, pool);
+	lzr->kp_tries = gu_new_addr_map(PgfSymbolKP, PgfKPTrie*,
+					&gu_null_struct, pool);
 
-	// XXX: get maybe instantiate from typetable directly?
-	GuPool* tmp_pool = gu_local_pool();
-	GuGeneric* genhash = gu_new_generic(gu_hasher_instances, tmp_pool);
-	lzr->ccat_ids_hasher = gu_specialize(genhash, gu_type(PgfCCatIds), pool);
-	gu_pool_free(tmp_pool);
-
-	PgfLzrIndexFn clo = { { pgf_lzr_index_cnccat_cb }, lzr };
+	GuPool* tmp_pool = gu_new_pool();
+	PgfLzrIndexFn clo = { { pgf_lzr_index_cnccat_cb }, lzr, tmp_pool };
 	gu_map_iter(cnc->cnccats, &clo.fn, gu_null_exn());
 	size_t n_extras = gu_seq_length(cnc->extra_ccats);
 	for (size_t i = 0; i < n_extras; i++) {
 		PgfCCat* cat = gu_seq_get(cnc->extra_ccats, PgfCCat*, i);
-		pgf_lzr_index_ccat(lzr, cat);
+		pgf_lzr_index_ccat(lzr, cat, tmp_pool);
 	}
+	PgfLzrCompileFunFn compile_clo = { { pgf_lzr_compile_fun_cb }, pool };
+	gu_map_iter(lzr->fun_indices, &compile_clo.fn, gu_null_exn());
+	gu_pool_free(tmp_pool);
+	PgfLzrCloseFn close_clo = { { pgf_lzr_close_coerce_cb }, lzr };
+	gu_map_iter(lzr->coerce_idx, &close_clo.fn, gu_null_exn());
 	// TODO: prune productions with zero linearizations
 	return lzr;
 }
 
-typedef struct PgfLzn PgfLzn;
-
-struct PgfLzn {
-	PgfLzr* lzr;
-	GuChoice* ch;
-	PgfExpr expr;
-	GuEnum en;
-};
-
-
 //
 // PgfCncTree
 //
@@ -250,183 +550,275 @@ struct PgfCncTreeLit {
 };
 
 
-static PgfCCat*
-pgf_lzn_pick_supercat(PgfLzn* lzn, PgfCCat* cat)
+//
+// Concretization
+//
+// An abstract tree is first annotated bottom-up with the concrete
+// categories that each of its subtrees can realize, and the ways in which
+// they can realize them. Only combinations that succeed are recorded, so
+// the concrete trees can then be enumerated from the annotations without
+// backtracking.
+//
+
+typedef struct PgfLznNode PgfLznNode;
+typedef GuSeq PgfLznNodes;
+
+typedef struct PgfLznAlt PgfLznAlt;
+
+struct PgfLznAlt {
+	PgfCncFun* fun;
+	/**< The concrete function, or `NULL` for a literal. */
+	PgfPArgs args;
+	/**< The arguments of the production, whose categories the
+	 * subtrees of the arguments must be coercible to. */
+};
+
+typedef GuBuf PgfLznAlts;
+
+struct PgfLznNode {
+	PgfLiteral lit;
+	PgfLznNodes args;
+	PgfCCatBuf* cats;
+	/**< The categories that the subtree can realize. */
+	GuMap* alts;
+	/**< Maps each category in `cats` to the #PgfLznAlts that realize
+	 * it. */
+	GuMap* lifts;
+	/**< Maps each category that is reachable from `cats` by
+	 * coercions, including the categories in `cats` themselves, to
+	 * the #PgfCCatBuf of categories in `cats` that reach it. */
+	PgfCCatBuf* lift_cats;
+	/**< The keys of `lifts`. */
+};
+
+typedef struct PgfLzn PgfLzn;
+
+struct PgfLzn {
+	PgfLzr* lzr;
+	GuChoice* ch;
+	PgfExpr expr;
+	PgfLznNode* root;
+	GuPool* pool;
+	GuEnum en;
+};
+
+static void
+pgf_lzn_node_add_lift(PgfLznNode* node, PgfCCat* super, PgfCCat* cat,
+		      GuPool* pool)
 {
-	gu_enter("->");
-	while (true) {
-		PgfCCatBuf* supers =
-			gu_map_get(lzn->lzr->coerce_idx, cat, PgfCCatBuf*);
-		if (!supers) {
-			break;
-		}
-		gu_debug("n_supers: %d", gu_buf_length(supers));
-		int ch = gu_choice_next(lzn->ch, gu_buf_length(supers) + 1);
-		gu_debug("choice: %d", ch);
-		if (ch == 0) {
-			break;
-		}
-		cat = gu_buf_get(supers, PgfCCat*, ch - 1);
+	PgfCCatBuf* cats = gu_map_get(node->lifts, super, PgfCCatBuf*);
+	if (cats == NULL) {
+		cats = gu_new_buf(PgfCCat*, pool);
+		gu_map_put(node->lifts, super, PgfCCatBuf*, cats);
+		gu_buf_push(node->lift_cats, PgfCCat*, super);
 	}
-	gu_exit("<- %d", pgf_ccat_fid(cat));
-	return cat;
+	gu_buf_push(cats, PgfCCat*, cat);
 }
 
-static PgfCCat*
-pgf_lzn_infer(PgfLzn* lzn, PgfExpr expr, GuPool* pool, PgfCncTree* ctree_out);
-
-static PgfCCat*
-pgf_lzn_infer_apply_try(PgfLzn* lzn, GuSeq args,
-			PgfInferMap* infer, GuChoiceMark* marks,
-			PgfCCatIds arg_cats, int* ip, 
-			GuPool* pool, PgfCncTreeApp* app_out)
+static void
+pgf_lzn_node_lift(PgfLzn* lzn, PgfLznNode* node, GuPool* pool)
 {
-	// gu_enter("f: %s, *ip: %d, n_args: %d", appl->fun, *ip, n_args);
-	int n_args = gu_seq_length(args);
-	gu_enter("->");
-	PgfCCat* ret = NULL;
-	while (*ip < n_args) {
-		PgfCncTree* arg_treep = NULL;
-		if (app_out) {
-			arg_treep = gu_seq_index(app_out->args, PgfCncTree, *ip);
+	node->lifts = gu_new_addr_map(PgfCCat, PgfCCatBuf*,
+				      &gu_null_struct, pool);
+	node->lift_cats = gu_new_buf(PgfCCat*, pool);
+	size_t n_cats = gu_buf_length(node->cats);
+	for (size_t i = 0; i < n_cats; i++) {
+		PgfCCat* cat = gu_buf_get(node->cats, PgfCCat*, i);
+		PgfCCatIds supers = pgf_lzr_supercats(lzn->lzr, cat);
+		if (gu_seq_is_null(supers)) {
+			pgf_lzn_node_add_lift(node, cat, cat, pool);
+			continue;
 		}
-		PgfExpr arg_expr = gu_seq_get(args, PgfExpr, *ip);
-		PgfCCat* arg_i =
-			pgf_lzn_infer(lzn, arg_expr, pool, arg_treep);
-		if (arg_i == NULL) {
-			goto finish;
+		size_t n_supers = gu_seq_length(supers);
+		for (size_t j = 0; j < n_supers; j++) {
+			PgfCCat* super = gu_seq_get(supers, PgfCCatId, j);
+			pgf_lzn_node_add_lift(node, super, cat, pool);
 		}
-		arg_i = pgf_lzn_pick_supercat(lzn, arg_i);
-		gu_seq_set(arg_cats, PgfCCatId, *ip, arg_i);
-		marks[++*ip] = gu_choice_mark(lzn->ch);
-	}
-	PgfLinInfers* entries = gu_map_get(infer, &arg_cats, PgfLinInfers*);
-	if (!entries) {
-		goto finish;
 	}
-	size_t n_entries = gu_buf_length(entries);
-	int e = gu_choice_next(lzn->ch, n_entries);
-	gu_debug("entry %d of %d", e, n_entries);
-	if (e < 0) {
-		goto finish;
-	}
-	PgfLinInferEntry* entry = gu_buf_index(entries, PgfLinInferEntry, e);
-	if (app_out != NULL) {
-		app_out->fun = entry->fun;
+}
+
+static void
+pgf_lzn_node_add_alt(PgfLznNode* node, PgfCCat* cat, PgfLznAlt alt,
+		     GuPool* pool)
+{
+	PgfLznAlts* alts = gu_map_get(node->alts, cat, PgfLznAlts*);
+	if (alts == NULL) {
+		alts = gu_new_buf(PgfLznAlt, pool);
+		gu_map_put(node->alts, cat, PgfLznAlts*, alts);
+		gu_buf_push(node->cats, PgfCCat*, cat);
 	}
-	ret = entry->cat;
-finish:
-	gu_exit("fid: %d", ret ? ret->fid : -1);
-	return ret;
+	gu_buf_push(alts, PgfLznAlt, alt);
 }
-typedef GuSeq PgfChoiceMarks;
 
-static PgfCCat*
-pgf_lzn_infer_application(PgfLzn* lzn, PgfCId fun, GuSeq args,
-			  GuPool* pool, PgfCncTree* ctree_out)
+static void
+pgf_lzn_dispatch(PgfLznNode* node, PgfLinDispatch* disp, size_t arg_idx,
+		 GuPool* pool);
+
+static void
+pgf_lzn_dispatch_edge(PgfLznNode* node, PgfLinDispatchEdge* edge,
+		      size_t arg_idx, GuPool* pool)
 {
-	PgfInferMap* infer =
-		gu_map_get(lzn->lzr->fun_indices, &fun, PgfInferMap*);
-	size_t n_args = gu_seq_length(args);
-	gu_enter("->");
-	if (infer == NULL) {
-		gu_exit("<- couldn't find f");
-		return NULL;
+	gu_debug("arg %zu: fid %d", arg_idx, pgf_ccat_fid(edge->cat));
+	pgf_lzn_dispatch(node, edge->next, arg_idx + 1, pool);
+}
+
+// Record the productions in `disp` whose remaining argument categories,
+// starting from `arg_idx`, can be realized by the arguments of `node`.
+static void
+pgf_lzn_dispatch(PgfLznNode* node, PgfLinDispatch* disp, size_t arg_idx,
+		 GuPool* pool)
+{
+	size_t n_args = gu_seq_length(node->args);
+	if (arg_idx == n_args) {
+		size_t n_entries = disp->entries ?
+			gu_buf_length(disp->entries) : 0;
+		for (size_t i = 0; i < n_entries; i++) {
+			PgfLinInferEntry* entry =
+				gu_buf_index(disp->entries,
+					     PgfLinInferEntry, i);
+			PgfLznAlt alt = { entry->fun, entry->args };
+			pgf_lzn_node_add_alt(node, entry->cat, alt, pool);
+		}
+		return;
 	}
-	GuPool* tmp_pool = gu_new_pool();
-	PgfCCat* ret = NULL;
-	PgfCCatIds arg_cats = gu_new_seq(PgfCCatId, n_args, tmp_pool);
-
-	PgfCncTreeApp* appt = NULL;
-	if (ctree_out) {
-		appt = gu_new_variant(PGF_CNC_TREE_APP, PgfCncTreeApp, 
-				      ctree_out, pool);
-		appt->args = gu_new_seq(PgfCncTree, n_args, pool);
-	}
-
-	PgfChoiceMarks marks =
-		gu_new_seq(GuChoiceMark, n_args + 1, tmp_pool);
-	GuChoiceMark* markdata = gu_seq_data(marks);
-	int i = 0;
-	markdata[i] = gu_choice_mark(lzn->ch);
-	while (true) {
-		ret = pgf_lzn_infer_apply_try(
-			lzn, args, infer, markdata, arg_cats, &i, pool, appt);
-		if (ret != NULL) {
-			break;
+	PgfLznNode* arg = gu_seq_get(node->args, PgfLznNode*, arg_idx);
+	size_t n_lifts = gu_buf_length(arg->lift_cats);
+	// Intersect the categories that the argument can be lifted to
+	// with the ones that the productions expect, iterating over the
+	// smaller set.
+	if (n_lifts < disp->n_edges) {
+		for (size_t i = 0; i < n_lifts; i++) {
+			PgfLinDispatchEdge key = {
+				gu_buf_get(arg->lift_cats, PgfCCat*, i), NULL
+			};
+			PgfLinDispatchEdge* edge =
+				bsearch(&key, disp->edges, disp->n_edges,
+					sizeof(PgfLinDispatchEdge),
+					pgf_lin_dispatch_edge_cmp);
+			if (edge != NULL) {
+				pgf_lzn_dispatch_edge(node, edge, arg_idx, pool);
+			}
 		}
-
-		do {
-			--i;
-			if (i < 0) {
-				goto finish;
+	} else {
+		for (size_t i = 0; i < disp->n_edges; i++) {
+			PgfLinDispatchEdge* edge = &disp->edges[i];
+			if (gu_map_has(arg->lifts, edge->cat)) {
+				pgf_lzn_dispatch_edge(node, edge, arg_idx, pool);
 			}
-			gu_choice_reset(lzn->ch, markdata[i]);
-		} while (!gu_choice_advance(lzn->ch));
+		}
 	}
-finish:
-	gu_pool_free(tmp_pool);
-	gu_exit("<- fid: %d", ret ? ret->fid : -1);
-	return ret;
 }
 
-static PgfCCat*
-pgf_lzn_infer(PgfLzn* lzn, PgfExpr expr, GuPool* pool, PgfCncTree* ctree_out)
+static PgfLznNode*
+pgf_lzn_annotate(PgfLzn* lzn, PgfExpr expr, GuPool* pool)
 {
-	PgfCCat* ret = NULL;
-	GuPool* tmp_pool = gu_local_pool();
-	PgfApplication* appl = pgf_expr_unapply(expr, tmp_pool);
+	PgfLznNode* node = gu_new(PgfLznNode, pool);
+	node->lit = gu_null_variant;
+	node->args = gu_empty_seq();
+	node->cats = gu_new_buf(PgfCCat*, pool);
+	node->alts = gu_new_addr_map(PgfCCat, PgfLznAlts*,
+				     &gu_null_struct, pool);
+	PgfApplication* appl = pgf_expr_unapply(expr, pool);
 	if (appl != NULL) {
 		PgfExprFun* fun = gu_variant_data(appl->fun);
-		ret = pgf_lzn_infer_application(
-			lzn, fun->fun, appl->args, pool, ctree_out);
+		PgfLinDispatch* disp =
+			gu_map_get(lzn->lzr->fun_indices, &fun->fun,
+				   PgfLinDispatch*);
+		if (disp == NULL) {
+			return NULL;
+		}
+		size_t n_args = gu_seq_length(appl->args);
+		node->args = gu_new_seq(PgfLznNode*, n_args, pool);
+		for (size_t i = 0; i < n_args; i++) {
+			PgfExpr arg_expr = gu_seq_get(appl->args, PgfExpr, i);
+			PgfLznNode* arg = pgf_lzn_annotate(lzn, arg_expr, pool);
+			if (arg == NULL) {
+				return NULL;
+			}
+			gu_seq_set(node->args, PgfLznNode*, i, arg);
+		}
+		pgf_lzn_dispatch(node, disp, 0, pool);
 	} else {
 		GuVariantInfo i = gu_variant_open(pgf_expr_unwrap(expr));
 		switch (i.tag) {
 		case PGF_EXPR_LIT: {
 			PgfExprLit* elit = i.data;
-			if (pool != NULL) {
-				*ctree_out = gu_new_variant_i(
-					pool, PGF_CNC_TREE_LIT,
-					PgfCncTreeLit,
-					.lit = elit->lit);
-			}
-			ret = pgf_literal_cat(elit->lit);
+			node->lit = elit->lit;
+			PgfLznAlt alt = { NULL, gu_empty_seq() };
+			pgf_lzn_node_add_alt(node, pgf_literal_cat(elit->lit),
+					     alt, pool);
+			break;
 		}
 		default:
 			// XXX: should we do something here?
 			break;
 		}
 	}
-	gu_pool_free(tmp_pool);
-	return ret;
+	if (gu_buf_length(node->cats) == 0) {
+		return NULL;
+	}
+	pgf_lzn_node_lift(lzn, node, pool);
+	return node;
 }
 
+// Choose a concrete tree for `node`. If `super` is not `NULL`, the tree
+// must be of a category that is coercible to `super`.
+static PgfCncTree
+pgf_lzn_choose(PgfLzn* lzn, PgfLznNode* node, PgfCCat* super, GuPool* pool)
+{
+	PgfCCatBuf* cats = node->cats;
+	if (super != NULL) {
+		cats = gu_map_get(node->lifts, super, PgfCCatBuf*);
+	}
+	int c = gu_choice_next(lzn->ch, gu_buf_length(cats));
+	gu_assert(c >= 0);
+	PgfCCat* cat = gu_buf_get(cats, PgfCCat*, c);
+	PgfLznAlts* alts = gu_map_get(node->alts, cat, PgfLznAlts*);
+	int a = gu_choice_next(lzn->ch, gu_buf_length(alts));
+	gu_assert(a >= 0);
+	PgfLznAlt* alt = gu_buf_index(alts, PgfLznAlt, a);
+	gu_debug("fid: %d", pgf_ccat_fid(cat));
+	PgfCncTree ctree = gu_null_variant;
+	if (alt->fun == NULL) {
+		ctree = gu_new_variant_i(pool, PGF_CNC_TREE_LIT,
+					 PgfCncTreeLit,
+					 .lit = node->lit);
+		return ctree;
+	}
+	size_t n_args = gu_seq_length(node->args);
+	PgfCncTreeApp* appt = gu_new_variant(PGF_CNC_TREE_APP, PgfCncTreeApp,
+					     &ctree, pool);
+	appt->fun = alt->fun;
+	appt->args = gu_new_seq(PgfCncTree, n_args, pool);
+	for (size_t i = 0; i < n_args; i++) {
+		PgfLznNode* arg = gu_seq_get(node->args, PgfLznNode*, i);
+		PgfCCat* arg_cat = gu_seq_index(alt->args, PgfPArg, i)->ccat;
+		PgfCncTree arg_tree = pgf_lzn_choose(lzn, arg, arg_cat, pool);
+		gu_seq_set(appt->args, PgfCncTree, i, arg_tree);
+	}
+	return ctree;
+}
 
 static PgfCncTree
 pgf_lzn_next(PgfLzn* lzn, GuPool* pool)
 {
-	// XXX: rewrite this whole mess
 	PgfCncTree ctree = gu_null_variant;
 	if (gu_variant_is_null(lzn->expr)) {
 		return ctree;
 	}
-	PgfCCat* cat = NULL;
-	GuChoiceMark mark = gu_choice_mark(lzn->ch);
-	do {
-		cat = pgf_lzn_infer(lzn, lzn->expr, NULL, NULL);
-		gu_choice_reset(lzn->ch, mark);
-	} while (!cat && gu_choice_advance(lzn->ch));
-
-	if (cat) {
-		PgfCCat* cat2 = pgf_lzn_infer(lzn, lzn->expr, pool, &ctree);
-		gu_assert(cat == cat2);
-		gu_debug("fid: %d", cat->fid);
-		gu_choice_reset(lzn->ch, mark);
-		if (!gu_choice_advance(lzn->ch)) {
+	if (lzn->root == NULL) {
+		lzn->root = pgf_lzn_annotate(lzn, lzn->expr, lzn->pool);
+		if (lzn->root == NULL) {
 			lzn->expr = gu_null_variant;
+			return ctree;
 		}
 	}
+	GuChoiceMark mark = gu_choice_mark(lzn->ch);
+	ctree = pgf_lzn_choose(lzn, lzn->root, NULL, pool);
+	gu_choice_reset(lzn->ch, mark);
+	if (!gu_choice_advance(lzn->ch)) {
+		lzn->expr = gu_null_variant;
+	}
 	return ctree;
 }
 
@@ -449,12 +841,128 @@ pgf_lzr_concretize(PgfLzr* lzr, PgfExpr expr, GuPool* pool)
 	PgfLzn* lzn = gu_new(PgfLzn, pool);
 	lzn->lzr = lzr;
 	lzn->expr = expr;
+	lzn->root = NULL;
+	lzn->pool = pool;
 	lzn->ch = gu_new_choice(pool);
 	lzn->en.next = pgf_cnc_tree_enum_next;
 	return &lzn->en;
 }
 
 
+//
+// Linearization
+//
+// A prefix-dependent symbol cannot be emitted before the token that
+// follows it is known. The symbols are kept in a #PgfLzrKPQueue until
+// the next token arrives, or the linearization ends, and are then
+// resolved from the last one to the first.
+//
+
+enum { PGF_LZR_LOCAL_KPS = 8 };
+
+typedef struct PgfLzrKPQueue PgfLzrKPQueue;
+
+struct PgfLzrKPQueue {
+	void (*emit)(PgfLzrKPQueue* q, PgfTokens toks);
+	PgfLzr* lzr;
+	PgfSymbolKP** kps;
+	PgfTokens* forms;
+	/**< Room for the forms of `kps` while they are resolved. */
+	size_t n_kps;
+	size_t max_kps;
+	GuPool* pool;
+	/**< Holds `kps` and `forms` once they have outgrown the local
+	 * arrays, or `NULL`. */
+	PgfSymbolKP* local_kps[PGF_LZR_LOCAL_KPS];
+	PgfTokens local_forms[PGF_LZR_LOCAL_KPS];
+};
+
+static void
+pgf_lzr_kp_init(PgfLzrKPQueue* q,
+		void (*emit)(PgfLzrKPQueue* q, PgfTokens toks), PgfLzr* lzr)
+{
+	q->emit = emit;
+	q->lzr = lzr;
+	q->kps = q->local_kps;
+	q->forms = q->local_forms;
+	q->n_kps = 0;
+	q->max_kps = PGF_LZR_LOCAL_KPS;
+	q->pool = NULL;
+}
+
+// Emit the pending prefix-dependent symbols, given the token that follows
+// them.
+static void
+pgf_lzr_kp_flush(PgfLzrKPQueue* q, PgfToken next)
+{
+	size_t n_kps = q->n_kps;
+	PgfTokens* forms = q->forms;
+	for (size_t i = n_kps; i-- > 0; ) {
+		forms[i] = pgf_lzr_kp_form(q->lzr, q->kps[i], next);
+		if (!gu_seq_is_empty(forms[i])) {
+			next = gu_seq_get(forms[i], PgfToken, 0);
+		}
+	}
+	q->n_kps = 0;
+	for (size_t i = 0; i < n_kps; i++) {
+		q->emit(q, forms[i]);
+	}
+}
+
+// Emit the symbols that are still pending at the end of the
+// linearization and release the queue.
+static void
+pgf_lzr_kp_finish(PgfLzrKPQueue* q)
+{
+	pgf_lzr_kp_flush(q, gu_null_string);
+	if (q->pool != NULL) {
+		gu_pool_free(q->pool);
+	}
+}
+
+static void
+pgf_lzr_kp_push(PgfLzrKPQueue* q, PgfSymbolKP* kp)
+{
+	if (q->n_kps == q->max_kps) {
+		// Every pending symbol may still depend on the token that
+		// follows, so none of them can be emitted yet.
+		if (q->pool == NULL) {
+			q->pool = gu_new_pool();
+		}
+		size_t max_kps = 2 * q->max_kps;
+		PgfSymbolKP** kps = gu_new_n(PgfSymbolKP*, max_kps, q->pool);
+		memcpy(kps, q->kps, q->n_kps * sizeof(PgfSymbolKP*));
+		q->kps = kps;
+		q->forms = gu_new_n(PgfTokens, max_kps, q->pool);
+		q->max_kps = max_kps;
+	}
+	q->kps[q->n_kps++] = kp;
+}
+
+static void
+pgf_lzr_kp_tokens(PgfLzrKPQueue* q, PgfTokens toks)
+{
+	if (gu_seq_is_empty(toks)) {
+		return;
+	}
+	if (q->n_kps > 0) {
+		pgf_lzr_kp_flush(q, gu_seq_get(toks, PgfToken, 0));
+	}
+	q->emit(q, toks);
+}
+
+// Return the token that a literal begins with, if it is known without
+// formatting the literal.
+static PgfToken
+pgf_lzr_literal_next(PgfLiteral lit)
+{
+	if (gu_variant_tag(lit) == PGF_LITERAL_STR) {
+		PgfLiteralStr* lstr = gu_variant_data(lit);
+		return lstr->val;
+	}
+	return gu_null_string;
+}
+
 int
 pgf_cnc_tree_n_ctnts(PgfCncTree ctree)
 {
@@ -472,16 +980,37 @@ pgf_cnc_tree_n_ctnts(PgfCncTree ctree)
 	}
 }
 
-void
-pgf_lzr_linearize(PgfLzr* lzr, PgfCncTree ctree, PgfCtntId lin_idx,
-		  PgfPresenter* prtr)
+typedef struct PgfLzrPrtrQueue PgfLzrPrtrQueue;
+
+struct PgfLzrPrtrQueue {
+	PgfLzrKPQueue q;
+	PgfPresenter* prtr;
+};
+
+static void
+pgf_lzr_prtr_emit(PgfLzrKPQueue* q, PgfTokens toks)
 {
+	PgfLzrPrtrQueue* pq = gu_container(q, PgfLzrPrtrQueue, q);
+	if (!gu_seq_is_empty(toks)) {
+		gu_invoke_maybe(0, pq->prtr, symbol_tokens, toks);
+	}
+}
+
+static void
+pgf_lzr_linearize_prtr(PgfLzr* lzr, PgfCncTree ctree, PgfCtntId lin_idx,
+		       PgfLzrPrtrQueue* pq)
+{
+	PgfPresenter* prtr = pq->prtr;
 	GuVariantInfo cti = gu_variant_open(ctree);
 	gu_require(lin_idx >= 0);
 	switch (cti.tag) {
 	case PGF_CNC_TREE_LIT: {
 		gu_require(lin_idx == 0);
 		PgfCncTreeLit* flit = cti.data;
+		if (pq->q.n_kps > 0) {
+			pgf_lzr_kp_flush(&pq->q,
+					 pgf_lzr_literal_next(flit->lit));
+		}
 		gu_invoke_maybe(0, prtr, expr_literal, flit->lit);
 		break;
 	}
@@ -496,28 +1025,25 @@ pgf_lzr_linearize(PgfLzr* lzr, PgfCncTree ctree, PgfCtntId lin_idx,
 		PgfSymbol* syms = gu_seq_data(seq);
 		for (size_t i = 0; i < nsyms; i++) {
 			PgfSymbol sym = syms[i];
-			GuVariantInfo sym_i = gu_variant_open(sym);
-			switch (sym_i.tag) {
+			switch (pgf_symbol_tag(sym)) {
 			case PGF_SYMBOL_CAT:
 			case PGF_SYMBOL_VAR:
 			case PGF_SYMBOL_LIT: {
-				PgfSymbolIdx* sidx = sym_i.data;
 				PgfCncTree argf = gu_seq_get(fapp->args,
 							     PgfCncTree,
-							     sidx->d);
-				pgf_lzr_linearize(lzr, argf, sidx->r, prtr);
+							     pgf_symbol_d(sym));
+				pgf_lzr_linearize_prtr(lzr, argf,
+						       pgf_symbol_r(sym), pq);
 				break;
 			}
 			case PGF_SYMBOL_KS: {
-				PgfSymbolKS* ks = sym_i.data;
-				gu_invoke_maybe(0, prtr, symbol_tokens, ks->tokens);
+				PgfSymbolKS* ks = pgf_symbol_ks(lzr->cnc, sym);
+				pgf_lzr_kp_tokens(&pq->q, ks->tokens);
 				break;
 			}
 			case PGF_SYMBOL_KP: {
-				// TODO: correct prefix-dependencies
-				PgfSymbolKP* kp = sym_i.data;
-				gu_invoke_maybe(0, prtr, symbol_tokens,
-						kp->default_form);
+				PgfSymbolKP* kp = pgf_symbol_kp(lzr->cnc, sym);
+				pgf_lzr_kp_push(&pq->q, kp);
 				break;
 			}
 			default:
@@ -531,6 +1057,551 @@ pgf_lzr_linearize(PgfLzr* lzr, PgfCncTree ctree, PgfCtntId lin_idx,
 	}
 }
 
+void
+pgf_lzr_linearize(PgfLzr* lzr, PgfCncTree ctree, PgfCtntId lin_idx,
+		  PgfPresenter* prtr)
+{
+	PgfLzrPrtrQueue pq = { .prtr = prtr };
+	pgf_lzr_kp_init(&pq.q, pgf_lzr_prtr_emit, lzr);
+	pgf_lzr_linearize_prtr(lzr, ctree, lin_idx, &pq);
+	pgf_lzr_kp_finish(&pq.q);
+}
+
+
+//
+// Linearization tables
+//
+// All the constituents of a tree are computed bottom-up in a single
+// pass. The items of every constituent of every node are appended to a
+// shared buffer, and a constituent that refers to a constituent of an
+// argument refers to the argument's span in the buffer, so each token is
+// stored only once however deep the tree is. The references are only
+// followed when the constituents of the root are packed into a table.
+// Prefix-dependent symbols are kept as items of their own until then,
+// since the token that follows them may come from a parent.
+//
+
+typedef struct PgfLinItem PgfLinItem;
+
+struct PgfLinItem {
+	PgfToken tok;
+	PgfSymbolKP* kp;
+	/**< The prefix-dependent symbol, or `NULL`. */
+	const PgfLinSpan* span;
+	/**< The span of the argument's constituent that this item stands
+	 * for, or `NULL`. If both `kp` and `span` are `NULL`, this item is
+	 * the token `tok`. */
+};
+
+static PgfToken
+pgf_lzr_literal_token(PgfLiteral lit, GuPool* pool)
+{
+	GuVariantInfo i = gu_variant_open(lit);
+	switch (i.tag) {
+	case PGF_LITERAL_STR: {
+		PgfLiteralStr* lstr = i.data;
+		return lstr->val;
+	}
+	case PGF_LITERAL_INT: {
+		PgfLiteralInt* lint = i.data;
+		return gu_format_string(pool, "%d", lint->val);
+	}
+	case PGF_LITERAL_FLT: {
+		PgfLiteralFlt* lflt = i.data;
+		return gu_format_string(pool, "%lg", lflt->val);
+	}
+	default:
+		gu_impossible();
+		return gu_empty_string;
+	}
+}
+
+static void
+pgf_lzr_push_tokens(GuBuf* items, PgfTokens toks)
+{
+	size_t n_toks = gu_seq_length(toks);
+	for (size_t i = 0; i < n_toks; i++) {
+		PgfLinItem item = { gu_seq_get(toks, PgfToken, i), NULL, NULL };
+		gu_buf_push(items, PgfLinItem, item);
+	}
+}
+
+static PgfLinSpan*
+pgf_lzr_lit_spans(PgfLiteral lit, GuBuf* items, GuPool* spans_pool,
+		  GuPool* pool)
+{
+	PgfLinSpan* spans = gu_new(PgfLinSpan, spans_pool);
+	spans->begin = gu_buf_length(items);
+	PgfLinItem item = { pgf_lzr_literal_token(lit, pool), NULL, NULL };
+	gu_buf_push(items, PgfLinItem, item);
+	spans->end = gu_buf_length(items);
+	return spans;
+}
+
+// Append the constituents of an application of `fun` to `items`, given
+// the spans of the constituents of its arguments, and return their spans,
+// allocated from `spans_pool`.
+static PgfLinSpan*
+pgf_lzr_app_spans(PgfConcr* cnc, PgfCncFun* fun, size_t n_args,
+		  PgfLinSpan** arg_spans, int* arg_n_ctnts, GuBuf* items,
+		  GuPool* spans_pool)
+{
+	size_t n_lins = gu_seq_length(fun->lins);
+	PgfLinSpan* spans = gu_new_n(PgfLinSpan, n_lins, spans_pool);
+	for (size_t l = 0; l < n_lins; l++) {
+		spans[l].begin = gu_buf_length(items);
+		PgfSequence seq = gu_seq_get(fun->lins, PgfSequence, l);
+		size_t nsyms = gu_seq_length(seq);
+		PgfSymbol* syms = gu_seq_data(seq);
+		for (size_t i = 0; i < nsyms; i++) {
+			PgfSymbol sym = syms[i];
+			switch (pgf_symbol_tag(sym)) {
+			case PGF_SYMBOL_CAT:
+			case PGF_SYMBOL_VAR:
+			case PGF_SYMBOL_LIT: {
+				int32_t d = pgf_symbol_d(sym);
+				int32_t r = pgf_symbol_r(sym);
+				gu_require((size_t) d < n_args);
+				gu_require(r >= 0 && r < arg_n_ctnts[d]);
+				const PgfLinSpan* span = &arg_spans[d][r];
+				if (span->end - span->begin == 1) {
+					// A single item is cheaper to copy.
+					PgfLinItem item =
+						gu_buf_get(items, PgfLinItem,
+							   span->begin);
+					gu_buf_push(items, PgfLinItem, item);
+				} else if (span->end > span->begin) {
+					PgfLinItem item = {
+						gu_null_string, NULL, span
+					};
+					gu_buf_push(items, PgfLinItem, item);
+				}
+				break;
+			}
+			case PGF_SYMBOL_KS: {
+				PgfSymbolKS* ks = pgf_symbol_ks(cnc, sym);
+				pgf_lzr_push_tokens(items, ks->tokens);
+				break;
+			}
+			case PGF_SYMBOL_KP: {
+				PgfLinItem item = {
+					gu_null_string, pgf_symbol_kp(cnc, sym),
+					NULL
+				};
+				gu_buf_push(items, PgfLinItem, item);
+				break;
+			}
+			default:
+				gu_impossible();
+			}
+		}
+		spans[l].end = gu_buf_length(items);
+	}
+	return spans;
+}
+
+// Linearize every constituent of `ctree` into `items` and return the
+// spans of the constituents, allocated from `tmp_pool`.
+static PgfLinSpan*
+pgf_lzr_linearize_spans(PgfLzr* lzr, PgfCncTree ctree, GuBuf* items,
+			GuPool* tmp_pool, GuPool* pool)
+{
+	GuVariantInfo cti = gu_variant_open(ctree);
+	switch (cti.tag) {
+	case PGF_CNC_TREE_LIT: {
+		PgfCncTreeLit* flit = cti.data;
+		return pgf_lzr_lit_spans(flit->lit, items, tmp_pool, pool);
+	}
+	case PGF_CNC_TREE_APP: {
+		PgfCncTreeApp* fapp = cti.data;
+		size_t n_args = gu_seq_length(fapp->args);
+		PgfLinSpan** arg_spans = gu_new_n(PgfLinSpan*, n_args, tmp_pool);
+		int* arg_n_ctnts = gu_new_n(int, n_args, tmp_pool);
+		for (size_t i = 0; i < n_args; i++) {
+			PgfCncTree argf = gu_seq_get(fapp->args, PgfCncTree, i);
+			arg_spans[i] = pgf_lzr_linearize_spans(lzr, argf, items,
+							       tmp_pool, pool);
+			arg_n_ctnts[i] = pgf_cnc_tree_n_ctnts(argf);
+		}
+		return pgf_lzr_app_spans(lzr->cnc, fapp->fun, n_args,
+					 arg_spans, arg_n_ctnts, items,
+					 tmp_pool);
+	}
+	default:
+		gu_impossible();
+		return NULL;
+	}
+}
+
+typedef struct PgfLzrTableQueue PgfLzrTableQueue;
+
+struct PgfLzrTableQueue {
+	PgfLzrKPQueue q;
+	GuBuf* toks;
+};
+
+static void
+pgf_lzr_table_emit(PgfLzrKPQueue* q, PgfTokens toks)
+{
+	PgfLzrTableQueue* tq = gu_container(q, PgfLzrTableQueue, q);
+	gu_buf_push_n(tq->toks, gu_seq_data(toks), gu_seq_length(toks));
+}
+
+// Append the tokens of the items in `span` to the table, following the
+// references to the spans of arguments.
+static void
+pgf_lzr_pack_span(PgfLzrTableQueue* tq, GuBuf* items, PgfLinSpan span)
+{
+	for (size_t j = span.begin; j < span.end; j++) {
+		PgfLinItem* item = gu_buf_index(items, PgfLinItem, j);
+		if (item->span != NULL) {
+			pgf_lzr_pack_span(tq, items, *item->span);
+		} else if (item->kp != NULL) {
+			pgf_lzr_kp_push(&tq->q, item->kp);
+		} else {
+			if (tq->q.n_kps > 0) {
+				pgf_lzr_kp_flush(&tq->q, item->tok);
+			}
+			gu_buf_push(tq->toks, PgfToken, item->tok);
+		}
+	}
+}
+
+// Pack the constituents with the given spans in `items` into a table,
+// resolving their prefix-dependent symbols.
+static PgfLinTable*
+pgf_lzr_pack_table(PgfLzr* lzr, GuBuf* items, PgfLinSpan* spans,
+		   size_t n_ctnts, GuPool* pool)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	PgfLzrTableQueue tq = {
+		.toks = gu_new_buf(PgfToken, tmp_pool)
+	};
+	pgf_lzr_kp_init(&tq.q, pgf_lzr_table_emit, lzr);
+	PgfLinTable* tbl = gu_new(PgfLinTable, pool);
+	tbl->spans = gu_new_seq(PgfLinSpan, n_ctnts, pool);
+	for (size_t i = 0; i < n_ctnts; i++) {
+		PgfLinSpan span = { gu_buf_length(tq.toks), 0 };
+		pgf_lzr_pack_span(&tq, items, spans[i]);
+		pgf_lzr_kp_flush(&tq.q, gu_null_string);
+		span.end = gu_buf_length(tq.toks);
+		gu_seq_set(tbl->spans, PgfLinSpan, i, span);
+	}
+	pgf_lzr_kp_finish(&tq.q);
+	size_t n_toks = gu_buf_length(tq.toks);
+	tbl->tokens = gu_new_seq(PgfToken, n_toks, pool);
+	memcpy(gu_seq_data(tbl->tokens), gu_buf_data(tq.toks),
+	       n_toks * sizeof(PgfToken));
+	gu_pool_free(tmp_pool);
+	return tbl;
+}
+
+PgfLinTable*
+pgf_lzr_linearize_table(PgfLzr* lzr, PgfCncTree ctree, GuPool* pool)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	GuBuf* items = gu_new_buf(PgfLinItem, tmp_pool);
+	PgfLinSpan* spans =
+		pgf_lzr_linearize_spans(lzr, ctree, items, tmp_pool, pool);
+	// Only the constituents of the root are kept.
+	PgfLinTable* tbl = pgf_lzr_pack_table(lzr, items, spans,
+					      pgf_cnc_tree_n_ctnts(ctree),
+					      pool);
+	gu_pool_free(tmp_pool);
+	return tbl;
+}
+
+
+//
+// Memoized linearization tables
+//
+// A memo identifies concrete subtrees by their structure: two subtrees
+// are the same if they apply the same concrete function to the same
+// memoized arguments, or if they are the same literal. Each distinct
+// subtree is linearized once, and its constituents stay in the memo's
+// item buffer for as long as the memo lives.
+//
+
+typedef struct PgfLzrMemoEntry PgfLzrMemoEntry;
+
+struct PgfLzrMemoEntry {
+	PgfLinSpan* spans;
+	int n_ctnts;
+};
+
+typedef struct PgfLzrMemoKey PgfLzrMemoKey;
+
+struct PgfLzrMemoKey {
+	PgfCncFun* fun;
+	/**< The concrete function, or `NULL` for a literal. */
+	void* lit;
+	/**< The data of the literal, or `NULL`. */
+	size_t n_args;
+	PgfLzrMemoEntry** args;
+};
+
+static GuHash
+pgf_lzr_memo_key_hash(GuHasher* self, GuHash h, const void* p)
+{
+	const PgfLzrMemoKey* key = p;
+	h = h * 31 + gu_hash_ptr(key->fun);
+	h = h * 31 + gu_hash_ptr(key->lit);
+	for (size_t i = 0; i < key->n_args; i++) {
+		h = h * 31 + gu_hash_ptr(key->args[i]);
+	}
+	return h;
+}
+
+static bool
+pgf_lzr_memo_key_eq(GuEq* self, const void* p1, const void* p2)
+{
+	const PgfLzrMemoKey* key1 = p1;
+	const PgfLzrMemoKey* key2 = p2;
+	return key1->fun == key2->fun && key1->lit == key2->lit &&
+		key1->n_args == key2->n_args &&
+		memcmp(key1->args, key2->args,
+		       key1->n_args * sizeof(PgfLzrMemoEntry*)) == 0;
+}
+
+static GU_DEFINE_HASHER(pgf_lzr_memo_key_hasher,
+			pgf_lzr_memo_key_hash, pgf_lzr_memo_key_eq);
+
+struct PgfLzrMemo {
+	PgfLzr* lzr;
+	GuPool* pool;
+	GuBuf* items;
+	GuMap* entries;
+	/**< Maps #PgfLzrMemoKey keys to #PgfLzrMemoEntry entries. */
+};
+
+PgfLzrMemo*
+pgf_new_lzr_memo(PgfLzr* lzr, GuPool* pool)
+{
+	PgfLzrMemo* memo = gu_new(PgfLzrMemo, pool);
+	memo->lzr = lzr;
+	memo->pool = pool;
+	memo->items = gu_new_buf(PgfLinItem, pool);
+	memo->entries = gu_new_map(PgfLzrMemoKey, pgf_lzr_memo_key_hasher,
+				   PgfLzrMemoEntry*, &gu_null_struct, pool);
+	return memo;
+}
+
+enum { PGF_LZR_MEMO_LOCAL_ARGS = 8 };
+
+static PgfLzrMemoEntry*
+pgf_lzr_memo_entry(PgfLzrMemo* memo, PgfCncTree ctree)
+{
+	GuVariantInfo cti = gu_variant_open(ctree);
+	PgfLzrMemoEntry* local_args[PGF_LZR_MEMO_LOCAL_ARGS];
+	PgfLzrMemoKey key = { NULL, NULL, 0, local_args };
+	PgfCncTreeApp* fapp = NULL;
+	PgfCncTreeLit* flit = NULL;
+	GuPool* tmp_pool = NULL;
+	switch (cti.tag) {
+	case PGF_CNC_TREE_LIT:
+		flit = cti.data;
+		key.lit = gu_variant_to_ptr(flit->lit);
+		break;
+	case PGF_CNC_TREE_APP:
+		fapp = cti.data;
+		key.fun = fapp->fun;
+		key.n_args = gu_seq_length(fapp->args);
+		if (key.n_args > PGF_LZR_MEMO_LOCAL_ARGS) {
+			// The key is copied into the memo's pool only
+			// when it is inserted.
+			tmp_pool = gu_new_pool();
+			key.args = gu_new_n(PgfLzrMemoEntry*, key.n_args,
+					    tmp_pool);
+		}
+		for (size_t i = 0; i < key.n_args; i++) {
+			PgfCncTree argf = gu_seq_get(fapp->args, PgfCncTree, i);
+			key.args[i] = pgf_lzr_memo_entry(memo, argf);
+		}
+		break;
+	default:
+		gu_impossible();
+		return NULL;
+	}
+	PgfLzrMemoEntry* entry =
+		gu_map_get(memo->entries, &key, PgfLzrMemoEntry*);
+	if (entry != NULL) {
+		if (tmp_pool != NULL) {
+			gu_pool_free(tmp_pool);
+		}
+		return entry;
+	}
+	entry = gu_new(PgfLzrMemoEntry, memo->pool);
+	if (flit != NULL) {
+		entry->spans = pgf_lzr_lit_spans(flit->lit, memo->items,
+						 memo->pool, memo->pool);
+		entry->n_ctnts = 1;
+	} else {
+		PgfLinSpan* local_spans[PGF_LZR_MEMO_LOCAL_ARGS];
+		int local_n_ctnts[PGF_LZR_MEMO_LOCAL_ARGS];
+		PgfLinSpan** arg_spans = local_spans;
+		int* arg_n_ctnts = local_n_ctnts;
+		if (tmp_pool != NULL) {
+			arg_spans = gu_new_n(PgfLinSpan*, key.n_args, tmp_pool);
+			arg_n_ctnts = gu_new_n(int, key.n_args, tmp_pool);
+		}
+		for (size_t i = 0; i < key.n_args; i++) {
+			arg_spans[i] = key.args[i]->spans;
+			arg_n_ctnts[i] = key.args[i]->n_ctnts;
+		}
+		entry->spans = pgf_lzr_app_spans(memo->lzr->cnc, fapp->fun,
+						 key.n_args,
+						 arg_spans, arg_n_ctnts,
+						 memo->items, memo->pool);
+		entry->n_ctnts = (int) gu_seq_length(fapp->fun->lins);
+		PgfLzrMemoEntry** args =
+			gu_new_n(PgfLzrMemoEntry*, key.n_args, memo->pool);
+		memcpy(args, key.args, key.n_args * sizeof(PgfLzrMemoEntry*));
+		key.args = args;
+	}
+	gu_map_put(memo->entries, &key, PgfLzrMemoEntry*, entry);
+	if (tmp_pool != NULL) {
+		gu_pool_free(tmp_pool);
+	}
+	return entry;
+}
+
+PgfLinTable*
+pgf_lzr_memo_table(PgfLzrMemo* memo, PgfCncTree ctree, GuPool* pool)
+{
+	PgfLzrMemoEntry* entry = pgf_lzr_memo_entry(memo, ctree);
+	return pgf_lzr_pack_table(memo->lzr, memo->items, entry->spans,
+				  entry->n_ctnts, pool);
+}
+
+//
+// Linearization into a byte buffer
+//
+
+typedef struct PgfLzrUtf8Queue PgfLzrUtf8Queue;
+
+struct PgfLzrUtf8Queue {
+	PgfLzrKPQueue q;
+	GuByteBuf* buf;
+	size_t start;
+	/**< The length of `buf` before the linearization began. */
+};
+
+static void
+pgf_lzr_utf8_emit(PgfLzrKPQueue* q, PgfTokens toks)
+{
+	PgfLzrUtf8Queue* uq = gu_container(q, PgfLzrUtf8Queue, q);
+	size_t n_toks = gu_seq_length(toks);
+	for (size_t i = 0; i < n_toks; i++) {
+		if (gu_buf_length(uq->buf) > uq->start) {
+			gu_buf_push(uq->buf, uint8_t, ' ');
+		}
+		gu_string_push_utf8(gu_seq_get(toks, PgfToken, i), uq->buf);
+	}
+}
+
+static void
+pgf_lzr_utf8_literal(PgfLzrUtf8Queue* uq, PgfLiteral lit)
+{
+	if (uq->q.n_kps > 0) {
+		pgf_lzr_kp_flush(&uq->q, pgf_lzr_literal_next(lit));
+	}
+	GuByteBuf* buf = uq->buf;
+	if (gu_buf_length(buf) > uq->start) {
+		gu_buf_push(buf, uint8_t, ' ');
+	}
+	GuVariantInfo i = gu_variant_open(lit);
+	char num[32];
+	int len = 0;
+	switch (i.tag) {
+	case PGF_LITERAL_STR: {
+		PgfLiteralStr* lstr = i.data;
+		gu_string_push_utf8(lstr->val, buf);
+		return;
+	}
+	case PGF_LITERAL_INT: {
+		PgfLiteralInt* lint = i.data;
+		len = snprintf(num, sizeof(num), "%d", lint->val);
+		break;
+	}
+	case PGF_LITERAL_FLT: {
+		PgfLiteralFlt* lflt = i.data;
+		len = snprintf(num, sizeof(num), "%lg", lflt->val);
+		break;
+	}
+	default:
+		gu_impossible();
+	}
+	gu_buf_push_n(buf, num, GU_MIN((size_t) len, sizeof(num) - 1));
+}
+
+static void
+pgf_lzr_linearize_utf8_at(PgfLzr* lzr, PgfCncTree ctree, PgfCtntId lin_idx,
+			  PgfLzrUtf8Queue* uq)
+{
+	GuVariantInfo cti = gu_variant_open(ctree);
+	gu_require(lin_idx >= 0);
+	switch (cti.tag) {
+	case PGF_CNC_TREE_LIT: {
+		gu_require(lin_idx == 0);
+		PgfCncTreeLit* flit = cti.data;
+		pgf_lzr_utf8_literal(uq, flit->lit);
+		break;
+	}
+	case PGF_CNC_TREE_APP: {
+		PgfCncTreeApp* fapp = cti.data;
+		PgfCncFun* fun = fapp->fun;
+		gu_require((size_t) lin_idx < gu_seq_length(fun->lins));
+		PgfSequence seq = gu_seq_get(fun->lins, PgfSequence, lin_idx);
+		size_t nsyms = gu_seq_length(seq);
+		PgfSymbol* syms = gu_seq_data(seq);
+		for (size_t i = 0; i < nsyms; i++) {
+			PgfSymbol sym = syms[i];
+			switch (pgf_symbol_tag(sym)) {
+			case PGF_SYMBOL_CAT:
+			case PGF_SYMBOL_VAR:
+			case PGF_SYMBOL_LIT: {
+				PgfCncTree argf = gu_seq_get(fapp->args,
+							     PgfCncTree,
+							     pgf_symbol_d(sym));
+				pgf_lzr_linearize_utf8_at(lzr, argf,
+							  pgf_symbol_r(sym),
+							  uq);
+				break;
+			}
+			case PGF_SYMBOL_KS: {
+				PgfSymbolKS* ks = pgf_symbol_ks(lzr->cnc, sym);
+				pgf_lzr_kp_tokens(&uq->q, ks->tokens);
+				break;
+			}
+			case PGF_SYMBOL_KP: {
+				PgfSymbolKP* kp = pgf_symbol_kp(lzr->cnc, sym);
+				pgf_lzr_kp_push(&uq->q, kp);
+				break;
+			}
+			default:
+				gu_impossible();
+			}
+		}
+		break;
+	}
+	default:
+		gu_impossible();
+	}
+}
+
+void
+pgf_lzr_linearize_utf8(PgfLzr* lzr, PgfCncTree ctree, PgfCtntId lin_idx,
+		       GuByteBuf* buf)
+{
+	PgfLzrUtf8Queue uq = {
+		.buf = buf,
+		.start = gu_buf_length(buf)
+	};
+	pgf_lzr_kp_init(&uq.q, pgf_lzr_utf8_emit, lzr);
+	pgf_lzr_linearize_utf8_at(lzr, ctree, lin_idx, &uq);
+	pgf_lzr_kp_finish(&uq.q);
+}
+
 
 
 typedef struct PgfSimplePrtr PgfSimplePrtr;
@@ -123,6 +123,84 @@ pgf_lzr_linearize_simple(PgfLzr* lzr, PgfCncTree ctree,
 			 PgfCtntId ctnt, GuWriter* wtr, GuExn* err);
 
 
+/// A range of tokens in a #PgfLinTable.
+typedef struct PgfLinSpan PgfLinSpan;
+
+struct PgfLinSpan {
+	size_t begin;
+	/**< The index of the first token. */
+	size_t end;
+	/**< The index one past the last token. */
+};
+
+/// All the linearizations of a concrete syntax tree.
+typedef struct PgfLinTable PgfLinTable;
+
+struct PgfLinTable {
+	PgfTokens tokens;
+	/**< The tokens of all the constituents, one after another. */
+	GuSeq spans;
+	/**< The #PgfLinSpan of each constituent in `tokens`, indexed
+	 * by #PgfCtntId. */
+};
+
+/// Linearize all the constituents of a concrete syntax tree.
+PgfLinTable*
+pgf_lzr_linearize_table(PgfLzr* lzr, PgfCncTree ctree, GuPool* pool);
+/**<
+ * Every constituent of every subtree is computed exactly once, so this is
+ * cheaper than calling #pgf_lzr_linearize for each constituent when the
+ * whole inflection table is needed. Literals are rendered as single
+ * tokens.
+ *
+ * @pool
+ *
+ * @return A table with #pgf_cnc_tree_n_ctnts spans.
+ */
+
+
+/// A cache of the linearizations of concrete subtrees.
+typedef struct PgfLzrMemo PgfLzrMemo;
+/**<
+ * When many concrete trees share subtrees, as the readings of an
+ * ambiguous sentence do, a memo lets each distinct subtree be linearized
+ * only once. Subtrees are recognized by their structure, so the trees
+ * need not share memory. A memo is not thread-safe, and its memory grows
+ * with the number of distinct subtrees, so it is meant to be used for one
+ * batch of trees and then freed with its pool.
+ */
+
+/// Create a new linearization memo.
+PgfLzrMemo*
+pgf_new_lzr_memo(PgfLzr* lzr, GuPool* pool);
+
+/// Linearize all the constituents of a concrete syntax tree using a memo.
+PgfLinTable*
+pgf_lzr_memo_table(PgfLzrMemo* memo, PgfCncTree ctree, GuPool* pool);
+/**<
+ * The result is the same as that of #pgf_lzr_linearize_table, but the
+ * subtrees of `ctree` that have already been linearized with `memo` are
+ * not linearized again.
+ *
+ * @pool
+ */
+
+
+/// Linearize a concrete syntax tree into a UTF-8 byte buffer.
+void
+pgf_lzr_linearize_utf8(PgfLzr* lzr, PgfCncTree ctree,
+		       PgfCtntId ctnt, GuByteBuf* buf);
+/**<
+ * The tokens are appended to `buf`, separated by single spaces, without
+ * going through a #PgfPresenter or a #GuWriter. Each token is copied with
+ * one `memcpy`, and nothing is allocated from a pool, so a buffer that is
+ * cleared and reused between sentences stops growing once it is large
+ * enough. The only exception is a run of more than eight prefix-dependent
+ * tokens with nothing in between, which are kept in a temporary pool
+ * until the token that follows them is known.
+ */
+
+
 /// Return the dimension of a concrete syntax tree.
 int
 pgf_cnc_tree_n_ctnts(PgfCncTree ctree);
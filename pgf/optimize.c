@@ -0,0 +1,643 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#include "data.h"
+#include "optimize.h"
+#include <gu/map.h>
+#include <gu/seq.h>
+#include <gu/assert.h>
+
+//
+// Sequences with the same symbols
+//
+
+static GuHash
+pgf_tokens_hash(GuHash h, PgfTokens toks)
+{
+	size_t n_toks = gu_seq_length(toks);
+	h = h * 31 + (GuHash) n_toks;
+	for (size_t i = 0; i < n_toks; i++) {
+		h = h * 31 + gu_string_hash(gu_seq_get(toks, PgfToken, i));
+	}
+	return h;
+}
+
+static bool
+pgf_tokens_eq(PgfTokens toks1, PgfTokens toks2)
+{
+	size_t n_toks = gu_seq_length(toks1);
+	if (gu_seq_length(toks2) != n_toks) {
+		return false;
+	}
+	for (size_t i = 0; i < n_toks; i++) {
+		if (!gu_string_eq(gu_seq_get(toks1, PgfToken, i),
+				  gu_seq_get(toks2, PgfToken, i))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static GuHash
+pgf_symbol_hash(PgfConcr* concr, GuHash h, PgfSymbol sym)
+{
+	PgfSymbolTag tag = pgf_symbol_tag(sym);
+	h = h * 31 + (GuHash) tag;
+	switch (tag) {
+	case PGF_SYMBOL_CAT:
+	case PGF_SYMBOL_LIT:
+	case PGF_SYMBOL_VAR: {
+		h = h * 31 + (GuHash) pgf_symbol_d(sym);
+		return h * 31 + (GuHash) pgf_symbol_r(sym);
+	}
+	case PGF_SYMBOL_KS: {
+		PgfSymbolKS* ks = pgf_symbol_ks(concr, sym);
+		return pgf_tokens_hash(h, ks->tokens);
+	}
+	case PGF_SYMBOL_KP: {
+		PgfSymbolKP* kp = pgf_symbol_kp(concr, sym);
+		h = pgf_tokens_hash(h, kp->default_form);
+		size_t n_alts = gu_seq_length(kp->alts);
+		for (size_t j = 0; j < n_alts; j++) {
+			PgfAlternative* alt =
+				gu_seq_index(kp->alts, PgfAlternative, j);
+			h = pgf_tokens_hash(h, alt->form);
+			h = pgf_tokens_hash(h, alt->prefixes);
+		}
+		return h;
+	}
+	default:
+		gu_impossible();
+		return h;
+	}
+}
+
+static bool
+pgf_symbol_eq(PgfConcr* concr, PgfSymbol sym1, PgfSymbol sym2)
+{
+	if (sym1.word == sym2.word) {
+		return true;
+	}
+	PgfSymbolTag tag = pgf_symbol_tag(sym1);
+	if (pgf_symbol_tag(sym2) != tag) {
+		return false;
+	}
+	switch (tag) {
+	case PGF_SYMBOL_CAT:
+	case PGF_SYMBOL_LIT:
+	case PGF_SYMBOL_VAR:
+		// The indices are in the words.
+		return false;
+	case PGF_SYMBOL_KS: {
+		PgfSymbolKS* ks1 = pgf_symbol_ks(concr, sym1);
+		PgfSymbolKS* ks2 = pgf_symbol_ks(concr, sym2);
+		return pgf_tokens_eq(ks1->tokens, ks2->tokens);
+	}
+	case PGF_SYMBOL_KP: {
+		PgfSymbolKP* kp1 = pgf_symbol_kp(concr, sym1);
+		PgfSymbolKP* kp2 = pgf_symbol_kp(concr, sym2);
+		size_t n_alts = gu_seq_length(kp1->alts);
+		if (!pgf_tokens_eq(kp1->default_form, kp2->default_form)
+		    || gu_seq_length(kp2->alts) != n_alts) {
+			return false;
+		}
+		for (size_t j = 0; j < n_alts; j++) {
+			PgfAlternative* alt1 =
+				gu_seq_index(kp1->alts, PgfAlternative, j);
+			PgfAlternative* alt2 =
+				gu_seq_index(kp2->alts, PgfAlternative, j);
+			if (!pgf_tokens_eq(alt1->form, alt2->form)
+			    || !pgf_tokens_eq(alt1->prefixes, alt2->prefixes)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	default:
+		gu_impossible();
+		return false;
+	}
+}
+
+typedef struct PgfSequenceHasher PgfSequenceHasher;
+
+// The keyword symbols of a sequence are looked up in the concrete grammar
+// that it belongs to.
+struct PgfSequenceHasher {
+	struct GuHasher hasher;
+	struct GuEq eq;
+	PgfConcr* concr;
+};
+
+static GuHash
+pgf_sequence_hash(GuHasher* self, GuHash h, const void* p)
+{
+	PgfSequenceHasher* shasher =
+		gu_container(self, PgfSequenceHasher, hasher);
+	PgfSequence seq = *(const PgfSequence*) p;
+	size_t n_syms = gu_seq_length(seq);
+	h = h * 31 + (GuHash) n_syms;
+	for (size_t i = 0; i < n_syms; i++) {
+		h = pgf_symbol_hash(shasher->concr, h,
+				    gu_seq_get(seq, PgfSymbol, i));
+	}
+	return h;
+}
+
+static bool
+pgf_sequence_eq(GuEq* self, const void* p1, const void* p2)
+{
+	PgfSequenceHasher* shasher = gu_container(self, PgfSequenceHasher, eq);
+	PgfSequence seq1 = *(const PgfSequence*) p1;
+	PgfSequence seq2 = *(const PgfSequence*) p2;
+	size_t n_syms = gu_seq_length(seq1);
+	if (gu_seq_length(seq2) != n_syms) {
+		return false;
+	}
+	for (size_t i = 0; i < n_syms; i++) {
+		if (!pgf_symbol_eq(shasher->concr,
+				   gu_seq_get(seq1, PgfSymbol, i),
+				   gu_seq_get(seq2, PgfSymbol, i))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static GuHasherFuns pgf_sequence_hasher_funs = {
+	.hash = pgf_sequence_hash
+};
+
+static GuEqFuns pgf_sequence_eq_funs = {
+	.is_equal = pgf_sequence_eq
+};
+
+static GuHasher*
+pgf_new_sequence_hasher(PgfConcr* concr, GuPool* pool)
+{
+	PgfSequenceHasher* shasher = gu_new(PgfSequenceHasher, pool);
+	shasher->hasher.funs = &pgf_sequence_hasher_funs;
+	shasher->hasher.eq = &shasher->eq;
+	shasher->eq.funs = &pgf_sequence_eq_funs;
+	shasher->concr = concr;
+	return &shasher->hasher;
+}
+
+//
+// Functions with the same sequences
+//
+
+// The sequences of the functions have already been merged, so they are
+// compared by address.
+static GuHash
+pgf_cncfun_hash(GuHasher* self, GuHash h, const void* p)
+{
+	const PgfCncFun* cncfun = *(PgfCncFun* const*) p;
+	size_t n_lins = gu_seq_length(cncfun->lins);
+	h = h * 31 + gu_string_hash(cncfun->fun);
+	for (size_t i = 0; i < n_lins; i++) {
+		PgfSequence seq = gu_seq_get(cncfun->lins, PgfSeqId, i);
+		h = h * 31 + gu_hash_ptr(gu_seq_data(seq));
+	}
+	return h;
+}
+
+static bool
+pgf_cncfun_eq(GuEq* self, const void* p1, const void* p2)
+{
+	const PgfCncFun* cncfun1 = *(PgfCncFun* const*) p1;
+	const PgfCncFun* cncfun2 = *(PgfCncFun* const*) p2;
+	size_t n_lins = gu_seq_length(cncfun1->lins);
+	if (!gu_string_eq(cncfun1->fun, cncfun2->fun)
+	    || gu_seq_length(cncfun2->lins) != n_lins) {
+		return false;
+	}
+	for (size_t i = 0; i < n_lins; i++) {
+		PgfSequence seq1 = gu_seq_get(cncfun1->lins, PgfSeqId, i);
+		PgfSequence seq2 = gu_seq_get(cncfun2->lins, PgfSeqId, i);
+		if (gu_seq_data(seq1) != gu_seq_data(seq2)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static GU_DEFINE_HASHER(pgf_cncfun_hasher,
+			pgf_cncfun_hash, pgf_cncfun_eq);
+
+//
+// Productions of the same ccat
+//
+
+typedef struct PgfProductionKey PgfProductionKey;
+
+struct PgfProductionKey {
+	PgfCCat* ccat;
+	PgfProduction prod;
+};
+
+static GuHash
+pgf_production_key_hash(GuHasher* self, GuHash h, const void* p)
+{
+	const PgfProductionKey* key = p;
+	h = h * 31 + gu_hash_ptr(key->ccat);
+	GuVariantInfo i = gu_variant_open(key->prod);
+	h = h * 31 + (GuHash) i.tag;
+	switch (i.tag) {
+	case PGF_PRODUCTION_APPLY: {
+		PgfProductionApply* papp = i.data;
+		size_t n_args = gu_seq_length(papp->args);
+		h = h * 31 + gu_hash_ptr(papp->fun);
+		for (size_t j = 0; j < n_args; j++) {
+			PgfPArg* parg = gu_seq_index(papp->args, PgfPArg, j);
+			h = h * 31 + gu_hash_ptr(parg->ccat);
+		}
+		return h;
+	}
+	case PGF_PRODUCTION_COERCE: {
+		PgfProductionCoerce* pcoerce = i.data;
+		return h * 31 + gu_hash_ptr(pcoerce->coerce);
+	}
+	default:
+		gu_impossible();
+		return h;
+	}
+}
+
+static bool
+pgf_production_key_eq(GuEq* self, const void* p1, const void* p2)
+{
+	const PgfProductionKey* key1 = p1;
+	const PgfProductionKey* key2 = p2;
+	return key1->ccat == key2->ccat
+		&& pgf_production_eq(key1->prod, key2->prod);
+}
+
+static GU_DEFINE_HASHER(pgf_production_key_hasher,
+			pgf_production_key_hash, pgf_production_key_eq);
+
+//
+// The pass
+//
+
+typedef struct PgfOptimizer PgfOptimizer;
+
+static const bool pgf_optimizer_false = false;
+
+struct PgfOptimizer {
+	GuPool* pool;
+	GuPool* tmp_pool;
+	GuMap* ccats;
+	/**< Maps each ccat that has been seen to whether it is productive. */
+	GuBuf* seen;
+	/**< The keys of `ccats`, in the order they were seen in. */
+	GuMap* sequences;
+	/**< Maps each sequence to the first sequence with the same
+	 * symbols. */
+	GuMap* cncfuns;
+	/**< Maps each function to the first function with the same
+	 * abstract function and sequences. */
+	GuMap* canonical;
+	/**< Maps each function that has been seen to its replacement. */
+	GuMap* prods;
+	/**< The set of productions that have been kept so far. */
+};
+
+static void
+pgf_optimizer_see(PgfOptimizer* opt, PgfCCat* ccat)
+{
+	if (gu_map_has(opt->ccats, ccat)) {
+		return;
+	}
+	// The reader creates a ccat without productions for each literal
+	// category (String, Int, Float, Var) that is used as an argument.
+	// They are productive, since they match the literals.
+	bool productive = (ccat->cnccat == NULL
+			   && gu_seq_is_null(ccat->prods)
+			   && pgf_ccat_fid(ccat) < 0);
+	gu_map_put(opt->ccats, ccat, bool, productive);
+	gu_buf_push(opt->seen, PgfCCat*, ccat);
+}
+
+static bool
+pgf_optimizer_is_productive(PgfOptimizer* opt, PgfCCat* ccat)
+{
+	return gu_map_get(opt->ccats, ccat, bool);
+}
+
+// Add the ccats that are reachable from the productions of the seen ccats
+// from index `i` onwards.
+static void
+pgf_optimizer_see_reachable(PgfOptimizer* opt, size_t i)
+{
+	for (; i < gu_buf_length(opt->seen); i++) {
+		PgfCCat* ccat = gu_buf_get(opt->seen, PgfCCat*, i);
+		size_t n_prods = pgf_ccat_n_prods(ccat);
+		for (size_t j = 0; j < n_prods; j++) {
+			PgfProduction prod =
+				gu_seq_get(ccat->prods, PgfProduction, j);
+			GuVariantInfo pi = gu_variant_open(prod);
+			switch (pi.tag) {
+			case PGF_PRODUCTION_APPLY: {
+				PgfProductionApply* papp = pi.data;
+				size_t n_args = gu_seq_length(papp->args);
+				for (size_t k = 0; k < n_args; k++) {
+					PgfPArg* parg = gu_seq_index(
+						papp->args, PgfPArg, k);
+					size_t n_hypos =
+						gu_seq_length(parg->hypos);
+					for (size_t h = 0; h < n_hypos; h++) {
+						pgf_optimizer_see(
+							opt, gu_seq_get(
+								parg->hypos,
+								PgfCCatId, h));
+					}
+					pgf_optimizer_see(opt, parg->ccat);
+				}
+				break;
+			}
+			case PGF_PRODUCTION_COERCE: {
+				PgfProductionCoerce* pcoerce = pi.data;
+				pgf_optimizer_see(opt, pcoerce->coerce);
+				break;
+			}
+			default:
+				gu_impossible();
+			}
+		}
+	}
+}
+
+// A production is useful if all of its arguments are productive. The
+// ccats of bound variables (hypos) need no derivations.
+static bool
+pgf_optimizer_is_useful(PgfOptimizer* opt, PgfProduction prod)
+{
+	GuVariantInfo pi = gu_variant_open(prod);
+	switch (pi.tag) {
+	case PGF_PRODUCTION_APPLY: {
+		PgfProductionApply* papp = pi.data;
+		size_t n_args = gu_seq_length(papp->args);
+		for (size_t k = 0; k < n_args; k++) {
+			PgfPArg* parg = gu_seq_index(papp->args, PgfPArg, k);
+			if (!pgf_optimizer_is_productive(opt, parg->ccat)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	case PGF_PRODUCTION_COERCE: {
+		PgfProductionCoerce* pcoerce = pi.data;
+		return pgf_optimizer_is_productive(opt, pcoerce->coerce);
+	}
+	default:
+		gu_impossible();
+		return false;
+	}
+}
+
+static void
+pgf_optimizer_find_productive(PgfOptimizer* opt)
+{
+	size_t n_seen = gu_buf_length(opt->seen);
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t i = 0; i < n_seen; i++) {
+			PgfCCat* ccat = gu_buf_get(opt->seen, PgfCCat*, i);
+			bool* productivep = gu_map_insert(opt->ccats, ccat);
+			size_t n_prods = pgf_ccat_n_prods(ccat);
+			for (size_t j = 0; !*productivep && j < n_prods; j++) {
+				PgfProduction prod = gu_seq_get(
+					ccat->prods, PgfProduction, j);
+				if (pgf_optimizer_is_useful(opt, prod)) {
+					*productivep = true;
+					changed = true;
+				}
+			}
+		}
+	}
+}
+
+static PgfCncFun*
+pgf_optimizer_canonical_cncfun(PgfOptimizer* opt, PgfCncFun* cncfun)
+{
+	PgfCncFun** canonicalp = gu_map_insert(opt->canonical, cncfun);
+	if (*canonicalp == NULL) {
+		// The functions are only referred to through productions and
+		// lindefs, so their sequences can be replaced in place.
+		size_t n_lins = gu_seq_length(cncfun->lins);
+		for (size_t i = 0; i < n_lins; i++) {
+			PgfSequence seq =
+				gu_seq_get(cncfun->lins, PgfSeqId, i);
+			PgfSequence* seqp =
+				gu_map_insert(opt->sequences, &seq);
+			if (gu_seq_is_null(*seqp)) {
+				*seqp = seq;
+			}
+			gu_seq_set(cncfun->lins, PgfSeqId, i, *seqp);
+		}
+		PgfCncFun** samep = gu_map_insert(opt->cncfuns, &cncfun);
+		if (*samep == NULL) {
+			*samep = cncfun;
+		}
+		*canonicalp = *samep;
+	}
+	return *canonicalp;
+}
+
+// Replace the productions of `ccat` with the useful ones, with their
+// functions merged.
+static void
+pgf_optimizer_prune_ccat(PgfOptimizer* opt, PgfCCat* ccat)
+{
+	if (gu_seq_is_null(ccat->prods)) {
+		return;
+	}
+	size_t n_prods = pgf_ccat_n_prods(ccat);
+	GuBuf* prods = gu_new_buf(PgfProduction, opt->tmp_pool);
+	for (size_t i = 0; i < n_prods; i++) {
+		PgfProduction prod = gu_seq_get(ccat->prods, PgfProduction, i);
+		if (!pgf_optimizer_is_useful(opt, prod)) {
+			continue;
+		}
+		GuVariantInfo pi = gu_variant_open(prod);
+		if (pi.tag == PGF_PRODUCTION_APPLY) {
+			PgfProductionApply* papp = pi.data;
+			papp->fun = pgf_optimizer_canonical_cncfun(opt,
+								  papp->fun);
+		}
+		PgfProductionKey key = { ccat, prod };
+		bool* seenp = gu_map_insert(opt->prods, &key);
+		if (!*seenp) {
+			*seenp = true;
+			gu_buf_push(prods, PgfProduction, prod);
+		}
+	}
+	if (gu_buf_length(prods) < n_prods) {
+		ccat->prods = gu_buf_freeze(prods, opt->pool);
+	}
+}
+
+static void
+pgf_optimizer_reach(GuMap* reachable, GuBuf* queue, PgfCCat* ccat)
+{
+	if (!gu_map_has(reachable, ccat)) {
+		gu_map_put(reachable, ccat, bool, true);
+		gu_buf_push(queue, PgfCCat*, ccat);
+	}
+}
+
+static void
+pgf_optimize_concr(PgfOptimizer* opt, PgfConcr* concr, GuBuf* cnccats)
+{
+	GuPool* tmp_pool = opt->tmp_pool;
+	opt->ccats = gu_new_addr_map(PgfCCat, bool, &pgf_optimizer_false,
+				     tmp_pool);
+	opt->seen = gu_new_buf(PgfCCat*, tmp_pool);
+	opt->sequences = gu_new_map(PgfSequence,
+				    pgf_new_sequence_hasher(concr, tmp_pool),
+				    PgfSequence, &gu_null_seq, tmp_pool);
+	opt->cncfuns = gu_new_map(PgfCncFun*, pgf_cncfun_hasher,
+				  PgfCncFun*, &gu_null, tmp_pool);
+	opt->canonical = gu_new_addr_map(PgfCncFun, PgfCncFun*,
+					 &gu_null, tmp_pool);
+	opt->prods = gu_new_map(PgfProductionKey, pgf_production_key_hasher,
+				bool, &pgf_optimizer_false, tmp_pool);
+
+	size_t n_cnccats = gu_buf_length(cnccats);
+	for (size_t i = 0; i < n_cnccats; i++) {
+		PgfCncCat* cnccat = gu_buf_get(cnccats, PgfCncCat*, i);
+		size_t n_cats = gu_seq_length(cnccat->cats);
+		for (size_t j = 0; j < n_cats; j++) {
+			PgfCCat* ccat = gu_seq_get(cnccat->cats, PgfCCatId, j);
+			if (ccat != NULL) {
+				pgf_optimizer_see(opt, ccat);
+			}
+		}
+	}
+	size_t n_extras = gu_seq_length(concr->extra_ccats);
+	for (size_t i = 0; i < n_extras; i++) {
+		pgf_optimizer_see(opt, gu_seq_get(concr->extra_ccats,
+						  PgfCCatId, i));
+	}
+	pgf_optimizer_see_reachable(opt, 0);
+	pgf_optimizer_find_productive(opt);
+
+	size_t n_seen = gu_buf_length(opt->seen);
+	for (size_t i = 0; i < n_seen; i++) {
+		pgf_optimizer_prune_ccat(opt, gu_buf_get(opt->seen, PgfCCat*, i));
+	}
+
+	// Erase the useless ccats from the ranges, as GF does, and keep the
+	// other ccats that can still be reached from them.
+	GuMap* reachable = gu_new_addr_map(PgfCCat, bool, &pgf_optimizer_false,
+					   tmp_pool);
+	GuBuf* queue = gu_new_buf(PgfCCat*, tmp_pool);
+	for (size_t i = 0; i < n_cnccats; i++) {
+		PgfCncCat* cnccat = gu_buf_get(cnccats, PgfCncCat*, i);
+		size_t n_cats = gu_seq_length(cnccat->cats);
+		for (size_t j = 0; j < n_cats; j++) {
+			PgfCCat* ccat = gu_seq_get(cnccat->cats, PgfCCatId, j);
+			if (ccat == NULL) {
+				continue;
+			}
+			if (!pgf_optimizer_is_productive(opt, ccat)) {
+				gu_seq_set(cnccat->cats, PgfCCatId, j, NULL);
+				continue;
+			}
+			pgf_optimizer_reach(reachable, queue, ccat);
+		}
+		size_t n_lindefs = gu_seq_is_null(cnccat->lindefs)
+			? 0 : gu_seq_length(cnccat->lindefs);
+		for (size_t j = 0; j < n_lindefs; j++) {
+			PgfCncFun* cncfun =
+				gu_seq_get(cnccat->lindefs, PgfFunId, j);
+			gu_seq_set(cnccat->lindefs, PgfFunId, j,
+				   pgf_optimizer_canonical_cncfun(opt, cncfun));
+		}
+	}
+	for (size_t i = 0; i < gu_buf_length(queue); i++) {
+		PgfCCat* ccat = gu_buf_get(queue, PgfCCat*, i);
+		size_t n_prods = pgf_ccat_n_prods(ccat);
+		for (size_t j = 0; j < n_prods; j++) {
+			PgfProduction prod =
+				gu_seq_get(ccat->prods, PgfProduction, j);
+			GuVariantInfo pi = gu_variant_open(prod);
+			if (pi.tag == PGF_PRODUCTION_COERCE) {
+				PgfProductionCoerce* pcoerce = pi.data;
+				pgf_optimizer_reach(reachable, queue,
+						    pcoerce->coerce);
+				continue;
+			}
+			PgfProductionApply* papp = pi.data;
+			size_t n_args = gu_seq_length(papp->args);
+			for (size_t k = 0; k < n_args; k++) {
+				PgfPArg* parg =
+					gu_seq_index(papp->args, PgfPArg, k);
+				size_t n_hypos = gu_seq_length(parg->hypos);
+				for (size_t h = 0; h < n_hypos; h++) {
+					pgf_optimizer_reach(
+						reachable, queue,
+						gu_seq_get(parg->hypos,
+							   PgfCCatId, h));
+				}
+				pgf_optimizer_reach(reachable, queue,
+						    parg->ccat);
+			}
+		}
+	}
+	GuBuf* extras = gu_new_buf(PgfCCat*, tmp_pool);
+	for (size_t i = 0; i < n_extras; i++) {
+		PgfCCat* ccat = gu_seq_get(concr->extra_ccats, PgfCCatId, i);
+		if (gu_map_has(reachable, ccat)) {
+			gu_buf_push(extras, PgfCCat*, ccat);
+		}
+	}
+	if (gu_buf_length(extras) < n_extras) {
+		concr->extra_ccats = gu_buf_freeze(extras, opt->pool);
+	}
+	// The numbering of the file no longer fits.
+	concr->layout = NULL;
+}
+
+typedef struct {
+	GuMapItor fn;
+	GuBuf* cnccats;
+} PgfOptimizeCollectFn;
+
+static void
+pgf_optimize_collect_cnccat_cb(GuMapItor* fn, const void* key, void* value,
+			       GuExn* err)
+{
+	PgfOptimizeCollectFn* clo = (PgfOptimizeCollectFn*) fn;
+	gu_buf_push(clo->cnccats, PgfCncCat*, *(PgfCncCat**) value);
+}
+
+typedef struct {
+	GuMapItor fn;
+	PgfOptimizer* opt;
+} PgfOptimizeConcrFn;
+
+static void
+pgf_optimize_concr_cb(GuMapItor* fn, const void* key, void* value,
+		      GuExn* err)
+{
+	PgfOptimizeConcrFn* clo = (PgfOptimizeConcrFn*) fn;
+	PgfOptimizer* opt = clo->opt;
+	PgfConcr* concr = *(PgfConcr**) value;
+	opt->tmp_pool = gu_new_pool();
+	GuBuf* cnccats = gu_new_buf(PgfCncCat*, opt->tmp_pool);
+	PgfOptimizeCollectFn collect_clo =
+		{ { pgf_optimize_collect_cnccat_cb }, cnccats };
+	gu_map_iter(concr->cnccats, &collect_clo.fn, err);
+	pgf_optimize_concr(opt, concr, cnccats);
+	gu_pool_free(opt->tmp_pool);
+}
+
+void
+pgf_optimize(PgfPGF* pgf, GuPool* pool)
+{
+	PgfOptimizer opt = { .pool = pool };
+	PgfOptimizeConcrFn clo = { { pgf_optimize_concr_cb }, &opt };
+	gu_map_iter(pgf->concretes, &clo.fn, gu_null_exn());
+}
@@ -0,0 +1,52 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#ifndef PGF_OPTIMIZE_H_
+#define PGF_OPTIMIZE_H_
+
+#include <libgu.h>
+#include <pgf/pgf.h>
+
+/// Removing the useless parts of a grammar
+/** @file
+ *
+ * Grammars compiled by GF often contain concrete categories that can't
+ * produce anything, productions that need such categories as arguments,
+ * and duplicate sequences and functions. They make the grammar bigger
+ * and the parser slower without changing what it parses or how trees are
+ * linearized.
+ */
+
+/// Remove the useless parts of the concrete grammars of a grammar
+void
+pgf_optimize(PgfPGF* pgf, GuPool* pool);
+/**<
+ * The grammar is changed in place:
+ *
+ * - A ccat is useless if it has no complete derivations, i.e. if none
+ *   of its productions has arguments whose ccats all have derivations.
+ *   Useless ccats are removed from the ranges of their concrete
+ *   categories, and every production that needs a useless ccat is
+ *   removed.
+ *
+ * - Ccats that are not reachable from the concrete categories are
+ *   forgotten.
+ *
+ * - Sequences with the same symbols are merged, and so are concrete
+ *   functions with the same abstract function and sequences. Then
+ *   productions of a ccat that have become equal are merged as well.
+ *
+ * Concrete functions and sequences that are no longer used are dropped
+ * when the grammar is written with #pgf_write_pgf, which also numbers the
+ * ccats densely instead of keeping the numbering of the file. The
+ * abstract grammar is left as it is.
+ *
+ * Parsing and linearizing with the optimized grammar give the same
+ * trees and strings as before, except that a reading that used to be
+ * found several times through duplicate functions may now be found only
+ * once.
+ *
+ * @param pool The pool that `pgf` was read into. The new productions are
+ * allocated from it.
+ */
+
+#endif // PGF_OPTIMIZE_H_
@@ -2,6 +2,7 @@
 
 #include <libpgf.h>
 #include "data.h"
+#include <stdlib.h>
 
 typedef struct PgfItem PgfItem;
 
@@ -20,17 +21,44 @@ typedef GuMap PgfTransitions;
 
 typedef GuBuf PgfCCatBuf;
 
+// PgfCCat* -> PgfPArgs
+typedef GuMap PgfCoerceArgs;
+
+static GU_DEFINE_TYPE(PgfCoerceArgs, GuMap,
+		      gu_type(PgfCCat), NULL,
+		      gu_type(PgfPArgs), &gu_null_seq);
+
 struct PgfParser {
 	PgfConcr* concr;
+	GuPool* pool;
 	GuHasher* item_hasher;
 	GuHasher* tokens_hasher;
-	int next_fid;
+	PgfParseOrder order;
+	PgfCoerceArgs* coerce_args;
+	/**< Canonical single-argument vectors of the coercions in the
+	 * grammar, indexed by the coerced category. */
+	GuMap* init_parses;
+	/**< Initial parse states, computed on demand. Maps each
+	 * #PgfCncCat to a sequence of #PgfParse pointers indexed by
+	 * constituent. */
+	GuMutex* mutex;
+	/**< Protects `init_parses` and the lazily computed parts of
+	 * shared parse states. */
 };
 
+typedef struct PgfCompletionIndex PgfCompletionIndex;
+
 struct PgfParse {
 	PgfParser* parser;
 	PgfTransitions* transitions;
 	PgfCCatBuf* completed;
+	PgfCompletionIndex* completions;
+	/**< The index of the next tokens, computed on demand. */
+	GuFinalizer fin;
+	int next_fid;
+	/**< The id for the next synthetic category. This is kept in the
+	 * parse state rather than in the parser so that a parser can be
+	 * shared between threads. */
 };
 
 typedef struct PgfParseResult PgfParseResult;
@@ -38,6 +66,9 @@ typedef struct PgfParseResult PgfParseResult;
 struct PgfParseResult {
 	PgfCCatBuf* completed;
 	GuChoice* choice;
+	PgfExprFactory* factory;
+	GuSet* seen;
+	/**< The trees returned so far, if they are hash-consed. */
 	PgfExprEnum en;
 };
 
@@ -78,13 +109,15 @@ static GU_DEFINE_TYPE(
 static void
 pgf_symbol_print(PgfSymbol sym, size_t tok_idx, GuWriter* wtr, GuExn* exn)
 {
-	GuVariantInfo i = gu_variant_open(sym);
 	if (tok_idx == 0) {
 		gu_puts(". ", wtr, exn);
 	}
-	switch (i.tag) {
+	switch (pgf_symbol_tag(sym)) {
+#ifndef GU_OPTIMIZE_SIZE
+	// Keywords are only found through their concrete grammar when the
+	// grammar is size-optimized, but then there is no debug output.
 	case PGF_SYMBOL_KS: {
-		PgfSymbolKS* sks = i.data;
+		PgfSymbolKS* sks = pgf_symbol_ks(NULL, sym);
 		size_t n_toks = gu_seq_length(sks->tokens);
 		PgfToken* toks = gu_seq_data(sks->tokens);
 		for (size_t i = 0; i < n_toks; i++) {
@@ -96,9 +129,10 @@ pgf_symbol_print(PgfSymbol sym, size_t tok_idx, GuWriter* wtr, GuExn* exn)
 		}
 		break;
 	}
+#endif
 	case PGF_SYMBOL_CAT: {
-		PgfSymbolCat* scat = i.data;
-		gu_printf(wtr, exn, "<%d,%d> ", scat->d, scat->r);
+		gu_printf(wtr, exn, "<%d,%d> ",
+			  pgf_symbol_d(sym), pgf_symbol_r(sym));
 		break;
 	}
 	default: {
@@ -226,6 +260,13 @@ static GU_DEFINE_TYPE(PgfTransitions, GuStringMap,
 
 typedef GuMap PgfGenCatMap;
 
+typedef struct PgfAgendaEntry PgfAgendaEntry;
+
+struct PgfAgendaEntry {
+	PgfItem* item;
+	size_t prio;
+};
+
 typedef struct PgfParsing PgfParsing;
 
 struct PgfParsing {
@@ -234,6 +275,10 @@ struct PgfParsing {
 	GuSet* seen_items;
 	PgfContsMap* conts_map;
 	PgfGenCatMap* generated_cats;
+	GuBuf* agenda; // -> PgfAgendaEntry
+	size_t agenda_head;
+	size_t n_processed;
+	size_t max_agenda;
 };
 
 
@@ -297,7 +342,7 @@ pgf_parsing_create_completed(PgfParsing* parsing, PgfItemSet* conts,
 {
 	PgfCCat* cat = gu_new(PgfCCat, parsing->pool);
 	cat->cnccat = cnccat;
-	pgf_ccat_set_fid(cat, --parsing->parse->parser->next_fid);
+	pgf_ccat_set_fid(cat, --parsing->parse->next_fid);
 	cat->prods = gu_buf_seq(gu_new_buf(PgfProduction, parsing->pool));
 	gu_map_put(parsing->generated_cats, conts, PgfCCat*, cat);
 	return cat;
@@ -309,8 +354,11 @@ pgf_parsing_get_completed(PgfParsing* parsing, PgfItemSet* conts)
 	return gu_map_get(parsing->generated_cats, conts, PgfCCat*);
 }
 
+/// The `curr_sym` of an item at the end of its sequence.
+static const PgfSymbol pgf_item_end_sym = { (PgfSymbolWord) -1 };
+
 static PgfSymbol
-pgf_item_base_symbol(PgfItemBase* ibase, size_t seq_idx, GuPool* pool)
+pgf_item_base_symbol(PgfItemBase* ibase, size_t seq_idx)
 {
 	GuVariantInfo i = gu_variant_open(ibase->prod);
 	switch (i.tag) {
@@ -321,7 +369,7 @@ pgf_item_base_symbol(PgfItemBase* ibase, size_t seq_idx, GuPool* pool)
 			gu_seq_get(fun->lins, PgfSequence, ibase->lin_idx);
 		gu_assert(seq_idx <= gu_seq_length(seq));
 		if (seq_idx == gu_seq_length(seq)) {
-			return gu_null_variant;
+			return pgf_item_end_sym;
 		} else {
 			return gu_seq_get(seq, PgfSymbol, seq_idx);
 		}
@@ -330,22 +378,35 @@ pgf_item_base_symbol(PgfItemBase* ibase, size_t seq_idx, GuPool* pool)
 	case PGF_PRODUCTION_COERCE: {
 		gu_assert(seq_idx <= 1);
 		if (seq_idx == 1) {
-			return gu_null_variant;
+			return pgf_item_end_sym;
 		} else {
-			return gu_new_variant_i(pool, PGF_SYMBOL_CAT,
-						PgfSymbolCat,
-						.d = 0, .r = ibase->lin_idx);
+			return pgf_symbol_idx(PGF_SYMBOL_CAT, 0,
+					      (int32_t) ibase->lin_idx);
 		}
 		break;
 	}
 	default:
 		gu_impossible();
 	}
-	return gu_null_variant;
+	return pgf_item_end_sym;
+}
+
+static PgfPArgs
+pgf_parser_coerce_args(PgfParser* parser, PgfCCat* coerce, GuPool* pool)
+{
+	PgfPArgs args = gu_map_get(parser->coerce_args, coerce, PgfPArgs);
+	if (gu_seq_is_null(args)) {
+		// A coercion to a category generated during parsing.
+		args = gu_new_seq(PgfPArg, 1, pool);
+		PgfPArg* parg = gu_seq_index(args, PgfPArg, 0);
+		parg->hypos = gu_empty_seq();
+		parg->ccat = coerce;
+	}
+	return args;
 }
 
 static PgfItem*
-pgf_new_item(PgfItemBase* base, GuPool* pool)
+pgf_new_item(PgfParser* parser, PgfItemBase* base, GuPool* pool)
 {
 	PgfItem* item = gu_new(PgfItem, pool);
 	GuVariantInfo pi = gu_variant_open(base->prod);
@@ -357,17 +418,15 @@ pgf_new_item(PgfItemBase* base, GuPool* pool)
 	}
 	case PGF_PRODUCTION_COERCE: {
 		PgfProductionCoerce* pcoerce = pi.data;
-		item->args = gu_new_seq(PgfPArg, 1, pool);
-		PgfPArg* parg = gu_seq_index(item->args, PgfPArg, 0);
-		parg->hypos = gu_empty_seq();
-		parg->ccat = pcoerce->coerce;
+		item->args = pgf_parser_coerce_args(parser, pcoerce->coerce,
+						    pool);
 		break;
 	}
 	default:
 		gu_impossible();
 	}
 	item->base = base;
-	item->curr_sym = pgf_item_base_symbol(item->base, 0, pool);
+	item->curr_sym = pgf_item_base_symbol(item->base, 0);
 	item->seq_idx = 0;
 	item->tok_idx = 0;
 	item->alt = 0;
@@ -383,14 +442,127 @@ pgf_item_copy(PgfItem* item, GuPool* pool)
 }
 
 static void
-pgf_item_advance(PgfItem* item, GuPool* pool)
+pgf_item_advance(PgfItem* item)
 {
 	item->seq_idx++;
-	item->curr_sym = pgf_item_base_symbol(item->base, item->seq_idx, pool);
+	item->curr_sym = pgf_item_base_symbol(item->base, item->seq_idx);
+}
+
+static size_t
+pgf_item_remaining(PgfItem* item)
+{
+	GuVariantInfo i = gu_variant_open(item->base->prod);
+	switch (i.tag) {
+	case PGF_PRODUCTION_APPLY: {
+		PgfProductionApply* papp = i.data;
+		PgfSequence seq = gu_seq_get(papp->fun->lins, PgfSequence,
+					     item->base->lin_idx);
+		return gu_seq_length(seq) - item->seq_idx;
+	}
+	case PGF_PRODUCTION_COERCE:
+		return 1 - item->seq_idx;
+	default:
+		gu_impossible();
+	}
+	return 0;
 }
 
 static void
-pgf_parsing_item(PgfParsing* parsing, PgfItem* item);
+pgf_agenda_sift_up(PgfAgendaEntry* heap, size_t n)
+{
+	PgfAgendaEntry e = heap[n];
+	while (n > 0) {
+		size_t parent = (n - 1) / 2;
+		if (heap[parent].prio <= e.prio) {
+			break;
+		}
+		heap[n] = heap[parent];
+		n = parent;
+	}
+	heap[n] = e;
+}
+
+static void
+pgf_agenda_sift_down(PgfAgendaEntry* heap, size_t len)
+{
+	PgfAgendaEntry e = heap[0];
+	size_t n = 0;
+	while (true) {
+		size_t child = 2 * n + 1;
+		if (child >= len) {
+			break;
+		}
+		if (child + 1 < len && heap[child + 1].prio < heap[child].prio) {
+			child++;
+		}
+		if (e.prio <= heap[child].prio) {
+			break;
+		}
+		heap[n] = heap[child];
+		n = child;
+	}
+	heap[n] = e;
+}
+
+/// Schedule an item for processing, unless it has been seen already.
+static void
+pgf_parsing_item(PgfParsing* parsing, PgfItem* item)
+{
+	gu_pdebug(GU_A({NULL, pgf_item_printer}), item);
+	if (gu_set_has(parsing->seen_items, &item)) {
+		gu_debug("Seen item already");
+		return;
+	}
+	gu_debug("Not seen before");
+	gu_set_insert(parsing->seen_items, &item);
+	PgfAgendaEntry entry = { .item = item, .prio = 0 };
+	PgfParseOrder order = parsing->parse->parser->order;
+	if (order == PGF_PARSE_ORDER_PRIORITY) {
+		entry.prio = pgf_item_remaining(item);
+	}
+	gu_buf_push(parsing->agenda, PgfAgendaEntry, entry);
+	size_t len = gu_buf_length(parsing->agenda);
+	if (order == PGF_PARSE_ORDER_PRIORITY) {
+		pgf_agenda_sift_up(gu_buf_data(parsing->agenda), len - 1);
+	}
+	parsing->max_agenda = GU_MAX(parsing->max_agenda,
+				     len - parsing->agenda_head);
+}
+
+static PgfItem*
+pgf_parsing_next_item(PgfParsing* parsing)
+{
+	GuBuf* agenda = parsing->agenda;
+	size_t len = gu_buf_length(agenda);
+	if (len == parsing->agenda_head) {
+		return NULL;
+	}
+	PgfAgendaEntry* entries = gu_buf_data(agenda);
+	PgfItem* item = NULL;
+	switch (parsing->parse->parser->order) {
+	case PGF_PARSE_ORDER_LIFO:
+		item = gu_buf_pop(agenda, PgfAgendaEntry).item;
+		break;
+	case PGF_PARSE_ORDER_FIFO:
+		item = entries[parsing->agenda_head++].item;
+		if (parsing->agenda_head == len) {
+			gu_buf_trim_n(agenda, len);
+			parsing->agenda_head = 0;
+		}
+		break;
+	case PGF_PARSE_ORDER_PRIORITY:
+		item = entries[0].item;
+		entries[0] = entries[len - 1];
+		gu_buf_trim(agenda);
+		if (len > 1) {
+			pgf_agenda_sift_down(entries, len - 1);
+		}
+		break;
+	default:
+		gu_impossible();
+	}
+	return item;
+}
 
 static void
 pgf_parsing_combine(PgfParsing* parsing, PgfItem* cont, PgfCCat* cat)
@@ -404,11 +576,10 @@ pgf_parsing_combine(PgfParsing* parsing, PgfItem* cont, PgfCCat* cat)
 	item->args = gu_new_seq(PgfPArg, nargs, parsing->pool);
 	memcpy(gu_seq_data(item->args), gu_seq_data(cont->args),
 	       nargs * sizeof(PgfPArg));
-	gu_assert(gu_variant_tag(item->curr_sym) == PGF_SYMBOL_CAT);
-	PgfSymbolCat* pcat = gu_variant_data(cont->curr_sym);
-	gu_seq_set(item->args, PgfPArg, pcat->d,
+	gu_assert(pgf_symbol_tag(item->curr_sym) == PGF_SYMBOL_CAT);
+	gu_seq_set(item->args, PgfPArg, pgf_symbol_d(cont->curr_sym),
 		   ((PgfPArg) { .hypos = gu_empty_seq(), .ccat = cat }));
-	pgf_item_advance(item, parsing->pool);
+	pgf_item_advance(item);
 	gu_pdebug(GU_A({"combine: ", pgf_item_printer}), item);
 	pgf_parsing_item(parsing, item);
 }
@@ -422,7 +593,8 @@ pgf_parsing_production(PgfParsing* parsing, PgfCCat* cat, size_t lin_idx,
 	base->lin_idx = lin_idx;
 	base->prod = prod;
 	base->conts = conts;
-	PgfItem* item = pgf_new_item(base, parsing->pool);
+	PgfItem* item = pgf_new_item(parsing->parse->parser, base,
+				     parsing->pool);
 	pgf_parsing_item(parsing, item);
 }
 
@@ -535,23 +707,26 @@ pgf_parsing_predict(PgfParsing* parsing, PgfItem* item,
 
 static void
 pgf_parsing_symbol(PgfParsing* parsing, PgfItem* item, PgfSymbol sym) {
-	switch (gu_variant_tag(sym)) {
+	switch (pgf_symbol_tag(sym)) {
 	case PGF_SYMBOL_CAT: {
-		PgfSymbolCat* scat = gu_variant_data(sym);
-		PgfPArg* parg = gu_seq_index(item->args, PgfPArg, scat->d);
+		PgfPArg* parg = gu_seq_index(item->args, PgfPArg,
+					     pgf_symbol_d(sym));
 		gu_assert(gu_seq_is_empty(parg->hypos));
-		pgf_parsing_predict(parsing, item, parg->ccat, scat->r);
+		pgf_parsing_predict(parsing, item, parg->ccat,
+				    pgf_symbol_r(sym));
 		break;
 	}
 	case PGF_SYMBOL_KS: {
-		PgfSymbolKS* sks = gu_variant_data(sym);
+		PgfSymbolKS* sks =
+			pgf_symbol_ks(parsing->parse->parser->concr, sym);
 		PgfToken tok = 
 			gu_seq_get(sks->tokens, PgfToken, item->tok_idx);
 		pgf_parsing_add_transition(parsing, tok, item);
 		break;
 	}
 	case PGF_SYMBOL_KP: {
-		PgfSymbolKP* skp = gu_variant_data(sym);
+		PgfSymbolKP* skp =
+			pgf_symbol_kp(parsing->parse->parser->concr, sym);
 		size_t idx = item->tok_idx;
 		uint8_t alt = item->alt;
 		size_t n_alts = gu_seq_length(skp->alts);
@@ -598,15 +773,9 @@ pgf_parsing_symbol(PgfParsing* parsing, PgfItem* item, PgfSymbol sym) {
 }
 
 static void
-pgf_parsing_item(PgfParsing* parsing, PgfItem* item)
+pgf_parsing_process(PgfParsing* parsing, PgfItem* item)
 {
-	gu_pdebug(GU_A({NULL, pgf_item_printer}), item);
-	if (gu_set_has(parsing->seen_items, &item)) {
-		gu_debug("Seen item already");
-		return;
-	}
-	gu_debug("Not seen before");
-	gu_set_insert(parsing->seen_items, &item);
+	gu_pdebug(GU_A({"process: ", pgf_item_printer}), item);
 	GuVariantInfo i = gu_variant_open(item->base->prod);
 	switch (i.tag) {
 	case PGF_PRODUCTION_APPLY: {
@@ -657,7 +826,7 @@ pgf_parsing_scan_toks(PgfParsing* parsing, PgfItem* old_item,
 	item->alt = alt;
 	if (item->tok_idx == gu_seq_length(toks)) {
 		item->tok_idx = 0;
-		pgf_item_advance(item, parsing->pool);
+		pgf_item_advance(item);
 	}
 	pgf_parsing_item(parsing, item);
 	return true;
@@ -668,16 +837,17 @@ pgf_parsing_scan(PgfParsing* parsing, PgfItem* item, PgfToken tok)
 {
 	bool succ = false;
 	gu_pdebug(GU_A({NULL, pgf_item_printer}), item);
-	GuVariantInfo i = gu_variant_open(item->curr_sym);
-	switch (i.tag) {
+	PgfConcr* concr = parsing->parse->parser->concr;
+	PgfSymbol sym = item->curr_sym;
+	switch (pgf_symbol_tag(sym)) {
 	case PGF_SYMBOL_KS: {
-		PgfSymbolKS* ks = i.data;
+		PgfSymbolKS* ks = pgf_symbol_ks(concr, sym);
 		succ = pgf_parsing_scan_toks(parsing, item, tok, 0, 
 					     ks->tokens);
 		break;
 	}
 	case PGF_SYMBOL_KP: {
-		PgfSymbolKP* kp = i.data;
+		PgfSymbolKP* kp = pgf_symbol_kp(concr, sym);
 		size_t alt = item->alt;
 		size_t n_alts = gu_seq_length(kp->alts);
 		PgfAlternative* alts = gu_seq_data(kp->alts);
@@ -716,6 +886,19 @@ pgf_parsing_scan(PgfParsing* parsing, PgfItem* item, PgfToken tok)
 }
 
 
+/// Process items until the agenda is empty.
+static void
+pgf_parsing_run(PgfParsing* parsing)
+{
+	PgfItem* item;
+	while ((item = pgf_parsing_next_item(parsing)) != NULL) {
+		parsing->n_processed++;
+		pgf_parsing_process(parsing, item);
+	}
+	gu_debug("processed %zu items, max agenda length %zu",
+		 parsing->n_processed, parsing->max_agenda);
+}
+
 static PgfParsing*
 pgf_new_parsing(PgfParse* parse, GuPool* parse_pool, GuPool* out_pool)
 {
@@ -726,9 +909,16 @@ pgf_new_parsing(PgfParse* parse, GuPool* parse_pool, GuPool* out_pool)
 	parsing->pool = parse_pool;
 	parsing->seen_items =
 		gu_new_set(PgfItem*, parse->parser->item_hasher, out_pool);
+	parsing->agenda = gu_new_buf(PgfAgendaEntry, out_pool);
+	parsing->agenda_head = 0;
+	parsing->n_processed = 0;
+	parsing->max_agenda = 0;
 	return parsing;
 }
 
+static void
+pgf_parse_finalize(GuFinalizer* fin);
+
 static PgfParse*
 pgf_new_parse(PgfParser* parser, GuPool* pool)
 {
@@ -736,9 +926,27 @@ pgf_new_parse(PgfParser* parser, GuPool* pool)
 	parse->parser = parser;
 	parse->transitions = gu_map_type_new(PgfTransitions, pool);
 	parse->completed = gu_new_buf(PgfCCat*, pool);
+	parse->completions = NULL;
+	parse->fin.fn = pgf_parse_finalize;
+	gu_pool_finally(pool, &parse->fin);
+	parse->next_fid = PGF_FID_SYNTHETIC;
 	return parse;
 }
 
+// Scan the items of `parse` that expect `tok` into the position being
+// built by `parsing`.
+static void
+pgf_parsing_scan_token(PgfParsing* parsing, PgfItemSet* agenda,
+		       PgfToken tok, GuPool* tmp_pool)
+{
+	gu_pdebug(GU_A({"scan: ", gu_string_printer}), &tok);
+	GuEnum* items = gu_map_keys(agenda, tmp_pool);
+	PgfItem* item;
+	while (gu_enum_next(items, &item, tmp_pool)) {
+		pgf_parsing_scan(parsing, item, tok);
+	}
+}
+
 PgfParse*
 pgf_parse_token(PgfParse* parse, PgfToken tok, GuPool* pool)
 {
@@ -747,42 +955,143 @@ pgf_parse_token(PgfParse* parse, PgfToken tok, GuPool* pool)
 	if (!agenda) {
 		return NULL;
 	}
-	gu_pdebug(GU_A({"scan: ", gu_string_printer}), &tok);
 	PgfParse* next_parse = pgf_new_parse(parse->parser, pool);
+	next_parse->next_fid = parse->next_fid;
 	GuPool* tmp_pool = gu_new_pool();
 	PgfParsing* parsing = pgf_new_parsing(next_parse, pool, tmp_pool);
-	GuEnum* items = gu_map_keys(agenda, tmp_pool);
-	PgfItem* item;
-	while (gu_enum_next(items, &item, tmp_pool)) {
-		pgf_parsing_scan(parsing, item, tok);
-	}
+	pgf_parsing_scan_token(parsing, agenda, tok, tmp_pool);
+	pgf_parsing_run(parsing);
 	gu_pool_free(tmp_pool);
 	return next_parse;
 }
 
+PgfParse*
+pgf_parse_lattice_limited(PgfParse* parse, PgfLattice edges,
+			  PgfParseLimit* limit, double* cost_out,
+			  GuPool* pool)
+{
+	size_t n_edges = gu_seq_length(edges);
+	PgfLatticeEdge* edge_data = gu_seq_data(edges);
+	size_t n_positions = 1;
+	for (size_t i = 0; i < n_edges; i++) {
+		gu_require(edge_data[i].from < edge_data[i].to);
+		n_positions = GU_MAX(n_positions, edge_data[i].to + 1);
+	}
+
+	GuPool* tmp_pool = gu_new_pool();
+	// Group the edges by their target positions, so that each position
+	// is completed only once, after all of its incoming edges have been
+	// scanned.
+	size_t* starts = gu_new_n(size_t, n_positions + 1, tmp_pool);
+	memset(starts, 0, (n_positions + 1) * sizeof(size_t));
+	for (size_t i = 0; i < n_edges; i++) {
+		starts[edge_data[i].to + 1]++;
+	}
+	for (size_t p = 0; p < n_positions; p++) {
+		starts[p + 1] += starts[p];
+	}
+	size_t* fill = gu_new_n(size_t, n_positions, tmp_pool);
+	memcpy(fill, starts, n_positions * sizeof(size_t));
+	PgfLatticeEdge** by_target =
+		gu_new_n(PgfLatticeEdge*, GU_MAX(n_edges, 1), tmp_pool);
+	for (size_t i = 0; i < n_edges; i++) {
+		by_target[fill[edge_data[i].to]++] = &edge_data[i];
+	}
+
+	PgfParse** states = gu_new_n(PgfParse*, n_positions, tmp_pool);
+	double* costs = gu_new_n(double, n_positions, tmp_pool);
+	states[0] = parse;
+	costs[0] = 0.0;
+	for (size_t p = 1; p < n_positions; p++) {
+		states[p] = NULL;
+		PgfParsing* parsing = NULL;
+		GuPool* pos_pool = gu_new_pool();
+		for (size_t i = starts[p]; i < starts[p + 1]; i++) {
+			PgfLatticeEdge* edge = by_target[i];
+			PgfParse* prev = states[edge->from];
+			if (prev == NULL) {
+				continue;
+			}
+			PgfItemSet* agenda =
+				gu_map_get(prev->transitions, &edge->tok,
+					   PgfItemSet*);
+			if (!agenda) {
+				continue;
+			}
+			double cost = costs[edge->from] + edge->cost;
+			if (parsing == NULL) {
+				states[p] = pgf_new_parse(parse->parser, pool);
+				states[p]->next_fid = prev->next_fid;
+				parsing = pgf_new_parsing(states[p], pool,
+							  pos_pool);
+				costs[p] = cost;
+			} else {
+				states[p]->next_fid =
+					GU_MIN(states[p]->next_fid,
+					       prev->next_fid);
+				costs[p] = GU_MIN(costs[p], cost);
+			}
+			pgf_parsing_scan_token(parsing, agenda, edge->tok,
+					       pos_pool);
+		}
+		if (parsing != NULL) {
+			pgf_parsing_run(parsing);
+		}
+		gu_pool_free(pos_pool);
+		if (parsing != NULL && limit != NULL
+		    && p + 1 < n_positions && limit->fn(limit, pool)) {
+			states[n_positions - 1] = NULL;
+			break;
+		}
+	}
+	PgfParse* final = states[n_positions - 1];
+	if (final != NULL && cost_out != NULL) {
+		*cost_out = costs[n_positions - 1];
+	}
+	gu_pool_free(tmp_pool);
+	return final;
+}
+
+PgfParse*
+pgf_parse_lattice(PgfParse* parse, PgfLattice edges, double* cost_out,
+		  GuPool* pool)
+{
+	return pgf_parse_lattice_limited(parse, edges, NULL, cost_out, pool);
+}
+
 static PgfExpr
-pgf_cat_to_expr(PgfCCat* cat, GuChoice* choice, GuSet* seen_cats, GuPool* pool);
+pgf_cat_to_expr(PgfCCat* cat, GuChoice* choice, GuSet* seen_cats,
+		PgfExprFactory* factory, GuPool* pool);
 
 static PgfExpr
 pgf_production_to_expr(PgfProduction prod, GuChoice* choice,
-		       GuSet* seen_cats, GuPool* pool)
+		       GuSet* seen_cats, PgfExprFactory* factory,
+		       GuPool* pool)
 {
 	GuVariantInfo pi = gu_variant_open(prod);
 	switch (pi.tag) {
 	case PGF_PRODUCTION_APPLY: {
 		PgfProductionApply* papp = pi.data;
-		PgfExpr expr = gu_new_variant_i(pool, PGF_EXPR_FUN,
-						PgfExprFun,
-						.fun = papp->fun->fun);
+		PgfExpr expr = factory != NULL
+			? pgf_expr_factory_fun(factory, papp->fun->fun)
+			: gu_new_variant_i(pool, PGF_EXPR_FUN,
+					   PgfExprFun,
+					   .fun = papp->fun->fun);
 		size_t n_args = gu_seq_length(papp->args);
 		for (size_t i = 0; i < n_args; i++) {
 			PgfPArg* parg = gu_seq_index(papp->args, PgfPArg, i);
 			gu_assert(gu_seq_is_empty(parg->hypos));
 			PgfExpr earg = pgf_cat_to_expr(parg->ccat, choice,
-						       seen_cats, pool);
+						       seen_cats, factory,
+						       pool);
 			if (gu_variant_is_null(earg)) {
 				return gu_null_variant;
 			}
+			if (factory != NULL) {
+				expr = pgf_expr_factory_app(factory,
+							    expr, earg);
+				continue;
+			}
 			expr = gu_new_variant_i(pool, PGF_EXPR_APP,
 						PgfExprApp,
 						.fun = expr, .arg = earg);
@@ -792,7 +1101,7 @@ pgf_production_to_expr(PgfProduction prod, GuChoice* choice,
 	case PGF_PRODUCTION_COERCE: {
 		PgfProductionCoerce* pcoerce = pi.data;
 		return pgf_cat_to_expr(pcoerce->coerce, choice,
-				       seen_cats, pool);
+				       seen_cats, factory, pool);
 	}
 	default:
 		gu_impossible();
@@ -803,7 +1112,7 @@ pgf_production_to_expr(PgfProduction prod, GuChoice* choice,
 
 static PgfExpr
 pgf_cat_to_expr(PgfCCat* cat, GuChoice* choice,
-		GuSet* seen_cats, GuPool* pool)
+		GuSet* seen_cats, PgfExprFactory* factory, GuPool* pool)
 {
 	if (gu_set_has(seen_cats, cat)) {
 		// cyclic expression
@@ -813,6 +1122,9 @@ pgf_cat_to_expr(PgfCCat* cat, GuChoice* choice,
 	// If prods is not a buf, this is not a synthetic category.
 	if (!gu_seq_is_buf(cat->prods)) {
 		// XXX: What should the PgfMetaId be?
+		if (factory != NULL) {
+			return pgf_expr_factory_meta(factory, 0);
+		}
 		return gu_new_variant_i(pool, PGF_EXPR_META,
 					PgfExprMeta, 
 					.id = 0);
@@ -823,19 +1135,16 @@ pgf_cat_to_expr(PgfCCat* cat, GuChoice* choice,
 		return gu_null_variant;
 	}
 	PgfProduction prod = gu_seq_get(cat->prods, PgfProduction, i);
-	return pgf_production_to_expr(prod, choice, seen_cats, pool);
+	return pgf_production_to_expr(prod, choice, seen_cats, factory, pool);
 }
 
 
 static PgfExpr
 pgf_parse_result_next(PgfParseResult* pr, GuPool* pool)
 {
-	if (pr->choice == NULL) {
-		return gu_null_variant;
-	}
 	size_t n_results = gu_buf_length(pr->completed);
 	PgfExpr ret = gu_null_variant;
-	while (gu_variant_is_null(ret)) {
+	while (gu_variant_is_null(ret) && pr->choice != NULL) {
 		GuChoiceMark mark = gu_choice_mark(pr->choice);
 		int i = gu_choice_next(pr->choice, n_results);
 		if (i == -1) {
@@ -844,12 +1153,22 @@ pgf_parse_result_next(PgfParseResult* pr, GuPool* pool)
 		PgfCCat* cat = gu_buf_get(pr->completed, PgfCCat*, i);
 		GuPool* tmp_pool = gu_new_pool();
 		GuSet* seen_cats = gu_new_addr_set(PgfCCat, tmp_pool);
-		ret = pgf_cat_to_expr(cat, pr->choice, seen_cats, pool);
+		ret = pgf_cat_to_expr(cat, pr->choice, seen_cats,
+				      pr->factory, pool);
 		gu_pool_free(tmp_pool);
 		gu_choice_reset(pr->choice, mark);
 		if (!gu_choice_advance(pr->choice)) {
 			pr->choice = NULL;
 		};
+		if (pr->seen != NULL && !gu_variant_is_null(ret)) {
+			// Skip the trees that have already been returned.
+			void* p = gu_variant_to_ptr(ret);
+			if (gu_set_has(pr->seen, p)) {
+				ret = gu_null_variant;
+			} else {
+				gu_set_insert(pr->seen, p);
+			}
+		}
 	}
 	return ret;
 }
@@ -872,34 +1191,343 @@ pgf_parse_result(PgfParse* parse, GuPool* pool)
 	return &gu_new_i(pool, PgfParseResult,
 			 .completed = parse->completed,
 			 .choice = gu_new_choice(pool),
+			 .factory = NULL,
+			 .seen = NULL,
+			 .en.next = pgf_parse_result_enum_next)->en;
+}
+
+PgfExprEnum*
+pgf_parse_result_unique(PgfParse* parse, PgfExprFactory* factory,
+			GuPool* pool)
+{
+	return &gu_new_i(pool, PgfParseResult,
+			 .completed = parse->completed,
+			 .choice = gu_new_choice(pool),
+			 .factory = factory,
+			 .seen = gu_new_addr_set(void, pool),
 			 .en.next = pgf_parse_result_enum_next)->en;
 }
 
 
+typedef struct PgfCompletionEntry PgfCompletionEntry;
+
+struct PgfCompletionEntry {
+	GuCSlice utf8;
+	PgfCompletion completion;
+};
+
+struct PgfCompletionIndex {
+	GuPool* pool;
+	/**< The index has a pool of its own, since the pool of the
+	 * parse state may be in use by another thread. */
+	PgfCompletionEntry* entries;
+	/**< The possible next tokens, sorted by their UTF-8 encodings,
+	 * so that the tokens with a given prefix form a contiguous
+	 * range. */
+	size_t n_entries;
+};
+
+typedef struct {
+	GuMapItor fn;
+	PgfAbstr* abstr;
+	GuBuf* entries;
+	GuPool* pool;
+	GuPool* tmp_pool;
+} PgfCompletionIndexFn;
+
+static void
+pgf_completion_index_cb(GuMapItor* fn, const void* key, void* value,
+			GuExn* err)
+{
+	PgfCompletionIndexFn* clo = (PgfCompletionIndexFn*) fn;
+	PgfToken tok = *(const PgfToken*) key;
+	PgfItemSet* items = *(PgfItemSet**) value;
+	// A token is as likely as the most likely function that can
+	// produce it here.
+	double prob = 0.0;
+	GuEnum* en = gu_map_keys(items, clo->tmp_pool);
+	PgfItem* item;
+	while (gu_enum_next(en, &item, clo->tmp_pool)) {
+		GuVariantInfo i = gu_variant_open(item->base->prod);
+		if (i.tag != PGF_PRODUCTION_APPLY) {
+			continue;
+		}
+		PgfProductionApply* papp = i.data;
+		PgfFunDecl* decl = gu_map_get(clo->abstr->funs,
+					      &papp->fun->fun, PgfFunDecl*);
+		if (decl != NULL) {
+			prob = GU_MAX(prob, decl->prob);
+		}
+	}
+	PgfCompletionEntry entry = {
+		gu_slice_cslice(gu_string_utf8(tok, clo->pool)),
+		{ tok, prob }
+	};
+	gu_buf_push(clo->entries, PgfCompletionEntry, entry);
+}
+
+static int
+pgf_completion_entry_cmp(const void* p1, const void* p2)
+{
+	const PgfCompletionEntry* e1 = p1;
+	const PgfCompletionEntry* e2 = p2;
+	size_t sz = GU_MIN(e1->utf8.sz, e2->utf8.sz);
+	int c = memcmp(e1->utf8.p, e2->utf8.p, sz);
+	if (c != 0) {
+		return c;
+	}
+	return (e1->utf8.sz > e2->utf8.sz) - (e1->utf8.sz < e2->utf8.sz);
+}
+
+static PgfCompletionIndex*
+pgf_parse_completion_index(PgfParse* parse)
+{
+	PgfParser* parser = parse->parser;
+	gu_mutex_lock(parser->mutex);
+	PgfCompletionIndex* idx = parse->completions;
+	if (idx == NULL) {
+		GuPool* pool = gu_new_pool();
+		GuPool* tmp_pool = gu_new_pool();
+		PgfCompletionIndexFn clo = {
+			{ pgf_completion_index_cb },
+			&parser->concr->pgf->abstract,
+			gu_new_buf(PgfCompletionEntry, tmp_pool),
+			pool, tmp_pool
+		};
+		gu_map_iter(parse->transitions, &clo.fn, gu_null_exn());
+		idx = gu_new(PgfCompletionIndex, pool);
+		idx->pool = pool;
+		idx->n_entries = gu_buf_length(clo.entries);
+		idx->entries = gu_new_n(PgfCompletionEntry,
+					GU_MAX(idx->n_entries, 1), pool);
+		memcpy(idx->entries, gu_buf_data(clo.entries),
+		       idx->n_entries * sizeof(PgfCompletionEntry));
+		qsort(idx->entries, idx->n_entries,
+		      sizeof(PgfCompletionEntry), pgf_completion_entry_cmp);
+		gu_pool_free(tmp_pool);
+		parse->completions = idx;
+	}
+	gu_mutex_unlock(parser->mutex);
+	return idx;
+}
+
+static void
+pgf_parse_finalize(GuFinalizer* fin)
+{
+	PgfParse* parse = gu_container(fin, PgfParse, fin);
+	if (parse->completions != NULL) {
+		gu_pool_free(parse->completions->pool);
+	}
+}
+
+// Whether `e1` should be ranked after `e2`
+static bool
+pgf_completion_worse(const PgfCompletionEntry* e1,
+		     const PgfCompletionEntry* e2)
+{
+	if (e1->completion.prob != e2->completion.prob) {
+		return e1->completion.prob < e2->completion.prob;
+	}
+	return pgf_completion_entry_cmp(e1, e2) > 0;
+}
+
+static int
+pgf_completion_rank_cmp(const void* p1, const void* p2)
+{
+	const PgfCompletionEntry* e1 = *(const PgfCompletionEntry* const*) p1;
+	const PgfCompletionEntry* e2 = *(const PgfCompletionEntry* const*) p2;
+	return pgf_completion_worse(e1, e2) - pgf_completion_worse(e2, e1);
+}
+
+GuSeq
+pgf_parse_completions(PgfParse* parse, GuString prefix, size_t limit,
+		      GuPool* pool)
+{
+	PgfCompletionIndex* idx = pgf_parse_completion_index(parse);
+	GuPool* tmp_pool = gu_local_pool();
+	GuSlice pfx = gu_string_utf8(prefix, tmp_pool);
+
+	// Find the range of tokens that begin with the prefix.
+	size_t lo = 0;
+	size_t hi = idx->n_entries;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		GuCSlice utf8 = idx->entries[mid].utf8;
+		size_t sz = GU_MIN(utf8.sz, pfx.sz);
+		int c = memcmp(utf8.p, pfx.p, sz);
+		if (c < 0 || (c == 0 && utf8.sz < pfx.sz)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	size_t end = lo;
+	while (end < idx->n_entries &&
+	       idx->entries[end].utf8.sz >= pfx.sz &&
+	       memcmp(idx->entries[end].utf8.p, pfx.p, pfx.sz) == 0) {
+		end++;
+	}
+
+	// Keep the `limit` best tokens in a heap whose root is the worst
+	// of them. The heap never needs to hold more than the tokens in the
+	// range, however large `limit` is.
+	limit = GU_MIN(limit, end - lo);
+	size_t n_best = 0;
+	PgfCompletionEntry** best =
+		gu_new_n(PgfCompletionEntry*, GU_MAX(limit, 1), tmp_pool);
+	for (size_t i = lo; i < end && limit > 0; i++) {
+		PgfCompletionEntry* entry = &idx->entries[i];
+		size_t j;
+		if (n_best < limit) {
+			j = n_best++;
+			while (j > 0 &&
+			       pgf_completion_worse(entry, best[(j - 1) / 2])) {
+				best[j] = best[(j - 1) / 2];
+				j = (j - 1) / 2;
+			}
+		} else if (pgf_completion_worse(best[0], entry)) {
+			j = 0;
+			while (true) {
+				size_t k = 2 * j + 1;
+				if (k >= n_best) {
+					break;
+				}
+				if (k + 1 < n_best &&
+				    pgf_completion_worse(best[k + 1], best[k])) {
+					k++;
+				}
+				if (!pgf_completion_worse(best[k], entry)) {
+					break;
+				}
+				best[j] = best[k];
+				j = k;
+			}
+		} else {
+			continue;
+		}
+		best[j] = entry;
+	}
+	qsort(best, n_best, sizeof(PgfCompletionEntry*),
+	      pgf_completion_rank_cmp);
+	GuSeq ret = gu_new_seq(PgfCompletion, n_best, pool);
+	for (size_t i = 0; i < n_best; i++) {
+		gu_seq_set(ret, PgfCompletion, i, best[i]->completion);
+	}
+	gu_pool_free(tmp_pool);
+	return ret;
+}
+
+
+static PgfParse*
+pgf_parser_predict_initial(PgfParser* parser, PgfCncCat* cnccat,
+			   PgfCtntId lin_idx)
+{
+	PgfParse* parse = pgf_new_parse(parser, parser->pool);
+	GuPool* tmp_pool = gu_new_pool();
+	PgfParsing* parsing = pgf_new_parsing(parse, parser->pool, tmp_pool);
+	size_t n_ccats = gu_seq_length(cnccat->cats);
+	for (size_t i = 0; i < n_ccats; i++) {
+		PgfCCat* ccat = gu_seq_get(cnccat->cats, PgfCCat*, i);
+		if (ccat != NULL) {
+			pgf_parsing_predict(parsing, NULL, ccat, lin_idx);
+		}
+	}
+	pgf_parsing_run(parsing);
+	gu_pool_free(tmp_pool);
+	return parse;
+}
+
 PgfParse*
 pgf_parser_parse(PgfParser* parser, PgfCat* cat, PgfCtntId lin_idx, GuPool* pool)
 {
 	gu_require(cat->pgf == parser->concr->pgf);
-	PgfParse* parse = pgf_new_parse(parser, pool);
-	GuPool* tmp_pool = gu_new_pool();
-	PgfParsing* parsing = pgf_new_parsing(parse, pool, tmp_pool);
 	PgfCncCat* cnccat =
 		gu_map_get(parser->concr->cnccats, cat, PgfCncCat*);
 	if (!cnccat) {
 		// No concrete productions, but a valid category. Just return
 		// the empty parse. XXX: Or should we raise error?
-		return parse;
+		return pgf_new_parse(parser, pool);
 	}
 	gu_require(lin_idx >= 0 && (size_t)lin_idx < cnccat->n_ctnts);
+	gu_mutex_lock(parser->mutex);
+	GuSeq parses = gu_map_get(parser->init_parses, cnccat, GuSeq);
+	if (gu_seq_is_null(parses)) {
+		size_t n_ctnts = cnccat->n_ctnts;
+		parses = gu_new_seq(PgfParse*, n_ctnts, parser->pool);
+		for (size_t i = 0; i < n_ctnts; i++) {
+			gu_seq_set(parses, PgfParse*, i, NULL);
+		}
+		gu_map_put(parser->init_parses, cnccat, GuSeq, parses);
+	}
+	PgfParse** parsep = gu_seq_index(parses, PgfParse*, lin_idx);
+	if (*parsep == NULL) {
+		*parsep = pgf_parser_predict_initial(parser, cnccat, lin_idx);
+	}
+	PgfParse* parse = *parsep;
+	gu_mutex_unlock(parser->mutex);
+	return parse;
+}
+
+static void
+pgf_parser_index_ccat(PgfParser* parser, PgfCCat* ccat, GuPool* pool)
+{
+	if (gu_seq_is_null(ccat->prods)) {
+		return;
+	}
+	size_t n_prods = gu_seq_length(ccat->prods);
+	for (size_t i = 0; i < n_prods; i++) {
+		PgfProduction prod = gu_seq_get(ccat->prods, PgfProduction, i);
+		if (gu_variant_tag(prod) != PGF_PRODUCTION_COERCE) {
+			continue;
+		}
+		PgfProductionCoerce* pcoerce = gu_variant_data(prod);
+		PgfCCat* coerce = pcoerce->coerce;
+		if (gu_map_has(parser->coerce_args, coerce)) {
+			continue;
+		}
+		PgfPArgs args = gu_new_seq(PgfPArg, 1, pool);
+		PgfPArg* parg = gu_seq_index(args, PgfPArg, 0);
+		parg->hypos = gu_empty_seq();
+		parg->ccat = coerce;
+		gu_map_put(parser->coerce_args, coerce, PgfPArgs, args);
+	}
+}
+
+typedef struct {
+	GuMapItor fn;
+	PgfParser* parser;
+	GuPool* pool;
+} PgfParserIndexFn;
+
+static void
+pgf_parser_index_cnccat_cb(GuMapItor* fn, const void* key, void* value,
+			   GuExn* err)
+{
+	PgfParserIndexFn* clo = (PgfParserIndexFn*) fn;
+	PgfCncCat* cnccat = *(PgfCncCat**) value;
 	size_t n_ccats = gu_seq_length(cnccat->cats);
 	for (size_t i = 0; i < n_ccats; i++) {
 		PgfCCat* ccat = gu_seq_get(cnccat->cats, PgfCCat*, i);
 		if (ccat != NULL) {
-			pgf_parsing_predict(parsing, NULL, ccat, lin_idx);
+			pgf_parser_index_ccat(clo->parser, ccat, clo->pool);
 		}
 	}
-	gu_pool_free(tmp_pool);
-	return parse;
+}
+
+static void
+pgf_parser_index(PgfParser* parser, GuPool* pool)
+{
+	PgfConcr* concr = parser->concr;
+	parser->coerce_args = gu_map_type_new(PgfCoerceArgs, pool);
+	PgfParserIndexFn clo = {
+		{ pgf_parser_index_cnccat_cb }, parser, pool
+	};
+	gu_map_iter(concr->cnccats, &clo.fn, gu_null_exn());
+	size_t n_extras = gu_seq_length(concr->extra_ccats);
+	for (size_t i = 0; i < n_extras; i++) {
+		PgfCCat* ccat = gu_seq_get(concr->extra_ccats, PgfCCat*, i);
+		pgf_parser_index_ccat(parser, ccat, pool);
+	}
 }
 
 PgfParser* 
@@ -908,6 +1536,9 @@ pgf_new_parser(PgfConcr* concr, GuPool* pool)
 	gu_require(concr != NULL);
 	PgfParser* parser = gu_new(PgfParser, pool);
 	parser->concr = concr;
+	parser->pool = pool;
+	parser->init_parses = gu_new_addr_map(PgfCncCat, GuSeq,
+					      &gu_null_seq, pool);
 	GuPool* tmp_pool = gu_local_pool();
 	GuGeneric* gen_hasher =
 		gu_new_generic(gu_hasher_instances, tmp_pool);
@@ -915,7 +1546,319 @@ pgf_new_parser(PgfConcr* concr, GuPool* pool)
 		gu_specialize(gen_hasher, gu_ptr_type(PgfItem), pool);
 	parser->tokens_hasher =
 		gu_specialize(gen_hasher, gu_type(PgfTokens), pool);
-	parser->next_fid = PGF_FID_SYNTHETIC;
+	parser->order = PGF_PARSE_ORDER_LIFO;
+	parser->mutex = gu_new_mutex(pool);
+	pgf_parser_index(parser, pool);
 	gu_pool_free(tmp_pool);
 	return parser;
 }
+
+void
+pgf_parser_set_order(PgfParser* parser, PgfParseOrder order)
+{
+	gu_require(order >= PGF_PARSE_ORDER_LIFO &&
+		   order <= PGF_PARSE_ORDER_PRIORITY);
+	parser->order = order;
+}
+
+
+typedef struct PgfParseCacheNode PgfParseCacheNode;
+
+struct PgfParseCacheNode {
+	PgfParseCacheNode* parent;
+	PgfParse* parse;
+	GuPool* pool;
+	/**< The pool of this node's parse state, or `NULL` for a root
+	 * node, whose state is owned by the parser. */
+	GuStringMap* children;
+	/**< Maps tokens to the nodes of the states that they lead to.
+	 * The entries of evicted nodes are removed. */
+	PgfToken tok;
+	/**< The token that leads to this node, allocated from `pool`. */
+	size_t size;
+	size_t refs;
+	/**< The number of children and outstanding references. Nodes
+	 * with no references are in the eviction list. */
+	PgfParseCacheNode* lru_prev;
+	PgfParseCacheNode* lru_next;
+};
+
+struct PgfParseCache {
+	PgfParser* parser;
+	GuPool* pool;
+	/**< A private pool for the root nodes. It is freed after the
+	 * other nodes when the cache is destroyed. */
+	GuMutex* mutex;
+	GuMap* roots;
+	/**< Maps the initial parse state of each category and
+	 * constituent to the root node of its prefix tree. */
+	size_t max_size;
+	size_t size;
+	PgfParseCacheNode* lru_head;
+	/**< The most recently released unreferenced node. */
+	PgfParseCacheNode* lru_tail;
+	/**< The next node to evict. */
+	GuFinalizer fin;
+};
+
+typedef struct PgfParseCacheRef PgfParseCacheRef;
+
+struct PgfParseCacheRef {
+	PgfParseCache* cache;
+	PgfParseCacheNode* node;
+	GuFinalizer fin;
+};
+
+static void
+pgf_parse_cache_lru_remove(PgfParseCache* cache, PgfParseCacheNode* node)
+{
+	if (node->lru_prev) {
+		node->lru_prev->lru_next = node->lru_next;
+	} else {
+		cache->lru_head = node->lru_next;
+	}
+	if (node->lru_next) {
+		node->lru_next->lru_prev = node->lru_prev;
+	} else {
+		cache->lru_tail = node->lru_prev;
+	}
+	node->lru_prev = node->lru_next = NULL;
+}
+
+static void
+pgf_parse_cache_lru_push(PgfParseCache* cache, PgfParseCacheNode* node)
+{
+	node->lru_prev = NULL;
+	node->lru_next = cache->lru_head;
+	if (cache->lru_head) {
+		cache->lru_head->lru_prev = node;
+	} else {
+		cache->lru_tail = node;
+	}
+	cache->lru_head = node;
+}
+
+static void
+pgf_parse_cache_ref(PgfParseCache* cache, PgfParseCacheNode* node)
+{
+	if (node->refs++ == 0 && node->parent != NULL) {
+		pgf_parse_cache_lru_remove(cache, node);
+	}
+}
+
+static void
+pgf_parse_cache_unref(PgfParseCache* cache, PgfParseCacheNode* node)
+{
+	gu_assert(node->refs > 0);
+	if (--node->refs == 0 && node->parent != NULL) {
+		pgf_parse_cache_lru_push(cache, node);
+	}
+}
+
+static void
+pgf_parse_cache_evict(PgfParseCache* cache)
+{
+	while (cache->size > cache->max_size && cache->lru_tail != NULL) {
+		PgfParseCacheNode* node = cache->lru_tail;
+		PgfParseCacheNode* parent = node->parent;
+		gu_assert(node->refs == 0);
+		pgf_parse_cache_lru_remove(cache, node);
+		gu_map_remove(parent->children, &node->tok);
+		cache->size -= node->size;
+		gu_debug("evicted %zu bytes, %zu in cache",
+			 node->size, cache->size);
+		gu_pool_free(node->pool);
+		pgf_parse_cache_unref(cache, parent);
+	}
+}
+
+static void
+pgf_parse_cache_ref_finalize(GuFinalizer* fin)
+{
+	PgfParseCacheRef* ref = gu_container(fin, PgfParseCacheRef, fin);
+	PgfParseCache* cache = ref->cache;
+	gu_mutex_lock(cache->mutex);
+	pgf_parse_cache_unref(cache, ref->node);
+	pgf_parse_cache_evict(cache);
+	gu_mutex_unlock(cache->mutex);
+}
+
+static PgfParseCacheNode*
+pgf_parse_cache_root(PgfParseCache* cache, PgfCat* cat, PgfCtntId ctnt)
+{
+	PgfParse* parse =
+		pgf_parser_parse(cache->parser, cat, ctnt, cache->pool);
+	PgfParseCacheNode* root =
+		gu_map_get(cache->roots, parse, PgfParseCacheNode*);
+	if (root == NULL) {
+		root = gu_new(PgfParseCacheNode, cache->pool);
+		root->parent = NULL;
+		root->parse = parse;
+		root->pool = NULL;
+		root->children = gu_new_string_map(PgfParseCacheNode*,
+						   &gu_null_struct,
+						   cache->pool);
+		root->tok = gu_empty_string;
+		root->size = 0;
+		root->refs = 0;
+		root->lru_prev = root->lru_next = NULL;
+		gu_map_put(cache->roots, parse, PgfParseCacheNode*, root);
+	}
+	return root;
+}
+
+// Called with the cache locked and a reference held to `node`. Returns
+// the child node for `tok` with a reference held to it, and releases the
+// reference to `node`.
+static PgfParseCacheNode*
+pgf_parse_cache_step(PgfParseCache* cache, PgfParseCacheNode* node,
+		     PgfToken tok)
+{
+	PgfParseCacheNode* child =
+		gu_map_get(node->children, &tok, PgfParseCacheNode*);
+	if (child == NULL) {
+		// The parse step is done without holding the lock, so
+		// that other threads can use the cache in the meantime.
+		// The reference to `node` keeps it from being evicted.
+		gu_mutex_unlock(cache->mutex);
+		GuPool* pool = gu_new_pool();
+		PgfParse* parse = pgf_parse_token(node->parse, tok, pool);
+		gu_mutex_lock(cache->mutex);
+		if (parse == NULL) {
+			gu_pool_free(pool);
+			pgf_parse_cache_unref(cache, node);
+			return NULL;
+		}
+		child = gu_map_get(node->children, &tok, PgfParseCacheNode*);
+		if (child != NULL) {
+			// Another thread got here first
+			gu_pool_free(pool);
+		} else {
+			child = gu_new(PgfParseCacheNode, pool);
+			child->parent = node;
+			child->parse = parse;
+			child->pool = pool;
+			child->children =
+				gu_new_string_map(PgfParseCacheNode*,
+						  &gu_null_struct, pool);
+			child->tok = gu_string_copy(tok, pool);
+			child->size = gu_pool_size(pool);
+			child->refs = 0;
+			child->lru_prev = child->lru_next = NULL;
+			gu_map_put(node->children, &child->tok,
+				   PgfParseCacheNode*, child);
+			pgf_parse_cache_ref(cache, node);
+			cache->size += child->size;
+		}
+	}
+	pgf_parse_cache_ref(cache, child);
+	pgf_parse_cache_unref(cache, node);
+	return child;
+}
+
+PgfParse*
+pgf_parse_cache_parse(PgfParseCache* cache, PgfCat* cat, PgfCtntId ctnt,
+		      PgfTokens toks, GuPool* pool)
+{
+	if (!gu_map_has(cache->parser->concr->cnccats, cat)) {
+		// The initial state of a category with no concrete
+		// category is a fresh empty parse each time, so there is
+		// nothing to share, and it is not cached.
+		PgfParse* parse =
+			pgf_parser_parse(cache->parser, cat, ctnt, pool);
+		size_t n_toks = gu_seq_length(toks);
+		for (size_t i = 0; i < n_toks && parse != NULL; i++) {
+			PgfToken tok = gu_seq_get(toks, PgfToken, i);
+			parse = pgf_parse_token(parse, tok, pool);
+		}
+		return parse;
+	}
+	gu_mutex_lock(cache->mutex);
+	PgfParseCacheNode* node = pgf_parse_cache_root(cache, cat, ctnt);
+	pgf_parse_cache_ref(cache, node);
+	size_t n_toks = gu_seq_length(toks);
+	for (size_t i = 0; i < n_toks && node != NULL; i++) {
+		PgfToken tok = gu_seq_get(toks, PgfToken, i);
+		node = pgf_parse_cache_step(cache, node, tok);
+	}
+	PgfParse* parse = NULL;
+	if (node != NULL) {
+		PgfParseCacheRef* ref = gu_new(PgfParseCacheRef, pool);
+		ref->cache = cache;
+		ref->node = node;
+		ref->fin.fn = pgf_parse_cache_ref_finalize;
+		gu_pool_finally(pool, &ref->fin);
+		parse = node->parse;
+	}
+	pgf_parse_cache_evict(cache);
+	gu_mutex_unlock(cache->mutex);
+	return parse;
+}
+
+size_t
+pgf_parse_cache_size(PgfParseCache* cache)
+{
+	gu_mutex_lock(cache->mutex);
+	size_t size = cache->size;
+	gu_mutex_unlock(cache->mutex);
+	return size;
+}
+
+typedef struct {
+	GuMapItor fn;
+} PgfParseCacheFreeFn;
+
+static void
+pgf_parse_cache_free_node(PgfParseCacheNode* node);
+
+static void
+pgf_parse_cache_free_child_cb(GuMapItor* fn, const void* key, void* value,
+			      GuExn* err)
+{
+	PgfParseCacheNode* child = *(PgfParseCacheNode**) value;
+	pgf_parse_cache_free_node(child);
+}
+
+static void
+pgf_parse_cache_free_node(PgfParseCacheNode* node)
+{
+	PgfParseCacheFreeFn clo = { { pgf_parse_cache_free_child_cb } };
+	gu_map_iter(node->children, &clo.fn, gu_null_exn());
+	if (node->pool != NULL) {
+		gu_pool_free(node->pool);
+	}
+}
+
+static void
+pgf_parse_cache_free_root_cb(GuMapItor* fn, const void* key, void* value,
+			     GuExn* err)
+{
+	PgfParseCacheNode* root = *(PgfParseCacheNode**) value;
+	pgf_parse_cache_free_node(root);
+}
+
+static void
+pgf_parse_cache_finalize(GuFinalizer* fin)
+{
+	PgfParseCache* cache = gu_container(fin, PgfParseCache, fin);
+	PgfParseCacheFreeFn clo = { { pgf_parse_cache_free_root_cb } };
+	gu_map_iter(cache->roots, &clo.fn, gu_null_exn());
+	gu_pool_free(cache->pool);
+}
+
+PgfParseCache*
+pgf_new_parse_cache(PgfParser* parser, size_t max_size, GuPool* pool)
+{
+	PgfParseCache* cache = gu_new(PgfParseCache, pool);
+	cache->parser = parser;
+	cache->pool = gu_new_pool();
+	cache->mutex = gu_new_mutex(pool);
+	cache->roots = gu_new_addr_map(PgfParse, PgfParseCacheNode*,
+				       &gu_null_struct, cache->pool);
+	cache->max_size = max_size;
+	cache->size = 0;
+	cache->lru_head = cache->lru_tail = NULL;
+	cache->fin.fn = pgf_parse_cache_finalize;
+	gu_pool_finally(pool, &cache->fin);
+	return cache;
+}
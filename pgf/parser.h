@@ -9,8 +9,6 @@
 
 /// Parsing
 /** @file
- *
- *  @todo Querying the parser for expected continuations
  *
  *  @todo Literals and custom categories
  *  
@@ -43,6 +41,32 @@ pgf_new_parser(PgfConcr* concr, GuPool* pool);
  * @return A newly created parser for the concrete category `concr`
  */ 
 
+/// The order in which the parser processes pending items
+typedef enum {
+	PGF_PARSE_ORDER_LIFO,
+	/**< Depth-first: the most recently derived item is processed
+	 * first. This is the default. */
+	PGF_PARSE_ORDER_FIFO,
+	/**< Breadth-first: items are processed in the order they are
+	 * derived. */
+	PGF_PARSE_ORDER_PRIORITY,
+	/**< Items that are closest to completion are processed
+	 * first. */
+} PgfParseOrder;
+
+/// Set the order in which pending parse items are processed
+void
+pgf_parser_set_order(PgfParser* parser, PgfParseOrder order);
+/**<
+ * The parser keeps the items that remain to be processed at the current
+ * position in an explicit agenda, so its stack depth does not grow with
+ * the grammar. The processing order does not affect the results of
+ * parsing, only the order in which they are discovered and the peak size
+ * of the agenda.
+ *
+ * @note The order should be set before the parser is used.
+ */
+
 /** @}
  * 
  * @name Parsing a sentence
@@ -73,6 +97,12 @@ pgf_parser_parse(PgfParser* parser, PgfCat* cat, PgfCtntId ctnt,
  * @pool
  *
  * @return An initial parsing state.
+ *
+ * @note The initial state depends only on the grammar, so it is computed
+ * only once for each category and constituent, and then shared between all
+ * parses started with the same parser. The shared state is allocated from
+ * the pool of `parser`, and `pool` is only used if `cat` has no concrete
+ * category.
 */
 
 
@@ -95,6 +125,187 @@ pgf_parse_token(PgfParse* parse, PgfToken tok, GuPool* pool);
  */
 
 
+/// An edge of a word lattice
+typedef struct PgfLatticeEdge PgfLatticeEdge;
+
+struct PgfLatticeEdge {
+	size_t from;
+	/**< The position where the token starts. */
+	size_t to;
+	/**< The position where the token ends. This must be greater than
+	 * `from`. */
+	PgfToken tok;
+	/**< The token. */
+	double cost;
+	/**< The cost of the edge, e.g. a negative log probability. */
+};
+
+/// A word lattice: a sequence of #PgfLatticeEdge elements
+typedef GuSeq PgfLattice;
+
+/// Feed a word lattice to the parser
+PgfParse*
+pgf_parse_lattice(PgfParse* parse, PgfLattice edges, double* cost_out,
+		  GuPool* pool);
+/**<
+ * A word lattice is a directed acyclic graph whose nodes are positions in
+ * the input, numbered in topological order, and whose edges are tokens.
+ * Position 0 is the start of the input, and the greatest position is its
+ * end. Lattices can represent alternative tokenizations, or the n-best
+ * hypotheses of a speech recognizer, compactly.
+ *
+ * The tokens of all the edges that end at the same position are scanned
+ * into a single parse state, so the work done after that position is
+ * shared by all the paths that reach it.
+ *
+ * @param parse The parse state at position 0
+ *
+ * @param edges The edges of the lattice
+ *
+ * @param[out] cost_out If not `NULL`, the least total cost of the paths
+ * through the lattice whose tokens the parser accepted is stored here.
+ *
+ * @pool
+ *
+ * @return The parse state at the end of the lattice, or `NULL` if none of
+ * the paths through the lattice were accepted.
+ */
+
+/// A check that can stop parsing a lattice early
+typedef struct PgfParseLimit PgfParseLimit;
+
+struct PgfParseLimit {
+	bool (*fn)(PgfParseLimit* self, GuPool* pool);
+	/**< Called after each position before the end of the lattice
+	 * that the parser reaches, with the pool of the parse. Returns
+	 * `true` to stop parsing. */
+};
+
+/// Feed a word lattice to the parser within a limit
+PgfParse*
+pgf_parse_lattice_limited(PgfParse* parse, PgfLattice edges,
+			  PgfParseLimit* limit, double* cost_out,
+			  GuPool* pool);
+/**<
+ * Like #pgf_parse_lattice, but `limit` can stop the parsing before the end
+ * of the lattice, e.g. when it takes too long or uses too much memory.
+ *
+ * @param limit The limit, or `NULL` for none.
+ *
+ * @pool
+ *
+ * @return As #pgf_parse_lattice, but `NULL` if `limit` stopped the
+ * parsing.
+ */
+
+
+/** @}
+ * @name Predicting the next token
+ *
+ * A parse state knows which tokens may come next. These can be queried
+ * e.g. to offer completions as the user types.
+ *
+ * @{
+ */
+
+/// A possible next token
+typedef struct PgfCompletion PgfCompletion;
+
+struct PgfCompletion {
+	PgfToken tok;
+	/**< The token. */
+	double prob;
+	/**< The greatest probability of an abstract function that
+	 * produces the token in this position. */
+};
+
+/// Get the possible next tokens that begin with a prefix
+GuSeq
+pgf_parse_completions(PgfParse* parse, GuString prefix, size_t limit,
+		      GuPool* pool);
+/**<
+ * @param parse A parse state
+ *
+ * @param prefix The beginning of the next token. Use #gu_empty_string to
+ * get all the possible next tokens.
+ *
+ * @param limit The maximum number of tokens to return. `SIZE_MAX` returns
+ * all of them.
+ *
+ * @pool
+ *
+ * @return A sequence of at most `limit` #PgfCompletion elements, the most
+ * probable first. Tokens of equal probability are in lexicographic order.
+ *
+ * @note An index of the next tokens is built the first time that this
+ * function is called on `parse`. After that, a query takes time
+ * logarithmic in the number of possible next tokens and linear in the
+ * number of those that begin with `prefix`.
+ */
+
+
+/** @}
+ * @name Caching parse states
+ *
+ * When many sentences with common prefixes are parsed, e.g. when parsing
+ * incrementally as the user types, the parse states for the prefixes can
+ * be shared with a #PgfParseCache. The cache keeps the states it has
+ * computed in a prefix tree, and parsing a sentence resumes from the state
+ * of its longest cached prefix.
+ *
+ * @{
+ */
+
+/// A bounded cache of parse states
+typedef struct PgfParseCache PgfParseCache;
+
+/// Create a new parse state cache
+PgfParseCache*
+pgf_new_parse_cache(PgfParser* parser, size_t max_size, GuPool* pool);
+/**<
+ * @param parser The parser whose states are to be cached
+ *
+ * @param max_size The maximum amount of memory, in bytes, to be used by
+ * cached states that are not in use. When the limit is exceeded, the least
+ * recently used states are evicted. The limit is approximate: only the pool
+ * memory of the states is counted.
+ *
+ * @pool
+ *
+ * @return A new cache. The cache may be used from several threads at once.
+ */
+
+/// Parse a sequence of tokens using the cache
+PgfParse*
+pgf_parse_cache_parse(PgfParseCache* cache, PgfCat* cat, PgfCtntId ctnt,
+		      PgfTokens toks, GuPool* pool);
+/**<
+ * @param cache The cache to use
+ *
+ * @param cat The abstract category to parse, as in #pgf_parser_parse
+ *
+ * @param ctnt The constituent to parse, as in #pgf_parser_parse
+ *
+ * @param toks The tokens to feed to the parser
+ *
+ * @pool
+ *
+ * @return The parse state obtained by feeding `toks` to the initial state
+ * of `cat` and `ctnt`, or `NULL` if one of the tokens was unexpected. The
+ * state and its prefixes are kept in the cache at least until `pool` is
+ * freed. The state must not be used after that.
+ *
+ * @note The pool of `cache` must outlive `pool`.
+ *
+ * @note If `cat` has no concrete category, nothing is cached, and the
+ * states are allocated from `pool`.
+ */
+
+/// Get the amount of memory used by the cached parse states
+size_t
+pgf_parse_cache_size(PgfParseCache* cache);
+
+
 /** @}
  * @name Retrieving abstract syntax trees
  *
@@ -127,6 +338,18 @@ pgf_parse_result(PgfParse* parse, GuPool* pool);
  */
 
 
+/// Retrieve the distinct current parses as hash-consed trees.
+PgfExprEnum*
+pgf_parse_result_unique(PgfParse* parse, PgfExprFactory* factory,
+			GuPool* pool);
+/**<
+ * Like #pgf_parse_result, but the trees are built by `factory`, so the
+ * readings share their common subtrees, and a tree that can be derived
+ * in several ways is only returned once.
+ *
+ * @pool
+ */
+
 /** @} */
 
 #endif // PGF_PARSER_H_
@@ -114,4 +114,6 @@ GU_DECLARE_TYPE(PgfPGF, referenced);
 
 GU_DECLARE_TYPE(PgfReadExn, abstract);
 
+GU_DECLARE_TYPE(PgfWriteExn, abstract);
+
 #endif // PGF_H_
@@ -33,6 +33,14 @@ struct PgfReader {
 	PgfCncFuns curr_cncfuns;
 	GuMap* curr_ccats;
 	GuMap* curr_lindefs;
+	GuMap* curr_firsts;
+	bool keep_layout;
+	/**< Whether the numbering of the concrete grammars is kept. */
+#ifdef GU_OPTIMIZE_SIZE
+	GuBuf* curr_kss;
+	GuBuf* curr_kps;
+#endif
+	GuMap* implicit_cats;
 	GuTypeMap* read_to_map;
 	GuTypeMap* read_new_map;
 	void* curr_key;
@@ -51,6 +59,8 @@ static GU_DEFINE_TYPE(PgfReadTagExn, abstract, _);
 
 GU_DEFINE_TYPE(PgfReadExn, abstract, _);
 
+static const bool pgf_reader_false = false;
+
 static void
 pgf_reader_tell(PgfReader* rdr)
 {
@@ -187,6 +197,69 @@ pgf_read_to_GuVariant(GuType* type, PgfReader* rdr, void* to)
 	gu_exit("<- variant %s", ctor->c_name);
 }
 
+static void
+pgf_read_to_PgfSymbol(GuType* type, PgfReader* rdr, void* to)
+{
+	PgfSymbol* sym = to;
+	uint8_t tag = pgf_read_u8(rdr);
+	gu_return_on_exn(rdr->err,);
+	switch (tag) {
+	case PGF_SYMBOL_CAT:
+	case PGF_SYMBOL_LIT:
+	case PGF_SYMBOL_VAR: {
+		int32_t d = pgf_read_int(rdr);
+		int32_t r = pgf_read_int(rdr);
+		gu_return_on_exn(rdr->err,);
+		if (d < 0 || d > PGF_SYMBOL_MAX_D
+		    || r < 0 || r > PGF_SYMBOL_MAX_R) {
+			// The indices don't fit in the symbol.
+			gu_raise_i(rdr->err, PgfReadTagExn,
+				   .type = type, .tag = tag);
+			return;
+		}
+		*sym = pgf_symbol_idx(tag, d, r);
+		break;
+	}
+#ifdef GU_OPTIMIZE_SIZE
+	case PGF_SYMBOL_KS:
+	case PGF_SYMBOL_KP: {
+		GuBuf* buf = tag == PGF_SYMBOL_KS ? rdr->curr_kss : rdr->curr_kps;
+		size_t idx = gu_buf_length(buf);
+		if (idx > PGF_SYMBOL_MAX_REF) {
+			gu_raise_i(rdr->err, PgfReadTagExn,
+				   .type = type, .tag = tag);
+			return;
+		}
+		pgf_read_to(rdr, tag == PGF_SYMBOL_KS ?
+			    gu_type(PgfSymbolKS) : gu_type(PgfSymbolKP),
+			    gu_buf_extend(buf));
+		*sym = pgf_symbol_ref(tag, idx);
+		break;
+	}
+#else
+	case PGF_SYMBOL_KS: {
+		PgfSymbolKS* ks = gu_malloc_aligned(rdr->opool,
+						    sizeof(PgfSymbolKS),
+						    PGF_SYMBOL_ALIGN);
+		pgf_read_to(rdr, gu_type(PgfSymbolKS), ks);
+		*sym = pgf_symbol_ptr(tag, ks);
+		break;
+	}
+	case PGF_SYMBOL_KP: {
+		PgfSymbolKP* kp = gu_malloc_aligned(rdr->opool,
+						    sizeof(PgfSymbolKP),
+						    PGF_SYMBOL_ALIGN);
+		pgf_read_to(rdr, gu_type(PgfSymbolKP), kp);
+		*sym = pgf_symbol_ptr(tag, kp);
+		break;
+	}
+#endif
+	default:
+		gu_raise_i(rdr->err, PgfReadTagExn, 
+			   .type = type, .tag = tag);
+	}
+}
+
 static void
 pgf_read_to_enum(GuType* type, PgfReader* rdr, void* to)
 {
@@ -388,7 +461,7 @@ pgf_read_new_PgfCCat(GuType* type, PgfReader* rdr, GuPool* pool)
 }
 
 static void
-pgf_read_to_GuSeq(GuType* type, PgfReader* rdr, void* to)
+pgf_read_seq_to(GuType* type, PgfReader* rdr, void* to, GuPool* pool)
 {
 	gu_enter("->");
 	void* old_key = rdr->curr_key;
@@ -396,7 +469,7 @@ pgf_read_to_GuSeq(GuType* type, PgfReader* rdr, void* to)
 	GuLength length = pgf_read_len(rdr);
 	GuTypeRepr* repr = gu_type_repr(stype->elem_type);
 	gu_return_on_exn(rdr->err, );
-	GuSeq seq = gu_make_seq(repr->size, length, rdr->opool);
+	GuSeq seq = gu_make_seq(repr->size, length, pool);
 	uint8_t* data = gu_seq_data(seq);
 	for (size_t i = 0; i < length; i++) {
 		rdr->curr_key = &i;
@@ -410,6 +483,12 @@ pgf_read_to_GuSeq(GuType* type, PgfReader* rdr, void* to)
 	gu_exit("<-");
 }
 
+static void
+pgf_read_to_GuSeq(GuType* type, PgfReader* rdr, void* to)
+{
+	pgf_read_seq_to(type, rdr, to, rdr->opool);
+}
+
 static void
 pgf_read_to_maybe_seq(GuType* type, PgfReader* rdr, void* to)
 {
@@ -434,7 +513,9 @@ pgf_read_to_maybe_seq(GuType* type, PgfReader* rdr, void* to)
 static void
 pgf_read_to_idarray(GuType* type, PgfReader* rdr, void* to)
 {
-	pgf_read_to_GuSeq(type, rdr, to);
+	// Without the layout, the array is only needed while reading.
+	pgf_read_seq_to(type, rdr, to,
+			rdr->keep_layout ? rdr->opool : rdr->curr_pool);
 	gu_return_on_exn(rdr->err,);
 	GuSeq seq = *(GuSeq*) to;
 	if (type == gu_type(PgfSequences)) {
@@ -558,6 +639,9 @@ pgf_read_new_PgfConcr(GuType* type, PgfReader* rdr, GuPool* pool)
 	GuPool* tmp_pool = gu_new_pool();
 	rdr->curr_pool = tmp_pool;
 	PgfConcr* concr = gu_new(PgfConcr, pool);
+	concr->layout = NULL;
+	/* The indices are kept for the writer if it is asked for. */
+	GuPool* index_pool = rdr->keep_layout ? rdr->opool : tmp_pool;
 	concr->pgf =
 		(PgfPGF*) gu_map_get(rdr->ctx, gu_type(PgfPGF), GuStruct*);
 	concr->id = *(PgfCId*) rdr->curr_key;
@@ -566,11 +650,21 @@ pgf_read_new_PgfConcr(GuType* type, PgfReader* rdr, GuPool* pool)
 		pgf_read_new(rdr, gu_type(PgfFlags), pool);
 	concr->printnames = 
 		pgf_read_new(rdr, gu_type(PgfPrintNames), pool);
+#ifdef GU_OPTIMIZE_SIZE
+	concr->symbol_kss = gu_null_seq;
+	concr->symbol_kps = gu_null_seq;
+	rdr->curr_kss = gu_new_buf(PgfSymbolKS, tmp_pool);
+	rdr->curr_kps = gu_new_buf(PgfSymbolKP, tmp_pool);
+#endif
 	pgf_read_to(rdr, gu_type(PgfSequences), &rdr->curr_sequences);
 	pgf_read_to(rdr, gu_type(PgfCncFuns), &rdr->curr_cncfuns);
 	if (!gu_ok(rdr->err)) {
 		goto fail;
 	}
+#ifdef GU_OPTIMIZE_SIZE
+	concr->symbol_kss = gu_buf_freeze(rdr->curr_kss, rdr->opool);
+	concr->symbol_kps = gu_buf_freeze(rdr->curr_kps, rdr->opool);
+#endif
 #ifndef GU_OPTIMIZE_SIZE	
 	PgfCncFun** cncfuns = gu_seq_data(rdr->curr_cncfuns);
 	size_t n_cncfuns = gu_seq_length(rdr->curr_cncfuns);
@@ -579,12 +673,14 @@ pgf_read_new_PgfConcr(GuType* type, PgfReader* rdr, GuPool* pool)
 	}
 #endif
 	GuMapType* lindefs_t = gu_type_cast(gu_type(PgfLinDefs), GuMap);
-	rdr->curr_lindefs = gu_map_type_make(lindefs_t, tmp_pool);
+	rdr->curr_lindefs = gu_map_type_make(lindefs_t, index_pool);
 	pgf_read_into_map(lindefs_t, rdr, rdr->curr_lindefs, rdr->opool);
 	GuMapType* ccats_t = gu_type_cast(gu_type(PgfCCatMap), GuMap);
 	rdr->curr_ccats = gu_new_map(PgfFId, gu_int32_hasher,
-				     PgfCCat*, &gu_null_struct, tmp_pool);
+				     PgfCCat*, &gu_null_struct, index_pool);
 	pgf_read_into_map(ccats_t, rdr, rdr->curr_ccats, rdr->opool);
+	rdr->curr_firsts = gu_new_addr_map(PgfCncCat, PgfFId, &gu_null_struct,
+					   index_pool);
 	concr->cnccats =
 		pgf_read_new(rdr, gu_type(PgfCncCatMap), rdr->opool);
 
@@ -592,7 +688,17 @@ pgf_read_new_PgfConcr(GuType* type, PgfReader* rdr, GuPool* pool)
 	PgfCCatCbCtx ctx = { { pgf_read_ccat_cb }, extra_ccats };
 	gu_map_iter(rdr->curr_ccats, &ctx.fn, gu_null_exn());
 	concr->extra_ccats = gu_buf_freeze(extra_ccats, rdr->opool);
-	(void) pgf_read_int(rdr); // totalcats
+	int32_t totalcats = pgf_read_int(rdr);
+	if (rdr->keep_layout && gu_ok(rdr->err)) {
+		PgfConcrLayout* layout = gu_new(PgfConcrLayout, rdr->opool);
+		layout->sequences = rdr->curr_sequences;
+		layout->cncfuns = rdr->curr_cncfuns;
+		layout->lindefs = rdr->curr_lindefs;
+		layout->ccats = rdr->curr_ccats;
+		layout->firsts = rdr->curr_firsts;
+		layout->totalcats = totalcats;
+		concr->layout = layout;
+	}
 fail:
 	gu_pool_free(tmp_pool);
 	return concr;
@@ -650,6 +756,7 @@ pgf_read_new_PgfCatId(GuType* type, PgfReader* rdr, GuPool* pool)
 		cat->context = gu_empty_seq();
 		cat->functions = gu_empty_seq();
 		gu_map_put(pgf->abstract.cats, &cid, PgfCat*, cat);
+		gu_map_put(rdr->implicit_cats, cat, bool, true);
 	}
 	return cat;
 }
@@ -685,6 +792,7 @@ pgf_read_new_PgfCncCat(GuType* type, PgfReader* rdr, GuPool* pool)
 	}
 	cnccat->n_ctnts = n_ctnts == -1 ? 0 : (size_t) n_ctnts;
 	cnccat->cats = cats;
+	gu_map_put(rdr->curr_firsts, cnccat, PgfFId, first);
 	cnccat->lindefs = gu_map_get(rdr->curr_lindefs, &first, PgfFunIds);
 	pgf_read_to(rdr, gu_type(GuStrings), &cnccat->ctnts);
 	gu_exit("<-");
@@ -722,6 +830,7 @@ pgf_read_to_table = GU_TYPETABLE(
 	PGF_READ_TO(PgfFunId),
 	PGF_READ_TO(PgfContext),
 	PGF_READ_TO(PgfKey),
+	PGF_READ_TO(PgfSymbol),
 	PGF_READ_TO(alias),
 	PGF_READ_TO(referenced),
 	PGF_READ_TO_FN(PgfSequences, pgf_read_to_idarray),
@@ -754,21 +863,43 @@ pgf_new_reader(GuIn* in, GuPool* opool, GuPool* pool, GuExn* err)
 	rdr->in = in;
 	rdr->curr_sequences = gu_null_seq;
 	rdr->curr_cncfuns = gu_null_seq;
+	rdr->keep_layout = false;
 	rdr->read_to_map = gu_new_type_map(&pgf_read_to_table, pool);
 	rdr->read_new_map = gu_new_type_map(&pgf_read_new_table, pool);
 	rdr->pool = pool;
 	rdr->ctx = gu_new_addr_map(GuType, void*, &gu_null, pool);
+	rdr->implicit_cats = gu_new_addr_map(PgfCat, bool,
+					     &pgf_reader_false, opool);
 	return rdr;
 }
 
 
-PgfPGF*
-pgf_read_pgf(GuIn* in, GuPool* pool, GuExn* err)
+static PgfPGF*
+pgf_read_pgf_layout(GuIn* in, bool keep_layout, GuPool* pool, GuExn* err)
 {
 	GuPool* tmp_pool = gu_new_pool();
 	PgfReader* rdr = pgf_new_reader(in, pool, tmp_pool, err);
+	rdr->keep_layout = keep_layout;
 	PgfPGF* pgf = pgf_read_new(rdr, gu_type(PgfPGF), pool);
+	if (pgf != NULL) {
+		pgf->implicit_cats = rdr->implicit_cats;
+	}
 	gu_pool_free(tmp_pool);
 	gu_return_on_exn(err, NULL);
 	return pgf;
 }
+
+PgfPGF*
+pgf_read_pgf(GuIn* in, GuPool* pool, GuExn* err)
+{
+	return pgf_read_pgf_layout(in, false, pool, err);
+}
+
+PgfPGF*
+pgf_read_pgf_keep_layout(GuIn* in, GuPool* pool, GuExn* err)
+{
+	// The writer needs the fids of the ccats and functions to use the
+	// layout, and GU_OPTIMIZE_SIZE doesn't keep them.
+	return pgf_read_pgf_layout(in, GU_SIZE_OPTIMIZED(true, false),
+				   pool, err);
+}
@@ -26,5 +26,19 @@ pgf_read_pgf(GuIn* in, GuPool* pool, GuExn* exn);
  * @return A new PGF object allocated from `pool`, or `NULL` upon failure.
  */
 
+PgfPGF*
+pgf_read_pgf_keep_layout(GuIn* in, GuPool* pool, GuExn* exn);
+
+/**< Read a grammar, and keep how it is numbered in the PGF file.
+ *
+ * Like #pgf_read_pgf, but the numbering of the sequences, functions and
+ * categories of each concrete grammar in the file is kept in the grammar,
+ * so that #pgf_write_pgf can write the grammar back as it was read. This
+ * costs memory that #pgf_read_pgf frees after reading, so only use this
+ * if the grammar is to be written again. When the library is built with
+ * GU_OPTIMIZE_SIZE, the numbering is not kept, and this is the same as
+ * #pgf_read_pgf.
+ */
+
 
 #endif // GU_READER_H_
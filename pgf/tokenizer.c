@@ -0,0 +1,333 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#include "data.h"
+#include "tokenizer.h"
+#include <gu/map.h>
+#include <gu/seq.h>
+#include <gu/string.h>
+#include <gu/assert.h>
+#include <gu/log.h>
+#include <stdlib.h>
+
+typedef struct PgfTokenForm PgfTokenForm;
+
+struct PgfTokenForm {
+	GuCSlice utf8;
+	PgfToken tok;
+};
+
+struct PgfTokenizer {
+	PgfTokenForm* forms;
+	/**< The distinct token forms of the grammar, sorted
+	 * lexicographically by their UTF-8 encodings. Each prefix of a
+	 * form thus corresponds to a contiguous range of forms, so the
+	 * array can be walked like a trie. */
+	size_t n_forms;
+};
+
+typedef struct {
+	PgfConcr* concr;
+	GuSet* funs;
+	GuSet* toks;
+} PgfTokenizerIndex;
+
+static void
+pgf_tokenizer_add_tokens(PgfTokenizerIndex* idx, PgfTokens toks)
+{
+	size_t n_toks = gu_seq_length(toks);
+	for (size_t i = 0; i < n_toks; i++) {
+		PgfToken tok = gu_seq_get(toks, PgfToken, i);
+		gu_set_insert(idx->toks, &tok);
+	}
+}
+
+static void
+pgf_tokenizer_add_fun(PgfTokenizerIndex* idx, PgfCncFun* fun)
+{
+	if (gu_set_has(idx->funs, fun)) {
+		return;
+	}
+	gu_set_insert(idx->funs, fun);
+	size_t n_lins = gu_seq_length(fun->lins);
+	for (size_t i = 0; i < n_lins; i++) {
+		PgfSequence seq = gu_seq_get(fun->lins, PgfSequence, i);
+		size_t n_syms = gu_seq_length(seq);
+		for (size_t j = 0; j < n_syms; j++) {
+			PgfSymbol sym = gu_seq_get(seq, PgfSymbol, j);
+			switch (pgf_symbol_tag(sym)) {
+			case PGF_SYMBOL_KS: {
+				PgfSymbolKS* ks = pgf_symbol_ks(idx->concr, sym);
+				pgf_tokenizer_add_tokens(idx, ks->tokens);
+				break;
+			}
+			case PGF_SYMBOL_KP: {
+				PgfSymbolKP* kp = pgf_symbol_kp(idx->concr, sym);
+				pgf_tokenizer_add_tokens(idx, kp->default_form);
+				size_t n_alts = gu_seq_length(kp->alts);
+				for (size_t k = 0; k < n_alts; k++) {
+					PgfAlternative* alt =
+						gu_seq_index(kp->alts,
+							     PgfAlternative, k);
+					pgf_tokenizer_add_tokens(idx, alt->form);
+				}
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+}
+
+static void
+pgf_tokenizer_add_ccat(PgfTokenizerIndex* idx, PgfCCat* ccat)
+{
+	if (gu_seq_is_null(ccat->prods)) {
+		return;
+	}
+	size_t n_prods = gu_seq_length(ccat->prods);
+	for (size_t i = 0; i < n_prods; i++) {
+		PgfProduction prod = gu_seq_get(ccat->prods, PgfProduction, i);
+		if (gu_variant_tag(prod) == PGF_PRODUCTION_APPLY) {
+			PgfProductionApply* papp = gu_variant_data(prod);
+			pgf_tokenizer_add_fun(idx, papp->fun);
+		}
+	}
+}
+
+typedef struct {
+	GuMapItor fn;
+	PgfTokenizerIndex* idx;
+} PgfTokenizerIndexFn;
+
+static void
+pgf_tokenizer_add_cnccat_cb(GuMapItor* fn, const void* key, void* value,
+			    GuExn* err)
+{
+	PgfTokenizerIndexFn* clo = (PgfTokenizerIndexFn*) fn;
+	PgfCncCat* cnccat = *(PgfCncCat**) value;
+	size_t n_ccats = gu_seq_length(cnccat->cats);
+	for (size_t i = 0; i < n_ccats; i++) {
+		PgfCCat* ccat = gu_seq_get(cnccat->cats, PgfCCat*, i);
+		if (ccat != NULL) {
+			pgf_tokenizer_add_ccat(clo->idx, ccat);
+		}
+	}
+}
+
+static int
+pgf_token_form_cmp(const void* p1, const void* p2)
+{
+	const PgfTokenForm* f1 = p1;
+	const PgfTokenForm* f2 = p2;
+	size_t sz = GU_MIN(f1->utf8.sz, f2->utf8.sz);
+	int c = memcmp(f1->utf8.p, f2->utf8.p, sz);
+	if (c != 0) {
+		return c;
+	}
+	return (f1->utf8.sz > f2->utf8.sz) - (f1->utf8.sz < f2->utf8.sz);
+}
+
+PgfTokenizer*
+pgf_new_tokenizer(PgfConcr* concr, GuPool* pool)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	PgfTokenizerIndex idx = {
+		.concr = concr,
+		.funs = gu_new_addr_set(PgfCncFun, tmp_pool),
+		.toks = gu_new_set(PgfToken, gu_string_hasher, tmp_pool)
+	};
+	PgfTokenizerIndexFn clo = { { pgf_tokenizer_add_cnccat_cb }, &idx };
+	gu_map_iter(concr->cnccats, &clo.fn, gu_null_exn());
+	size_t n_extras = gu_seq_length(concr->extra_ccats);
+	for (size_t i = 0; i < n_extras; i++) {
+		PgfCCat* ccat = gu_seq_get(concr->extra_ccats, PgfCCat*, i);
+		pgf_tokenizer_add_ccat(&idx, ccat);
+	}
+
+	GuBuf* forms = gu_new_buf(PgfTokenForm, tmp_pool);
+	GuEnum* toks = gu_map_keys(idx.toks, tmp_pool);
+	PgfToken tok;
+	while (gu_enum_next(toks, &tok, tmp_pool)) {
+		GuSlice utf8 = gu_string_utf8(tok, pool);
+		if (utf8.sz == 0) {
+			continue;
+		}
+		PgfTokenForm form = { gu_slice_cslice(utf8), tok };
+		gu_buf_push(forms, PgfTokenForm, form);
+	}
+
+	PgfTokenizer* tzr = gu_new(PgfTokenizer, pool);
+	tzr->n_forms = gu_buf_length(forms);
+	tzr->forms = gu_new_n(PgfTokenForm, GU_MAX(tzr->n_forms, 1), pool);
+	memcpy(tzr->forms, gu_buf_data(forms),
+	       tzr->n_forms * sizeof(PgfTokenForm));
+	qsort(tzr->forms, tzr->n_forms, sizeof(PgfTokenForm),
+	      pgf_token_form_cmp);
+	gu_debug("%zu token forms", tzr->n_forms);
+	gu_pool_free(tmp_pool);
+	return tzr;
+}
+
+static bool
+pgf_tokenizer_is_space(uint8_t c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r'
+		|| c == '\f' || c == '\v';
+}
+
+static size_t
+pgf_tokenizer_skip_space(GuCSlice text, size_t pos)
+{
+	while (pos < text.sz && pgf_tokenizer_is_space(text.p[pos])) {
+		pos++;
+	}
+	return pos;
+}
+
+// Find the first form in [lo, hi) whose byte at `depth` is not less than
+// `c`. All the forms in the range are longer than `depth`.
+static size_t
+pgf_tokenizer_lower_bound(PgfTokenizer* tzr, size_t lo, size_t hi,
+			  size_t depth, unsigned c)
+{
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (tzr->forms[mid].utf8.p[depth] < c) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Push the indices of the forms that occur in `text` at `pos` onto
+// `matches`, shortest first.
+static void
+pgf_tokenizer_match(PgfTokenizer* tzr, GuCSlice text, size_t pos,
+		    GuBuf* matches)
+{
+	size_t lo = 0;
+	size_t hi = tzr->n_forms;
+	for (size_t depth = 0; lo < hi; depth++) {
+		// Within the range of forms that share the first `depth`
+		// bytes, the form with exactly `depth` bytes sorts first.
+		if (tzr->forms[lo].utf8.sz == depth) {
+			gu_buf_push(matches, size_t, lo);
+			lo++;
+		}
+		if (lo == hi || pos + depth == text.sz) {
+			break;
+		}
+		unsigned c = text.p[pos + depth];
+		lo = pgf_tokenizer_lower_bound(tzr, lo, hi, depth, c);
+		hi = pgf_tokenizer_lower_bound(tzr, lo, hi, depth, c + 1);
+	}
+}
+
+static size_t
+pgf_tokenizer_unknown_end(GuCSlice text, size_t pos)
+{
+	while (pos < text.sz && !pgf_tokenizer_is_space(text.p[pos])) {
+		pos++;
+	}
+	return pos;
+}
+
+PgfTokens
+pgf_tokenize(PgfTokenizer* tzr, GuCSlice text, GuPool* pool)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	GuBuf* toks = gu_new_buf(PgfToken, tmp_pool);
+	GuBuf* matches = gu_new_buf(size_t, tmp_pool);
+	size_t pos = pgf_tokenizer_skip_space(text, 0);
+	while (pos < text.sz) {
+		gu_buf_trim_n(matches, gu_buf_length(matches));
+		pgf_tokenizer_match(tzr, text, pos, matches);
+		size_t n_matches = gu_buf_length(matches);
+		if (n_matches > 0) {
+			size_t i = gu_buf_get(matches, size_t, n_matches - 1);
+			PgfTokenForm* form = &tzr->forms[i];
+			gu_buf_push(toks, PgfToken, form->tok);
+			pos += form->utf8.sz;
+		} else {
+			size_t end = pgf_tokenizer_unknown_end(text, pos);
+			PgfToken tok = gu_utf8_string(
+				gu_cslice(&text.p[pos], end - pos), pool);
+			gu_buf_push(toks, PgfToken, tok);
+			pos = end;
+		}
+		pos = pgf_tokenizer_skip_space(text, pos);
+	}
+	PgfTokens ret = gu_buf_freeze(toks, pool);
+	gu_pool_free(tmp_pool);
+	return ret;
+}
+
+PgfLattice
+pgf_tokenize_lattice(PgfTokenizer* tzr, GuCSlice text, GuPool* pool)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	GuBuf* edges = gu_new_buf(PgfLatticeEdge, tmp_pool);
+	GuBuf* matches = gu_new_buf(size_t, tmp_pool);
+	bool* reached = gu_new_n(bool, text.sz + 1, tmp_pool);
+	memset(reached, 0, (text.sz + 1) * sizeof(bool));
+	// Leading whitespace is skipped, but the lattice always starts at
+	// position 0.
+	size_t start = pgf_tokenizer_skip_space(text, 0);
+	reached[start] = true;
+	// The edges are produced in order of their source positions.
+	for (size_t pos = start; pos < text.sz; pos++) {
+		if (!reached[pos]) {
+			continue;
+		}
+		size_t from = pos == start ? 0 : pos;
+		gu_buf_trim_n(matches, gu_buf_length(matches));
+		pgf_tokenizer_match(tzr, text, pos, matches);
+		size_t n_matches = gu_buf_length(matches);
+		for (size_t i = 0; i < n_matches; i++) {
+			PgfTokenForm* form =
+				&tzr->forms[gu_buf_get(matches, size_t, i)];
+			size_t to = pgf_tokenizer_skip_space(
+				text, pos + form->utf8.sz);
+			PgfLatticeEdge edge = { from, to, form->tok, 0.0 };
+			gu_buf_push(edges, PgfLatticeEdge, edge);
+			reached[to] = true;
+		}
+		if (n_matches == 0) {
+			size_t end = pgf_tokenizer_unknown_end(text, pos);
+			PgfToken tok = gu_utf8_string(
+				gu_cslice(&text.p[pos], end - pos), pool);
+			size_t to = pgf_tokenizer_skip_space(text, end);
+			PgfLatticeEdge edge = { from, to, tok, 0.0 };
+			gu_buf_push(edges, PgfLatticeEdge, edge);
+			reached[to] = true;
+		}
+	}
+
+	// Keep only the edges from which the end of the text can be
+	// reached, scanning them backwards.
+	bool* viable = gu_new_n(bool, text.sz + 1, tmp_pool);
+	memset(viable, 0, (text.sz + 1) * sizeof(bool));
+	viable[text.sz] = true;
+	size_t n_edges = gu_buf_length(edges);
+	size_t n_viable = 0;
+	for (size_t i = n_edges; i-- > 0; ) {
+		PgfLatticeEdge* edge = gu_buf_index(edges, PgfLatticeEdge, i);
+		if (viable[edge->to]) {
+			viable[edge->from] = true;
+			n_viable++;
+		}
+	}
+	PgfLattice lattice = gu_new_seq(PgfLatticeEdge, n_viable, pool);
+	size_t j = 0;
+	for (size_t i = 0; i < n_edges; i++) {
+		PgfLatticeEdge* edge = gu_buf_index(edges, PgfLatticeEdge, i);
+		if (viable[edge->to]) {
+			gu_seq_set(lattice, PgfLatticeEdge, j++, *edge);
+		}
+	}
+	gu_pool_free(tmp_pool);
+	return lattice;
+}
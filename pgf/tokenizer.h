@@ -0,0 +1,74 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#ifndef PGF_TOKENIZER_H_
+#define PGF_TOKENIZER_H_
+
+#include <libgu.h>
+#include <pgf/pgf.h>
+#include <pgf/parser.h>
+
+/// Tokenization of raw text
+/** @file
+ *
+ * A #PgfTokenizer splits text into the tokens of a concrete grammar. The
+ * tokens need not be separated by whitespace in the text, so punctuation
+ * and glued morphemes are recognized as separate tokens as long as they
+ * occur as tokens in the grammar. Conversely, a token of the grammar may
+ * itself contain spaces.
+ */
+
+/// A tokenizer for the token forms of a concrete grammar
+typedef struct PgfTokenizer PgfTokenizer;
+
+/// Create a new tokenizer
+PgfTokenizer*
+pgf_new_tokenizer(PgfConcr* concr, GuPool* pool);
+/**<
+ * @param concr The concrete grammar whose tokens are to be recognized.
+ * All the token forms of the grammar, including the variant forms of
+ * prefix-dependent symbols, are indexed when the tokenizer is created.
+ *
+ * @pool
+ *
+ * @return A new tokenizer.
+ */
+
+/// Split a text into tokens, preferring the longest tokens
+PgfTokens
+pgf_tokenize(PgfTokenizer* tzr, GuCSlice text, GuPool* pool);
+/**<
+ * @param tzr The tokenizer to use
+ *
+ * @param text A UTF-8 encoded text
+ *
+ * @pool
+ *
+ * @return The tokens of `text`. Whitespace between tokens is skipped, and
+ * at each position the longest token of the grammar that occurs there is
+ * chosen. Where no token of the grammar occurs, the text up to the next
+ * whitespace is returned as a single unknown token.
+ *
+ * @note The greedy choice may fail to find a segmentation that the grammar
+ * accepts when the text can be segmented in several ways. Use
+ * #pgf_tokenize_lattice to get all the segmentations.
+ */
+
+/// Split a text into tokens in all possible ways
+PgfLattice
+pgf_tokenize_lattice(PgfTokenizer* tzr, GuCSlice text, GuPool* pool);
+/**<
+ * @param tzr The tokenizer to use
+ *
+ * @param text A UTF-8 encoded text
+ *
+ * @pool
+ *
+ * @return A word lattice, suitable for #pgf_parse_lattice, whose paths are
+ * the segmentations of `text` into tokens. The positions of the lattice are
+ * byte offsets into `text`, except that the lattice starts at position 0
+ * even if `text` begins with whitespace. Each edge has zero cost. Edges
+ * that are not on a path through the whole text are omitted. The text is
+ * ambiguous if some position has more than one outgoing edge.
+ */
+
+#endif // PGF_TOKENIZER_H_
@@ -0,0 +1,270 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#include "config.h"
+#include <pgf/translate.h>
+#include <pgf/parser.h>
+#include <pgf/tokenizer.h>
+#include <pgf/linearize.h>
+#include <gu/mutex.h>
+#include <gu/assert.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+struct PgfTranslator {
+	PgfCat* cat;
+	PgfCtntId from_ctnt;
+	PgfCtntId to_ctnt;
+	PgfParser* parser;
+	PgfTokenizer* tzr;
+	PgfLzr* lzr;
+};
+
+PgfTranslator*
+pgf_new_translator(PgfCat* cat,
+		   PgfConcr* from, PgfCtntId from_ctnt,
+		   PgfConcr* to, PgfCtntId to_ctnt,
+		   GuPool* pool)
+{
+	PgfTranslator* tr = gu_new(PgfTranslator, pool);
+	tr->cat = cat;
+	tr->from_ctnt = from_ctnt;
+	tr->to_ctnt = to_ctnt;
+	tr->parser = pgf_new_parser(from, pool);
+	tr->tzr = pgf_new_tokenizer(from, pool);
+	tr->lzr = pgf_new_lzr(to, pool);
+	return tr;
+}
+
+static bool
+pgf_translate_stop(PgfTranslateLimit* limit, GuPool* ppool)
+{
+	return limit != NULL && limit->fn(limit, ppool);
+}
+
+// Checks a translation limit while the lattice of a sentence is parsed.
+typedef struct {
+	PgfParseLimit parse_limit;
+	PgfTranslateLimit* limit;
+	bool stopped;
+} PgfTranslateParseLimit;
+
+static bool
+pgf_translate_parse_stop(PgfParseLimit* self, GuPool* ppool)
+{
+	PgfTranslateParseLimit* tpl =
+		gu_container(self, PgfTranslateParseLimit, parse_limit);
+	tpl->stopped = pgf_translate_stop(tpl->limit, ppool);
+	return tpl->stopped;
+}
+
+// Translate `text`. The readings are built by `factory`, and the
+// translations are allocated from `pool`. `lin` is a scratch buffer for
+// linearizations.
+static PgfTranslations
+pgf_translate_with(PgfTranslator* tr, GuCSlice text,
+		   PgfExprFactory* factory, PgfTranslateLimit* limit,
+		   GuByteBuf* lin, GuPool* pool)
+{
+	GuPool* ppool = gu_local_pool();
+	PgfTranslations ret = gu_null_seq;
+	GuBuf* trans = gu_new_buf(PgfTranslation, ppool);
+	PgfParse* parse =
+		pgf_parser_parse(tr->parser, tr->cat, tr->from_ctnt, ppool);
+	// All the segmentations of the text are parsed, so that a greedy
+	// choice of a token can't hide a reading.
+	PgfLattice lattice = pgf_tokenize_lattice(tr->tzr, text, ppool);
+	PgfTranslateParseLimit tpl = {
+		{ pgf_translate_parse_stop }, limit, false
+	};
+	parse = pgf_parse_lattice_limited(parse, lattice,
+					  limit ? &tpl.parse_limit : NULL,
+					  NULL, ppool);
+	if (parse == NULL) {
+		if (tpl.stopped) {
+			ret = gu_buf_freeze(trans, pool);
+		}
+		goto end;
+	}
+	bool stop = pgf_translate_stop(limit, ppool);
+
+	GuEnum* result = pgf_parse_result_unique(parse, factory, ppool);
+	PgfExpr expr;
+	while (!stop && gu_enum_next(result, &expr, ppool)) {
+		GuEnum* cts = pgf_lzr_concretize(tr->lzr, expr, ppool);
+		PgfCncTree ctree;
+		while (!stop && gu_enum_next(cts, &ctree, ppool)) {
+			gu_buf_trim_n(lin, gu_buf_length(lin));
+			pgf_lzr_linearize_utf8(tr->lzr, ctree, tr->to_ctnt, lin);
+			GuCSlice bytes = gu_cslice(gu_buf_data(lin),
+						   gu_buf_length(lin));
+			PgfTranslation t = {
+				.expr = expr,
+				.lin = gu_utf8_string(bytes, pool)
+			};
+			gu_buf_push(trans, PgfTranslation, t);
+			stop = pgf_translate_stop(limit, ppool);
+		}
+	}
+	ret = gu_buf_freeze(trans, pool);
+end:
+	gu_pool_free(ppool);
+	return ret;
+}
+
+PgfTranslations
+pgf_translate_limited(PgfTranslator* tr, GuCSlice text,
+		      PgfTranslateLimit* limit, GuPool* pool)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	PgfExprFactory* factory = pgf_new_expr_factory(pool);
+	GuByteBuf* lin = gu_new_buf(uint8_t, tmp_pool);
+	PgfTranslations ret =
+		pgf_translate_with(tr, text, factory, limit, lin, pool);
+	gu_pool_free(tmp_pool);
+	return ret;
+}
+
+PgfTranslations
+pgf_translate(PgfTranslator* tr, GuCSlice text, GuPool* pool)
+{
+	PgfTranslations ret = pgf_translate_limited(tr, text, NULL, pool);
+	return gu_seq_is_null(ret) ? gu_empty_seq() : ret;
+}
+
+
+//
+// Batches
+//
+
+typedef struct PgfBatch PgfBatch;
+
+struct PgfBatch {
+	PgfTranslator* tr;
+	GuStrings texts;
+	GuSeq results;
+	GuMutex* mutex;
+	/**< Protects `next`. */
+	size_t next;
+	/**< The index of the next sentence that no thread has taken. */
+};
+
+typedef struct PgfBatchWorker PgfBatchWorker;
+
+struct PgfBatchWorker {
+	PgfBatch* batch;
+	GuPool* pool;
+	/**< The pool of the results of this worker. It is owned by the
+	 * worker until the batch is done, and then freed with the pool of
+	 * the batch. */
+	GuFinalizer fin;
+#ifdef HAVE_PTHREAD_H
+	pthread_t thread;
+	bool started;
+#endif
+};
+
+static void
+pgf_batch_worker_finalize(GuFinalizer* fin)
+{
+	PgfBatchWorker* w = gu_container(fin, PgfBatchWorker, fin);
+	gu_pool_free(w->pool);
+}
+
+static void*
+pgf_batch_worker_run(void* arg)
+{
+	PgfBatchWorker* w = arg;
+	PgfBatch* batch = w->batch;
+	size_t n_texts = gu_seq_length(batch->texts);
+	PgfExprFactory* factory = pgf_new_expr_factory(w->pool);
+	GuPool* tmp_pool = gu_new_pool();
+	GuByteBuf* lin = gu_new_buf(uint8_t, tmp_pool);
+	while (true) {
+		gu_mutex_lock(batch->mutex);
+		size_t i = batch->next;
+		if (i < n_texts) {
+			batch->next++;
+		}
+		gu_mutex_unlock(batch->mutex);
+		if (i >= n_texts) {
+			break;
+		}
+		GuString text = gu_seq_get(batch->texts, GuString, i);
+		GuShortData short_data;
+		GuCSlice utf8 = gu_string_open(text, &short_data);
+		PgfTranslations trans =
+			pgf_translate_with(batch->tr, utf8, factory, NULL,
+					   lin, w->pool);
+		if (gu_seq_is_null(trans)) {
+			trans = gu_empty_seq();
+		}
+		gu_seq_set(batch->results, PgfTranslations, i, trans);
+	}
+	gu_pool_free(tmp_pool);
+	return NULL;
+}
+
+static size_t
+pgf_batch_default_threads(void)
+{
+#if defined(HAVE_PTHREAD_H) && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0) {
+		return n;
+	}
+#endif
+	return 1;
+}
+
+GuSeq
+pgf_translate_batch(PgfTranslator* tr, GuStrings texts, size_t n_threads,
+		    GuPool* pool)
+{
+	size_t n_texts = gu_seq_length(texts);
+	if (n_threads == 0) {
+		n_threads = pgf_batch_default_threads();
+	}
+#ifndef HAVE_PTHREAD_H
+	n_threads = 1;
+#endif
+	n_threads = GU_MAX(GU_MIN(n_threads, n_texts), 1);
+
+	PgfBatch* batch = gu_new(PgfBatch, pool);
+	batch->tr = tr;
+	batch->texts = texts;
+	batch->results = gu_new_seq(PgfTranslations, n_texts, pool);
+	batch->mutex = gu_new_mutex(pool);
+	batch->next = 0;
+
+	PgfBatchWorker* workers = gu_new_n(PgfBatchWorker, n_threads, pool);
+	for (size_t i = 0; i < n_threads; i++) {
+		PgfBatchWorker* w = &workers[i];
+		w->batch = batch;
+		w->pool = gu_new_pool();
+		w->fin.fn = pgf_batch_worker_finalize;
+		gu_pool_finally(pool, &w->fin);
+	}
+#ifdef HAVE_PTHREAD_H
+	// The calling thread is the first worker.
+	for (size_t i = 1; i < n_threads; i++) {
+		PgfBatchWorker* w = &workers[i];
+		w->started = (pthread_create(&w->thread, NULL,
+					     pgf_batch_worker_run, w) == 0);
+	}
+#endif
+	pgf_batch_worker_run(&workers[0]);
+#ifdef HAVE_PTHREAD_H
+	for (size_t i = 1; i < n_threads; i++) {
+		PgfBatchWorker* w = &workers[i];
+		if (w->started) {
+			int err = pthread_join(w->thread, NULL);
+			gu_assert(err == 0);
+			(void) err;
+		}
+	}
+#endif
+	return batch->results;
+}
@@ -0,0 +1,130 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#ifndef PGF_TRANSLATE_H_
+#define PGF_TRANSLATE_H_
+
+#include <libgu.h>
+#include <pgf/pgf.h>
+#include <pgf/expr.h>
+
+/// Translation of many sentences at once
+/** @file
+ *
+ * A #PgfTranslator bundles the parser, tokenizer and linearizer that are
+ * needed to translate sentences of one category from one concrete grammar
+ * to another. They are built once and only read afterwards, so a single
+ * translator can serve several threads. #pgf_translate_batch uses this to
+ * translate a batch of sentences in parallel.
+ */
+
+/// A translator between two concrete grammars
+typedef struct PgfTranslator PgfTranslator;
+
+/// Create a new translator
+PgfTranslator*
+pgf_new_translator(PgfCat* cat,
+		   PgfConcr* from, PgfCtntId from_ctnt,
+		   PgfConcr* to, PgfCtntId to_ctnt,
+		   GuPool* pool);
+/**<
+ * @param cat The category of the sentences.
+ *
+ * @param from The concrete grammar of the source language.
+ *
+ * @param from_ctnt The constituent of `cat` that is parsed.
+ *
+ * @param to The concrete grammar of the target language.
+ *
+ * @param to_ctnt The constituent of `cat` that is linearized.
+ *
+ * @pool
+ *
+ * @return A new translator.
+ */
+
+/// One translation of a sentence
+typedef struct {
+	PgfExpr expr;
+	/**< The abstract syntax tree of the reading. */
+	GuString lin;
+	/**< The linearization of a concrete syntax tree of `expr`, as
+	 * tokens separated by spaces. */
+} PgfTranslation;
+
+/// The translations of one sentence
+typedef GuSeq PgfTranslations;
+
+/// Translate a single sentence
+PgfTranslations
+pgf_translate(PgfTranslator* tr, GuCSlice text, GuPool* pool);
+/**<
+ * @param text A UTF-8 encoded sentence.
+ *
+ * @pool
+ *
+ * @return All the translations of `text`: for each distinct reading, one
+ * translation for each concrete syntax tree of the reading in the target
+ * grammar. The sequence is empty if `text` cannot be parsed. As with
+ * #pgf_parse_result, the order of the readings is unspecified.
+ *
+ * @note `text` is split into tokens in all possible ways with
+ * #pgf_tokenize_lattice, and the readings of all the segmentations are
+ * returned.
+ */
+
+/// A check that can stop a translation early
+typedef struct PgfTranslateLimit PgfTranslateLimit;
+
+struct PgfTranslateLimit {
+	bool (*fn)(PgfTranslateLimit* self, GuPool* pool);
+	/**< Called after each position of the sentence that the parser
+	 * reaches and after each translation, with the pool in which the
+	 * sentence is parsed. Returns `true` to stop translating. */
+};
+
+/// Translate a single sentence within a limit
+PgfTranslations
+pgf_translate_limited(PgfTranslator* tr, GuCSlice text,
+		      PgfTranslateLimit* limit, GuPool* pool);
+/**<
+ * Like #pgf_translate, but `limit` can stop the translation in the middle,
+ * e.g. when it takes too long or uses too much memory. The parser can't be
+ * interrupted within a single position of the sentence, so a limit is
+ * only checked between steps.
+ *
+ * @param limit The limit, or `NULL` for none.
+ *
+ * @pool
+ *
+ * @return The translations of `text`, or `gu_null_seq` if `text` cannot
+ * be parsed. If `limit` stopped the translation, the translations found
+ * so far.
+ */
+
+/// Translate a batch of sentences in parallel
+GuSeq
+pgf_translate_batch(PgfTranslator* tr, GuStrings texts, size_t n_threads,
+		    GuPool* pool);
+/**<
+ * @param texts The sentences to translate.
+ *
+ * @param n_threads The number of threads to use, including the calling
+ * thread, or 0 to use one thread per online processor. When the library is
+ * built without thread support, everything is done in the calling thread.
+ *
+ * @pool
+ *
+ * @return A sequence of #PgfTranslations with one element for each
+ * element of `texts`, in the same order, as if #pgf_translate had been
+ * called on each sentence in turn.
+ *
+ * The threads take sentences from the batch one at a time, so a thread
+ * that gets short sentences simply translates more of them. Each thread
+ * parses in a pool of its own that is recycled after every sentence, and
+ * builds its results in a separate pool that is freed together with
+ * `pool`. The readings of a thread are hash-consed by a
+ * #PgfExprFactory, so that the trees of the batch share their common
+ * subtrees.
+ */
+
+#endif // PGF_TRANSLATE_H_
@@ -0,0 +1,1018 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#include "data.h"
+#include "expr.h"
+#include "writer.h"
+#include <gu/defs.h>
+#include <gu/map.h>
+#include <gu/seq.h>
+#include <gu/assert.h>
+#include <gu/out.h>
+#include <gu/exn.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// PgfWriter
+//
+
+typedef struct PgfWriter PgfWriter;
+
+struct PgfWriter {
+	GuOut* out;
+	GuExn* err;
+	GuPool* pool;
+	GuTypeMap* write_map;
+	PgfPGF* pgf;
+
+	PgfConcr* curr_concr;
+	/**< The concrete grammar being written. */
+
+	// The numbering of the current concrete grammar.
+	bool curr_as_read;
+	/**< The ccats and the concrete functions are numbered as in the
+	 * file that they were read from, so their fids are their ids. */
+	GuMap* curr_fids;
+	/**< Maps each #PgfCCat to its fid. */
+	GuBuf* curr_ccats;
+	/**< The ccats that may have productions, in the order of their
+	 * fids. */
+	GuMap* curr_ranges;
+	/**< Maps each #PgfCncCat to its #PgfFIdRange. */
+	GuMap* curr_funids;
+	/**< Maps each #PgfCncFun to its index. */
+	GuBuf* curr_cncfuns;
+	GuMap* curr_seqids;
+	/**< Maps the data of each #PgfSequence to its index. */
+	GuBuf* curr_sequences;
+};
+
+typedef struct PgfFIdRange PgfFIdRange;
+
+struct PgfFIdRange {
+	PgfFId first;
+	PgfFId last;
+};
+
+static const PgfFId pgf_writer_no_fid = INT32_MIN;
+static const int pgf_writer_no_id = -1;
+static const PgfFIdRange pgf_writer_no_range = { 0, -1 };
+
+GU_DEFINE_TYPE(PgfWriteExn, abstract, _);
+
+static void
+pgf_write_u8(PgfWriter* wtr, uint8_t u)
+{
+	gu_out_u8(wtr->out, u, wtr->err);
+}
+
+static void
+pgf_write_uint(PgfWriter* wtr, uint32_t u)
+{
+	while (u >= 0x80) {
+		pgf_write_u8(wtr, (uint8_t) (u | 0x80));
+		u >>= 7;
+	}
+	pgf_write_u8(wtr, (uint8_t) u);
+}
+
+static void
+pgf_write_int(PgfWriter* wtr, int32_t i)
+{
+	// The reader decodes the 32-bit two's complement representation.
+	pgf_write_uint(wtr, (uint32_t) i);
+}
+
+static void
+pgf_write_len(PgfWriter* wtr, size_t len)
+{
+	gu_assert(len <= INT32_MAX);
+	pgf_write_int(wtr, (int32_t) len);
+}
+
+typedef const struct PgfWriteFn PgfWriteFn;
+
+struct PgfWriteFn {
+	void (*fn)(GuType* type, PgfWriter* wtr, const void* from);
+};
+
+static void
+pgf_write(PgfWriter* wtr, GuType* type, const void* from)
+{
+	PgfWriteFn* fn = gu_type_map_get(wtr->write_map, type);
+	fn->fn(type, wtr, from);
+}
+
+static void
+pgf_write_struct(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuStructRepr* stype = gu_type_cast(type, struct);
+	const uint8_t* bfrom = from;
+	for (int i = 0; i < stype->members.len; i++) {
+		const GuMember* m = &stype->members.elems[i];
+		pgf_write(wtr, m->type, &bfrom[m->offset]);
+		gu_return_on_exn(wtr->err,);
+	}
+}
+
+static void
+pgf_write_pointer(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuPointerType* ptype = (GuPointerType*) type;
+	pgf_write(wtr, ptype->pointed_type, *(void* const*) from);
+}
+
+static void
+pgf_write_GuVariant(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuVariantType* vtype = (GuVariantType*) type;
+	GuVariantInfo i = gu_variant_open(*(const GuVariant*) from);
+	for (int c = 0; c < vtype->ctors.len; c++) {
+		GuConstructor* ctor = &vtype->ctors.elems[c];
+		if (ctor->c_tag == i.tag) {
+			// The reader takes the tag to be the index of the
+			// constructor.
+			pgf_write_u8(wtr, (uint8_t) c);
+			pgf_write(wtr, ctor->type, i.data);
+			return;
+		}
+	}
+	gu_impossible();
+}
+
+static void
+pgf_write_enum(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuEnumType* etype = (GuEnumType*) type;
+	GuEnumConstant* econ = gu_enum_value(etype, from);
+	gu_assert(econ != NULL);
+	pgf_write_u8(wtr, (uint8_t) (econ - etype->constants.elems));
+}
+
+static void
+pgf_write_void(GuType* type, PgfWriter* wtr, const void* from)
+{
+}
+
+static void
+pgf_write_int32_t(GuType* type, PgfWriter* wtr, const void* from)
+{
+	pgf_write_int(wtr, *(const int32_t*) from);
+}
+
+static void
+pgf_write_uint16_t(GuType* type, PgfWriter* wtr, const void* from)
+{
+	gu_out_u16be(wtr->out, *(const uint16_t*) from, wtr->err);
+}
+
+static void
+pgf_write_double(GuType* type, PgfWriter* wtr, const void* from)
+{
+	gu_out_f64be(wtr->out, *(const double*) from, wtr->err);
+}
+
+static void
+pgf_write_alias(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuTypeAlias* atype = gu_type_cast(type, alias);
+	pgf_write(wtr, atype->type, from);
+}
+
+static void
+pgf_write_string(PgfWriter* wtr, GuString s)
+{
+	GuShortData short_data;
+	GuCSlice utf8 = gu_string_open(s, &short_data);
+	// The length is in code points.
+	size_t len = 0;
+	for (size_t i = 0; i < utf8.sz; i++) {
+		if ((utf8.p[i] & 0xc0) != 0x80) {
+			len++;
+		}
+	}
+	pgf_write_len(wtr, len);
+	gu_out_bytes(wtr->out, utf8, wtr->err);
+}
+
+static void
+pgf_write_cid(PgfWriter* wtr, PgfCId cid)
+{
+	GuShortData short_data;
+	GuCSlice utf8 = gu_string_open(cid, &short_data);
+	uint8_t latin1[utf8.sz > 0 ? utf8.sz : 1];
+	size_t len = 0;
+	for (size_t i = 0; i < utf8.sz; i++) {
+		uint8_t b = utf8.p[i];
+		if (b < 0x80) {
+			latin1[len++] = b;
+		} else if ((b == 0xc2 || b == 0xc3) && i + 1 < utf8.sz) {
+			// CIds are in latin-1
+			latin1[len++] = (uint8_t) ((b & 0x1f) << 6
+						   | (utf8.p[++i] & 0x3f));
+		} else {
+			gu_raise(wtr->err, PgfWriteExn);
+			return;
+		}
+	}
+	pgf_write_len(wtr, len);
+	gu_out_bytes(wtr->out, gu_cslice(latin1, len), wtr->err);
+}
+
+static void
+pgf_write_GuString(GuType* type, PgfWriter* wtr, const void* from)
+{
+	pgf_write_string(wtr, *(const GuString*) from);
+}
+
+static void
+pgf_write_PgfCId(GuType* type, PgfWriter* wtr, const void* from)
+{
+	pgf_write_cid(wtr, *(const PgfCId*) from);
+}
+
+static void
+pgf_write_GuSeq(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuSeqType* stype = gu_type_cast(type, GuSeq);
+	GuSeq seq = *(const GuSeq*) from;
+	size_t len = gu_seq_length(seq);
+	size_t elem_size = gu_type_size(stype->elem_type);
+	const uint8_t* data = gu_seq_data(seq);
+	pgf_write_len(wtr, len);
+	for (size_t i = 0; i < len; i++) {
+		pgf_write(wtr, stype->elem_type, &data[i * elem_size]);
+		gu_return_on_exn(wtr->err,);
+	}
+}
+
+static void
+pgf_write_maybe_seq(GuType* type, PgfWriter* wtr, const void* from)
+{
+	if (gu_seq_is_null(*(const GuSeq*) from)) {
+		pgf_write_u8(wtr, 0);
+	} else {
+		pgf_write_u8(wtr, 1);
+		pgf_write_GuSeq(type, wtr, from);
+	}
+}
+
+// Derived from the reader's context: nothing to write.
+static void
+pgf_write_PgfContext(GuType* type, PgfWriter* wtr, const void* from)
+{
+}
+
+// Written as the key of the enclosing map.
+static void
+pgf_write_PgfKey(GuType* type, PgfWriter* wtr, const void* from)
+{
+}
+
+static void
+pgf_write_PgfCatId(GuType* type, PgfWriter* wtr, const void* from)
+{
+	const PgfCat* cat = from;
+	pgf_write_cid(wtr, cat->cid);
+}
+
+static void
+pgf_write_fid(PgfWriter* wtr, PgfCCat* ccat)
+{
+	PgfFId fid = wtr->curr_as_read
+		? pgf_ccat_fid(ccat)
+		: gu_map_get(wtr->curr_fids, ccat, PgfFId);
+	gu_assert(fid != pgf_writer_no_fid);
+	pgf_write_int(wtr, fid);
+}
+
+static void
+pgf_write_funid(PgfWriter* wtr, PgfCncFun* cncfun)
+{
+	int id = wtr->curr_as_read
+		? pgf_cncfun_fid(cncfun)
+		: gu_map_get(wtr->curr_funids, cncfun, int);
+	gu_assert(id != pgf_writer_no_id);
+	pgf_write_int(wtr, id);
+}
+
+static void
+pgf_write_seqid(PgfWriter* wtr, PgfSequence seq)
+{
+	int id = gu_map_get(wtr->curr_seqids, gu_seq_data(seq), int);
+	gu_assert(id != pgf_writer_no_id);
+	pgf_write_int(wtr, id);
+}
+
+static void
+pgf_write_PgfCCatId(GuType* type, PgfWriter* wtr, const void* from)
+{
+	pgf_write_fid(wtr, *(PgfCCat* const*) from);
+}
+
+static void
+pgf_write_PgfFunId(GuType* type, PgfWriter* wtr, const void* from)
+{
+	pgf_write_funid(wtr, *(PgfCncFun* const*) from);
+}
+
+static void
+pgf_write_PgfSeqId(GuType* type, PgfWriter* wtr, const void* from)
+{
+	pgf_write_seqid(wtr, *(const PgfSeqId*) from);
+}
+
+static void
+pgf_write_PgfCncCat(GuType* type, PgfWriter* wtr, const void* from)
+{
+	PgfCncCat* cnccat = (PgfCncCat*) from;
+	PgfFIdRange range =
+		gu_map_get(wtr->curr_ranges, cnccat, PgfFIdRange);
+	pgf_write_int(wtr, range.first);
+	pgf_write_int(wtr, range.last);
+	pgf_write(wtr, gu_type(GuStrings), &cnccat->ctnts);
+}
+
+//
+// Maps
+//
+
+typedef struct PgfMapEntry PgfMapEntry;
+
+struct PgfMapEntry {
+	const void* key;
+	void* value;
+};
+
+typedef struct {
+	GuMapItor fn;
+	GuBuf* entries;
+} PgfCollectEntriesFn;
+
+static void
+pgf_collect_entry_cb(GuMapItor* fn, const void* key, void* value,
+		     GuExn* err)
+{
+	PgfCollectEntriesFn* clo = (PgfCollectEntriesFn*) fn;
+	PgfMapEntry entry = { key, value };
+	gu_buf_push(clo->entries, PgfMapEntry, entry);
+}
+
+static int
+pgf_string_cmp(GuString str1, GuString str2)
+{
+	// Comparing UTF-8 bytewise orders the strings by code points,
+	// which is also the order of the latin-1 bytes of CIds.
+	GuShortData short1, short2;
+	GuCSlice s1 = gu_string_open(str1, &short1);
+	GuCSlice s2 = gu_string_open(str2, &short2);
+	int cmp = memcmp(s1.p, s2.p, GU_MIN(s1.sz, s2.sz));
+	if (cmp == 0) {
+		cmp = (s1.sz > s2.sz) - (s1.sz < s2.sz);
+	}
+	return cmp;
+}
+
+static int
+pgf_string_key_cmp(const void* p1, const void* p2)
+{
+	const PgfMapEntry* e1 = p1;
+	const PgfMapEntry* e2 = p2;
+	return pgf_string_cmp(*(const GuString*) e1->key,
+			      *(const GuString*) e2->key);
+}
+
+static int
+pgf_int32_key_cmp(const void* p1, const void* p2)
+{
+	int32_t i1 = *(const int32_t*) ((const PgfMapEntry*) p1)->key;
+	int32_t i2 = *(const int32_t*) ((const PgfMapEntry*) p2)->key;
+	return (i1 > i2) - (i1 < i2);
+}
+
+static int
+pgf_cat_key_cmp(const void* p1, const void* p2)
+{
+	const PgfCat* cat1 = ((const PgfMapEntry*) p1)->key;
+	const PgfCat* cat2 = ((const PgfMapEntry*) p2)->key;
+	return pgf_string_cmp(cat1->cid, cat2->cid);
+}
+
+typedef int (*PgfMapEntryCmp)(const void* p1, const void* p2);
+
+static PgfMapEntryCmp
+pgf_map_key_cmp(GuMapType* mtype)
+{
+	if (gu_type_has_kind(mtype->key_type, gu_kind(GuString))) {
+		return pgf_string_key_cmp;
+	} else if (gu_type_has_kind(mtype->key_type, gu_kind(int32_t))) {
+		return pgf_int32_key_cmp;
+	} else if (gu_type_has_kind(mtype->key_type, gu_kind(PgfCatId))) {
+		return pgf_cat_key_cmp;
+	}
+	return NULL;
+}
+
+// Get the entries of `map` in the order in which they are written.
+static GuBuf*
+pgf_map_entries(GuMap* map, PgfMapEntryCmp cmp, GuPool* pool)
+{
+	GuBuf* entries = gu_new_buf(PgfMapEntry, pool);
+	PgfCollectEntriesFn clo = { { pgf_collect_entry_cb }, entries };
+	gu_map_iter(map, &clo.fn, gu_null_exn());
+	if (cmp != NULL && gu_buf_length(entries) > 1) {
+		qsort(gu_buf_data(entries), gu_buf_length(entries),
+		      sizeof(PgfMapEntry), cmp);
+	}
+	return entries;
+}
+
+static void
+pgf_write_GuMap(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuMapType* mtype = (GuMapType*) type;
+	GuPool* tmp_pool = gu_new_pool();
+	GuBuf* entries = pgf_map_entries((GuMap*) from,
+					 pgf_map_key_cmp(mtype), tmp_pool);
+	size_t n_entries = gu_buf_length(entries);
+	pgf_write_len(wtr, n_entries);
+	for (size_t i = 0; i < n_entries && gu_ok(wtr->err); i++) {
+		PgfMapEntry* entry = gu_buf_index(entries, PgfMapEntry, i);
+		pgf_write(wtr, mtype->key_type, entry->key);
+		pgf_write(wtr, mtype->value_type, entry->value);
+	}
+	gu_pool_free(tmp_pool);
+}
+
+//
+// Abstract grammars
+//
+
+// The categories that the reader has made up for the concrete grammars
+// were not in the abstract syntax of the file.
+static void
+pgf_write_cats(PgfWriter* wtr, GuMap* cats)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	GuBuf* entries = pgf_map_entries(cats, pgf_string_key_cmp, tmp_pool);
+	GuMap* implicit_cats = wtr->pgf->implicit_cats;
+	size_t n_entries = gu_buf_length(entries);
+	size_t n_written = 0;
+	for (size_t i = 0; i < n_entries; i++) {
+		PgfMapEntry* entry = gu_buf_index(entries, PgfMapEntry, i);
+		PgfCat* cat = *(PgfCat**) entry->value;
+		if (implicit_cats == NULL || !gu_map_has(implicit_cats, cat)) {
+			*gu_buf_index(entries, PgfMapEntry, n_written++) =
+				*entry;
+		}
+	}
+	pgf_write_len(wtr, n_written);
+	for (size_t i = 0; i < n_written && gu_ok(wtr->err); i++) {
+		PgfMapEntry* entry = gu_buf_index(entries, PgfMapEntry, i);
+		pgf_write_cid(wtr, *(const PgfCId*) entry->key);
+		pgf_write(wtr, gu_type(PgfCat), *(PgfCat**) entry->value);
+	}
+	gu_pool_free(tmp_pool);
+}
+
+static void
+pgf_write_PgfAbstr(GuType* type, PgfWriter* wtr, const void* from)
+{
+	GuStructRepr* stype = gu_type_cast(type, struct);
+	const PgfAbstr* abstr = from;
+	const uint8_t* bfrom = from;
+	for (int i = 0; i < stype->members.len; i++) {
+		const GuMember* m = &stype->members.elems[i];
+		if (m->offset == offsetof(PgfAbstr, cats)) {
+			pgf_write_cats(wtr, abstr->cats);
+		} else {
+			pgf_write(wtr, m->type, &bfrom[m->offset]);
+		}
+		gu_return_on_exn(wtr->err,);
+	}
+}
+
+//
+// Concrete grammars
+//
+
+// The sequences and productions are most of a grammar, so they are
+// written directly instead of through the type table.
+
+static void
+pgf_write_strings(PgfWriter* wtr, GuStrings strs)
+{
+	size_t n_strs = gu_seq_length(strs);
+	GuString* data = gu_seq_data(strs);
+	pgf_write_len(wtr, n_strs);
+	for (size_t i = 0; i < n_strs; i++) {
+		pgf_write_string(wtr, data[i]);
+	}
+}
+
+static void
+pgf_write_symbol(PgfWriter* wtr, PgfSymbol sym)
+{
+	PgfSymbolTag tag = pgf_symbol_tag(sym);
+	// The tags are also the indices of the constructors.
+	pgf_write_u8(wtr, (uint8_t) tag);
+	switch (tag) {
+	case PGF_SYMBOL_CAT:
+	case PGF_SYMBOL_LIT:
+	case PGF_SYMBOL_VAR: {
+		pgf_write_int(wtr, pgf_symbol_d(sym));
+		pgf_write_int(wtr, pgf_symbol_r(sym));
+		break;
+	}
+	case PGF_SYMBOL_KS: {
+		PgfSymbolKS* sks = pgf_symbol_ks(wtr->curr_concr, sym);
+		pgf_write_strings(wtr, sks->tokens);
+		break;
+	}
+	case PGF_SYMBOL_KP: {
+		PgfSymbolKP* skp = pgf_symbol_kp(wtr->curr_concr, sym);
+		pgf_write_strings(wtr, skp->default_form);
+		size_t n_alts = gu_seq_length(skp->alts);
+		pgf_write_len(wtr, n_alts);
+		for (size_t j = 0; j < n_alts; j++) {
+			PgfAlternative* alt =
+				gu_seq_index(skp->alts, PgfAlternative, j);
+			pgf_write_strings(wtr, alt->form);
+			pgf_write_strings(wtr, alt->prefixes);
+		}
+		break;
+	}
+	default:
+		gu_impossible();
+	}
+}
+
+static void
+pgf_write_PgfSymbol(GuType* type, PgfWriter* wtr, const void* from)
+{
+	pgf_write_symbol(wtr, *(const PgfSymbol*) from);
+}
+
+static void
+pgf_write_sequence(PgfWriter* wtr, PgfSequence seq)
+{
+	size_t n_syms = gu_seq_length(seq);
+	PgfSymbol* syms = gu_seq_data(seq);
+	pgf_write_len(wtr, n_syms);
+	for (size_t i = 0; i < n_syms; i++) {
+		pgf_write_symbol(wtr, syms[i]);
+	}
+}
+
+static void
+pgf_write_cncfun(PgfWriter* wtr, PgfCncFun* cncfun)
+{
+	pgf_write_cid(wtr, cncfun->fun);
+	size_t n_lins = gu_seq_length(cncfun->lins);
+	PgfSeqId* lins = gu_seq_data(cncfun->lins);
+	pgf_write_len(wtr, n_lins);
+	for (size_t i = 0; i < n_lins; i++) {
+		pgf_write_seqid(wtr, lins[i]);
+	}
+}
+
+static void
+pgf_write_funids(PgfWriter* wtr, PgfFunIds funids)
+{
+	size_t n_funids = gu_seq_length(funids);
+	PgfFunId* data = gu_seq_data(funids);
+	pgf_write_len(wtr, n_funids);
+	for (size_t i = 0; i < n_funids; i++) {
+		pgf_write_funid(wtr, data[i]);
+	}
+}
+
+static void
+pgf_write_production(PgfWriter* wtr, PgfProduction prod)
+{
+	GuVariantInfo i = gu_variant_open(prod);
+	// The tags are also the indices of the constructors.
+	pgf_write_u8(wtr, (uint8_t) i.tag);
+	switch (i.tag) {
+	case PGF_PRODUCTION_APPLY: {
+		PgfProductionApply* papp = i.data;
+		pgf_write_funid(wtr, papp->fun);
+		size_t n_args = gu_seq_length(papp->args);
+		pgf_write_len(wtr, n_args);
+		for (size_t j = 0; j < n_args; j++) {
+			PgfPArg* parg = gu_seq_index(papp->args, PgfPArg, j);
+			size_t n_hypos = gu_seq_length(parg->hypos);
+			pgf_write_len(wtr, n_hypos);
+			for (size_t h = 0; h < n_hypos; h++) {
+				pgf_write_fid(wtr, gu_seq_get(parg->hypos,
+							      PgfCCatId, h));
+			}
+			pgf_write_fid(wtr, parg->ccat);
+		}
+		break;
+	}
+	case PGF_PRODUCTION_COERCE: {
+		PgfProductionCoerce* pcoerce = i.data;
+		pgf_write_fid(wtr, pcoerce->coerce);
+		break;
+	}
+	default:
+		gu_impossible();
+	}
+}
+
+static bool
+pgf_writer_is_literal(PgfCCat* ccat)
+{
+	// The reader creates a ccat without productions for each literal
+	// category (String, Int, Float, Var) that is used as an argument.
+	return gu_seq_is_null(ccat->prods) && pgf_ccat_fid(ccat) < 0;
+}
+
+static void
+pgf_writer_add_ccat(PgfWriter* wtr, PgfCCat* ccat)
+{
+	PgfFId* fidp = gu_map_insert(wtr->curr_fids, ccat);
+	if (*fidp != pgf_writer_no_fid) {
+		return;
+	}
+	if (pgf_writer_is_literal(ccat)) {
+		*fidp = pgf_ccat_fid(ccat);
+		return;
+	}
+	*fidp = (PgfFId) gu_buf_length(wtr->curr_ccats);
+	gu_buf_push(wtr->curr_ccats, PgfCCat*, ccat);
+}
+
+static void
+pgf_writer_add_cncfun(PgfWriter* wtr, PgfCncFun* cncfun)
+{
+	int* idp = gu_map_insert(wtr->curr_funids, cncfun);
+	if (*idp != pgf_writer_no_id) {
+		return;
+	}
+	*idp = (int) gu_buf_length(wtr->curr_cncfuns);
+	gu_buf_push(wtr->curr_cncfuns, PgfCncFun*, cncfun);
+}
+
+static void
+pgf_writer_add_sequence(PgfWriter* wtr, PgfSequence seq)
+{
+	int* idp = gu_map_insert(wtr->curr_seqids, gu_seq_data(seq));
+	if (*idp != pgf_writer_no_id) {
+		return;
+	}
+	*idp = (int) gu_buf_length(wtr->curr_sequences);
+	gu_buf_push(wtr->curr_sequences, PgfSequence, seq);
+}
+
+// Number the ccats that are reachable from the productions of the ccats
+// from index `i` onwards, including those that get numbered in the
+// process.
+static void
+pgf_writer_add_reachable(PgfWriter* wtr, size_t i)
+{
+	for (; i < gu_buf_length(wtr->curr_ccats); i++) {
+		PgfCCat* ccat = gu_buf_get(wtr->curr_ccats, PgfCCat*, i);
+		size_t n_prods = pgf_ccat_n_prods(ccat);
+		for (size_t j = 0; j < n_prods; j++) {
+			PgfProduction prod =
+				gu_seq_get(ccat->prods, PgfProduction, j);
+			GuVariantInfo pi = gu_variant_open(prod);
+			switch (pi.tag) {
+			case PGF_PRODUCTION_APPLY: {
+				PgfProductionApply* papp = pi.data;
+				size_t n_args = gu_seq_length(papp->args);
+				for (size_t k = 0; k < n_args; k++) {
+					PgfPArg* parg = gu_seq_index(
+						papp->args, PgfPArg, k);
+					size_t n_hypos =
+						gu_seq_length(parg->hypos);
+					for (size_t h = 0; h < n_hypos; h++) {
+						pgf_writer_add_ccat(
+							wtr, gu_seq_get(
+								parg->hypos,
+								PgfCCatId, h));
+					}
+					pgf_writer_add_ccat(wtr, parg->ccat);
+				}
+				break;
+			}
+			case PGF_PRODUCTION_COERCE: {
+				PgfProductionCoerce* pcoerce = pi.data;
+				pgf_writer_add_ccat(wtr, pcoerce->coerce);
+				break;
+			}
+			default:
+				gu_impossible();
+			}
+		}
+	}
+}
+
+static void
+pgf_writer_new_numbering(PgfWriter* wtr)
+{
+	GuPool* pool = wtr->pool;
+	wtr->curr_as_read = false;
+	wtr->curr_fids = gu_new_addr_map(PgfCCat, PgfFId,
+					 &pgf_writer_no_fid, pool);
+	wtr->curr_ccats = gu_new_buf(PgfCCat*, pool);
+	wtr->curr_ranges = gu_new_addr_map(PgfCncCat, PgfFIdRange,
+					   &pgf_writer_no_range, pool);
+	wtr->curr_funids = gu_new_addr_map(PgfCncFun, int,
+					   &pgf_writer_no_id, pool);
+	wtr->curr_cncfuns = gu_new_buf(PgfCncFun*, pool);
+	wtr->curr_seqids = gu_new_addr_map(void, int,
+					   &pgf_writer_no_id, pool);
+	wtr->curr_sequences = gu_new_buf(PgfSequence, pool);
+}
+
+// Number the ccats, functions and sequences of `concr` anew.
+static void
+pgf_writer_number_concr(PgfWriter* wtr, PgfConcr* concr, GuBuf* cnccats)
+{
+	pgf_writer_new_numbering(wtr);
+
+	// The ccats of each concrete category get a contiguous range of
+	// fids. Entries that belong to some other category are dropped.
+	size_t n_cnccats = gu_buf_length(cnccats);
+	for (size_t i = 0; i < n_cnccats; i++) {
+		PgfMapEntry* entry = gu_buf_index(cnccats, PgfMapEntry, i);
+		PgfCncCat* cnccat = *(PgfCncCat**) entry->value;
+		size_t n_cats = gu_seq_length(cnccat->cats);
+		PgfCCat* ccat0 = n_cats > 0
+			? gu_seq_get(cnccat->cats, PgfCCatId, 0) : NULL;
+		PgfFIdRange range;
+		if (ccat0 != NULL && pgf_writer_is_literal(ccat0)) {
+			// The concrete category of a literal category
+			// keeps its fid.
+			pgf_writer_add_ccat(wtr, ccat0);
+			range.first = range.last = pgf_ccat_fid(ccat0);
+			gu_map_put(wtr->curr_ranges, cnccat, PgfFIdRange, range);
+			continue;
+		}
+		range.first = (PgfFId) gu_buf_length(wtr->curr_ccats);
+		for (size_t j = 0; j < n_cats; j++) {
+			PgfCCat* ccat = gu_seq_get(cnccat->cats, PgfCCatId, j);
+			if (ccat != NULL && ccat->cnccat == cnccat) {
+				pgf_writer_add_ccat(wtr, ccat);
+			}
+		}
+		range.last = (PgfFId) gu_buf_length(wtr->curr_ccats) - 1;
+		gu_map_put(wtr->curr_ranges, cnccat, PgfFIdRange, range);
+	}
+	pgf_writer_add_reachable(wtr, 0);
+	size_t n_extras = gu_seq_length(concr->extra_ccats);
+	for (size_t i = 0; i < n_extras; i++) {
+		size_t n_ccats = gu_buf_length(wtr->curr_ccats);
+		PgfCCat* ccat = gu_seq_get(concr->extra_ccats, PgfCCatId, i);
+		pgf_writer_add_ccat(wtr, ccat);
+		pgf_writer_add_reachable(wtr, n_ccats);
+	}
+
+	size_t n_ccats = gu_buf_length(wtr->curr_ccats);
+	for (size_t i = 0; i < n_ccats; i++) {
+		PgfCCat* ccat = gu_buf_get(wtr->curr_ccats, PgfCCat*, i);
+		size_t n_prods = pgf_ccat_n_prods(ccat);
+		for (size_t j = 0; j < n_prods; j++) {
+			PgfProduction prod =
+				gu_seq_get(ccat->prods, PgfProduction, j);
+			GuVariantInfo pi = gu_variant_open(prod);
+			if (pi.tag == PGF_PRODUCTION_APPLY) {
+				PgfProductionApply* papp = pi.data;
+				pgf_writer_add_cncfun(wtr, papp->fun);
+			}
+		}
+	}
+	for (size_t i = 0; i < n_cnccats; i++) {
+		PgfMapEntry* entry = gu_buf_index(cnccats, PgfMapEntry, i);
+		PgfCncCat* cnccat = *(PgfCncCat**) entry->value;
+		size_t n_lindefs = gu_seq_is_null(cnccat->lindefs)
+			? 0 : gu_seq_length(cnccat->lindefs);
+		for (size_t j = 0; j < n_lindefs; j++) {
+			pgf_writer_add_cncfun(
+				wtr, gu_seq_get(cnccat->lindefs, PgfFunId, j));
+		}
+	}
+
+	size_t n_cncfuns = gu_buf_length(wtr->curr_cncfuns);
+	for (size_t i = 0; i < n_cncfuns; i++) {
+		PgfCncFun* cncfun = gu_buf_get(wtr->curr_cncfuns, PgfCncFun*, i);
+		size_t n_lins = gu_seq_length(cncfun->lins);
+		for (size_t j = 0; j < n_lins; j++) {
+			pgf_writer_add_sequence(
+				wtr, gu_seq_get(cncfun->lins, PgfSeqId, j));
+		}
+	}
+}
+
+// Number the ccats, functions and sequences of `concr` as in the file
+// that it was read from.
+static void
+pgf_writer_layout_concr(PgfWriter* wtr, PgfConcr* concr, GuBuf* cnccats)
+{
+	PgfConcrLayout* layout = concr->layout;
+	pgf_writer_new_numbering(wtr);
+	// The reader has stored the fids of the ccats and the indices of
+	// the concrete functions in them.
+	wtr->curr_as_read = true;
+
+	GuBuf* ccats = pgf_map_entries(layout->ccats, pgf_int32_key_cmp,
+				       wtr->pool);
+	size_t n_ccats = gu_buf_length(ccats);
+	for (size_t i = 0; i < n_ccats; i++) {
+		PgfMapEntry* entry = gu_buf_index(ccats, PgfMapEntry, i);
+		PgfCCat* ccat = *(PgfCCat**) entry->value;
+		gu_assert(pgf_ccat_fid(ccat) == *(const PgfFId*) entry->key);
+		gu_buf_push(wtr->curr_ccats, PgfCCat*, ccat);
+	}
+
+	size_t n_cnccats = gu_buf_length(cnccats);
+	for (size_t i = 0; i < n_cnccats; i++) {
+		PgfMapEntry* entry = gu_buf_index(cnccats, PgfMapEntry, i);
+		PgfCncCat* cnccat = *(PgfCncCat**) entry->value;
+		PgfFIdRange range;
+		range.first = gu_map_get(layout->firsts, cnccat, PgfFId);
+		range.last = range.first
+			+ (PgfFId) gu_seq_length(cnccat->cats) - 1;
+		gu_map_put(wtr->curr_ranges, cnccat, PgfFIdRange, range);
+	}
+
+	// Every function and sequence of the file is written, even if
+	// an equal one comes earlier.
+	size_t n_cncfuns = gu_seq_length(layout->cncfuns);
+	for (size_t i = 0; i < n_cncfuns; i++) {
+		PgfCncFun* cncfun = gu_seq_get(layout->cncfuns, PgfCncFun*, i);
+		gu_buf_push(wtr->curr_cncfuns, PgfCncFun*, cncfun);
+	}
+	size_t n_sequences = gu_seq_length(layout->sequences);
+	for (size_t i = 0; i < n_sequences; i++) {
+		PgfSequence seq = gu_seq_get(layout->sequences, PgfSequence, i);
+		// Empty sequences share their data, so the first one of
+		// them gets their id.
+		int* idp = gu_map_insert(wtr->curr_seqids, gu_seq_data(seq));
+		if (*idp == pgf_writer_no_id) {
+			*idp = (int) i;
+		}
+		gu_buf_push(wtr->curr_sequences, PgfSequence, seq);
+	}
+}
+
+static void
+pgf_write_PgfConcr(GuType* type, PgfWriter* wtr, const void* from)
+{
+	PgfConcr* concr = (PgfConcr*) from;
+	wtr->curr_concr = concr;
+	GuPool* tmp_pool = gu_new_pool();
+	GuPool* old_pool = wtr->pool;
+	wtr->pool = tmp_pool;
+	GuMapType* cnccats_t = gu_type_cast(gu_type(PgfCncCatMap), GuMap);
+	GuBuf* cnccats = pgf_map_entries(concr->cnccats,
+					 pgf_map_key_cmp(cnccats_t), tmp_pool);
+	PgfConcrLayout* layout = concr->layout;
+	if (layout != NULL) {
+		pgf_writer_layout_concr(wtr, concr, cnccats);
+	} else {
+		pgf_writer_number_concr(wtr, concr, cnccats);
+	}
+
+	pgf_write(wtr, gu_type(PgfFlags), concr->cflags);
+	pgf_write(wtr, gu_type(PgfPrintNames), concr->printnames);
+
+	size_t n_sequences = gu_buf_length(wtr->curr_sequences);
+	pgf_write_len(wtr, n_sequences);
+	for (size_t i = 0; i < n_sequences && gu_ok(wtr->err); i++) {
+		pgf_write_sequence(wtr, gu_buf_get(wtr->curr_sequences,
+						   PgfSequence, i));
+	}
+
+	size_t n_cncfuns = gu_buf_length(wtr->curr_cncfuns);
+	pgf_write_len(wtr, n_cncfuns);
+	for (size_t i = 0; i < n_cncfuns && gu_ok(wtr->err); i++) {
+		pgf_write_cncfun(wtr, gu_buf_get(wtr->curr_cncfuns,
+						 PgfCncFun*, i));
+	}
+
+	size_t n_cnccats = gu_buf_length(cnccats);
+	if (layout != NULL) {
+		GuBuf* lindefs = pgf_map_entries(layout->lindefs,
+						 pgf_int32_key_cmp, tmp_pool);
+		size_t n_lindefs = gu_buf_length(lindefs);
+		pgf_write_len(wtr, n_lindefs);
+		for (size_t i = 0; i < n_lindefs && gu_ok(wtr->err); i++) {
+			PgfMapEntry* entry =
+				gu_buf_index(lindefs, PgfMapEntry, i);
+			pgf_write_int(wtr, *(const PgfFId*) entry->key);
+			pgf_write_funids(wtr, *(PgfFunIds*) entry->value);
+		}
+	} else {
+		// Lindefs are keyed by the first fid of their category, so
+		// the lindefs of a category without ccats can't be written.
+		size_t n_lindefs = 0;
+		for (size_t i = 0; i < n_cnccats; i++) {
+			PgfMapEntry* entry =
+				gu_buf_index(cnccats, PgfMapEntry, i);
+			PgfCncCat* cnccat = *(PgfCncCat**) entry->value;
+			PgfFIdRange range = gu_map_get(wtr->curr_ranges,
+						       cnccat, PgfFIdRange);
+			if (!gu_seq_is_null(cnccat->lindefs)
+			    && range.first <= range.last) {
+				n_lindefs++;
+			}
+		}
+		pgf_write_len(wtr, n_lindefs);
+		for (size_t i = 0; i < n_cnccats && gu_ok(wtr->err); i++) {
+			PgfMapEntry* entry =
+				gu_buf_index(cnccats, PgfMapEntry, i);
+			PgfCncCat* cnccat = *(PgfCncCat**) entry->value;
+			PgfFIdRange range = gu_map_get(wtr->curr_ranges,
+						       cnccat, PgfFIdRange);
+			if (!gu_seq_is_null(cnccat->lindefs)
+			    && range.first <= range.last) {
+				pgf_write_int(wtr, range.first);
+				pgf_write_funids(wtr, cnccat->lindefs);
+			}
+		}
+	}
+
+	// Ccats without productions are not in the map. The reader
+	// recreates them when they are referred to.
+	size_t n_ccats = gu_buf_length(wtr->curr_ccats);
+	size_t n_written = 0;
+	for (size_t i = 0; i < n_ccats; i++) {
+		PgfCCat* ccat = gu_buf_get(wtr->curr_ccats, PgfCCat*, i);
+		if (!gu_seq_is_null(ccat->prods)) {
+			n_written++;
+		}
+	}
+	pgf_write_len(wtr, n_written);
+	for (size_t i = 0; i < n_ccats && gu_ok(wtr->err); i++) {
+		PgfCCat* ccat = gu_buf_get(wtr->curr_ccats, PgfCCat*, i);
+		if (!gu_seq_is_null(ccat->prods)) {
+			pgf_write_fid(wtr, ccat);
+			size_t n_prods = gu_seq_length(ccat->prods);
+			PgfProduction* prods = gu_seq_data(ccat->prods);
+			pgf_write_len(wtr, n_prods);
+			for (size_t j = 0; j < n_prods; j++) {
+				pgf_write_production(wtr, prods[j]);
+			}
+		}
+	}
+
+	pgf_write(wtr, gu_type(PgfCncCatMap), concr->cnccats);
+	pgf_write_int(wtr, layout != NULL
+		      ? layout->totalcats : (int32_t) n_ccats);
+
+	wtr->pool = old_pool;
+	gu_pool_free(tmp_pool);
+}
+
+#define PGF_WRITE_FN(k_, fn_)					\
+	{ gu_kind(k_), (void*) &(PgfWriteFn){ fn_ } }
+
+#define PGF_WRITE(k_)				\
+	PGF_WRITE_FN(k_, pgf_write_##k_)
+
+static GuTypeTable
+pgf_write_table = GU_TYPETABLE(
+	GU_SLIST_0,
+	PGF_WRITE(struct),
+	PGF_WRITE(GuVariant),
+	PGF_WRITE(enum),
+	PGF_WRITE(void),
+	PGF_WRITE(int32_t),
+	PGF_WRITE_FN(int, pgf_write_int32_t),
+	PGF_WRITE(uint16_t),
+	PGF_WRITE(PgfCId),
+	PGF_WRITE(GuString),
+	PGF_WRITE(double),
+	PGF_WRITE(pointer),
+	PGF_WRITE_FN(PgfEquationsM, pgf_write_maybe_seq),
+	PGF_WRITE(GuSeq),
+	PGF_WRITE(GuMap),
+	PGF_WRITE(PgfCCatId),
+	PGF_WRITE(PgfSeqId),
+	PGF_WRITE(PgfFunId),
+	PGF_WRITE(PgfContext),
+	PGF_WRITE(PgfKey),
+	PGF_WRITE(PgfSymbol),
+	PGF_WRITE(alias),
+	PGF_WRITE(PgfCatId),
+	PGF_WRITE(PgfCncCat),
+	PGF_WRITE(PgfAbstr),
+	PGF_WRITE(PgfConcr));
+
+void
+pgf_write_pgf(PgfPGF* pgf, GuOut* out, GuExn* err)
+{
+	GuPool* pool = gu_new_pool();
+	PgfWriter* wtr = gu_new(PgfWriter, pool);
+	wtr->out = out;
+	wtr->err = err;
+	wtr->pool = pool;
+	wtr->write_map = gu_new_type_map(&pgf_write_table, pool);
+	wtr->pgf = pgf;
+	pgf_write(wtr, gu_type(PgfPGF), pgf);
+	gu_pool_free(pool);
+}
@@ -0,0 +1,40 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#ifndef PGF_WRITER_H_
+#define PGF_WRITER_H_
+
+#include <gu/out.h>
+#include <pgf/pgf.h>
+
+/** @file
+ * Writing PGF grammars.
+ */
+
+void
+pgf_write_pgf(PgfPGF* pgf, GuOut* out, GuExn* err);
+
+/**< Write a grammar in the binary PGF format.
+ *
+ * The output can be read back with #pgf_read_pgf. Maps are written in
+ * the order of their keys, as GF writes them.
+ *
+ * A concrete grammar that was read with #pgf_read_pgf_keep_layout and
+ * has not been changed since is numbered as in its file, so a grammar
+ * written by GF is written back byte for byte, including the parts that
+ * the reader doesn't use. Otherwise, e.g. after #pgf_optimize, the
+ * categories, functions and sequences are numbered anew, densely and in
+ * the order in which they are reached from the concrete categories, and
+ * only the parts that the reader has kept are written. In both cases the
+ * output depends only on the contents of `pgf`.
+ *
+ * @param pgf  The grammar to write.
+ *
+ * @param out  The output stream. It is not flushed.
+ *
+ * @param[out] err  Current exception frame.
+ *
+ * @throws PgfWriteExn if an identifier contains a character that cannot
+ * be represented in latin-1.
+ */
+
+#endif // PGF_WRITER_H_
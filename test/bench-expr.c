@@ -0,0 +1,207 @@
+// Throughput of reading and printing abstract syntax trees as text.
+//
+// Usage: bench-expr [N_TREES]
+//
+// Generates a treebank of random trees, and then compares
+// pgf_read_expr/pgf_expr_print, which go through GuReader and GuWriter,
+// with pgf_expr_scan/pgf_expr_push_utf8, which work on contiguous UTF-8
+// bytes, and with the binary encoding of pgf/codec.h. The treebank is
+// deterministic, so runs are comparable.
+
+#include <libpgf.h>
+#include <pgf/data.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define N_FUNS 400
+#define MAX_ARITY 3
+#define MAX_DEPTH 6
+
+static uint32_t bench_seed = 12345;
+
+static uint32_t
+bench_rand(void)
+{
+	bench_seed = bench_seed * 1103515245 + 12345;
+	return (bench_seed >> 16) & 0x7fff;
+}
+
+static PgfExpr
+bench_gen(GuString* funs, int depth, GuPool* pool)
+{
+	int fun = bench_rand() % N_FUNS;
+	int arity = depth < MAX_DEPTH ? fun % (MAX_ARITY + 1) : 0;
+	PgfExpr expr = gu_new_variant_i(pool, PGF_EXPR_FUN, PgfExprFun,
+					funs[fun]);
+	for (int i = 0; i < arity; i++) {
+		PgfExpr arg = bench_gen(funs, depth + 1, pool);
+		expr = gu_new_variant_i(pool, PGF_EXPR_APP, PgfExprApp,
+					expr, arg);
+	}
+	return expr;
+}
+
+static double
+bench_secs(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void
+bench_report(const char* what, size_t n_trees, size_t n_bytes, double secs)
+{
+	printf("%-24s %8.3f s %10.0f trees/s %8.1f MB/s\n", what, secs,
+	       n_trees / secs, n_bytes / secs / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t n_trees = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+	GuPool* pool = gu_new_pool();
+	GuExn* err = gu_new_exn(NULL, gu_kind(type), pool);
+
+	GuString funs[N_FUNS];
+	for (int i = 0; i < N_FUNS; i++) {
+		funs[i] = gu_format_string(pool, i % 2 ? "Fun%d" : "mk_Word%d_N",
+					   i);
+	}
+	PgfExprs trees = gu_new_seq(PgfExpr, n_trees, pool);
+	for (size_t i = 0; i < n_trees; i++) {
+		gu_seq_set(trees, PgfExpr, i, bench_gen(funs, 0, pool));
+	}
+
+	// Printing
+	clock_t start = clock();
+	GuStringBuf* sbuf = gu_string_buf(pool);
+	GuWriter* wtr = gu_string_buf_writer(sbuf);
+	for (size_t i = 0; i < n_trees; i++) {
+		pgf_expr_print(gu_seq_get(trees, PgfExpr, i), wtr, err);
+		gu_puts(";\n", wtr, err);
+	}
+	GuString printed = gu_string_buf_freeze(sbuf, pool);
+	double print_secs = bench_secs(start);
+
+	start = clock();
+	GuByteBuf* text = gu_new_buf(uint8_t, pool);
+	for (size_t i = 0; i < n_trees; i++) {
+		pgf_expr_push_utf8(gu_seq_get(trees, PgfExpr, i), text);
+		gu_buf_push_n(text, ";\n", 2);
+	}
+	double push_secs = bench_secs(start);
+
+	size_t n_bytes = gu_buf_length(text);
+	GuCSlice bytes = gu_cslice(gu_buf_data(text), n_bytes);
+	GuByteBuf* printed_bytes = gu_new_buf(uint8_t, pool);
+	gu_string_push_utf8(printed, printed_bytes);
+	if (gu_buf_length(printed_bytes) != n_bytes
+	    || memcmp(gu_buf_data(printed_bytes), bytes.p, n_bytes) != 0) {
+		fprintf(stderr, "printers disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_report("pgf_expr_print", n_trees, n_bytes, print_secs);
+	bench_report("pgf_expr_push_utf8", n_trees, n_bytes, push_secs);
+
+	// Reading
+	GuPool* read_pool = gu_new_pool();
+	start = clock();
+	GuIn* in = gu_data_in(bytes, read_pool);
+	GuReader* rdr = gu_new_utf8_reader(in, read_pool);
+	size_t n_read = 0;
+	while (!gu_variant_is_null(pgf_read_expr(rdr, read_pool, err))) {
+		n_read++;
+	}
+	double read_secs = bench_secs(start);
+	gu_pool_free(read_pool);
+
+	read_pool = gu_new_pool();
+	start = clock();
+	GuCSlice rest = bytes;
+	PgfExprs scanned = gu_new_seq(PgfExpr, n_trees, read_pool);
+	size_t n_scanned = 0;
+	while (n_scanned < n_trees) {
+		PgfExpr expr = pgf_expr_scan(&rest, NULL, read_pool, err);
+		if (gu_variant_is_null(expr)) {
+			break;
+		}
+		gu_seq_set(scanned, PgfExpr, n_scanned++, expr);
+	}
+	double scan_secs = bench_secs(start);
+
+	if (!gu_ok(err) || n_read != n_trees || n_scanned != n_trees) {
+		fprintf(stderr, "readers failed\n");
+		return EXIT_FAILURE;
+	}
+	GuByteBuf* reprinted = gu_new_buf(uint8_t, read_pool);
+	for (size_t i = 0; i < n_trees; i++) {
+		pgf_expr_push_utf8(gu_seq_get(scanned, PgfExpr, i), reprinted);
+		gu_buf_push_n(reprinted, ";\n", 2);
+	}
+	if (gu_buf_length(reprinted) != n_bytes
+	    || memcmp(gu_buf_data(reprinted), bytes.p, n_bytes) != 0) {
+		fprintf(stderr, "scanned trees differ\n");
+		return EXIT_FAILURE;
+	}
+	gu_pool_free(read_pool);
+
+	bench_report("pgf_read_expr", n_trees, n_bytes, read_secs);
+	bench_report("pgf_expr_scan", n_trees, n_bytes, scan_secs);
+
+	// Binary encoding, with a codec for an abstract grammar that has
+	// just the functions of the treebank.
+	PgfPGF pgf = { .abstract.funs = gu_new_string_map(PgfFunDecl*,
+							  &gu_null_struct,
+							  pool) };
+	for (int i = 0; i < N_FUNS; i++) {
+		gu_map_put(pgf.abstract.funs, &funs[i], PgfFunDecl*, NULL);
+	}
+	PgfExprCodec* codec = pgf_new_expr_codec(&pgf, pool);
+
+	start = clock();
+	GuByteBuf* encoded = gu_new_buf(uint8_t, pool);
+	GuOut* out = gu_buf_out(encoded, pool);
+	for (size_t i = 0; i < n_trees; i++) {
+		pgf_expr_encode(codec, gu_seq_get(trees, PgfExpr, i), out, err);
+	}
+	gu_out_flush(out, err);
+	double encode_secs = bench_secs(start);
+	size_t n_encoded = gu_buf_length(encoded);
+
+	read_pool = gu_new_pool();
+	start = clock();
+	in = gu_data_in(gu_cslice(gu_buf_data(encoded), n_encoded),
+			read_pool);
+	PgfExprs decoded = gu_new_seq(PgfExpr, n_trees, read_pool);
+	for (size_t i = 0; i < n_trees && gu_ok(err); i++) {
+		gu_seq_set(decoded, PgfExpr, i,
+			   pgf_expr_decode(codec, in, read_pool, err));
+	}
+	double decode_secs = bench_secs(start);
+
+	if (!gu_ok(err)) {
+		fprintf(stderr, "codec failed\n");
+		return EXIT_FAILURE;
+	}
+	reprinted = gu_new_buf(uint8_t, read_pool);
+	for (size_t i = 0; i < n_trees; i++) {
+		pgf_expr_push_utf8(gu_seq_get(decoded, PgfExpr, i), reprinted);
+		gu_buf_push_n(reprinted, ";\n", 2);
+	}
+	if (gu_buf_length(reprinted) != n_bytes
+	    || memcmp(gu_buf_data(reprinted), bytes.p, n_bytes) != 0) {
+		fprintf(stderr, "decoded trees differ\n");
+		return EXIT_FAILURE;
+	}
+	gu_pool_free(read_pool);
+
+	bench_report("pgf_expr_encode", n_trees, n_encoded, encode_secs);
+	bench_report("pgf_expr_decode", n_trees, n_encoded, decode_secs);
+	printf("%-24s %8.1f MB text %8.1f MB encoded %6.1f%%\n", "size",
+	       n_bytes / 1e6, n_encoded / 1e6, 100.0 * n_encoded / n_bytes);
+
+	gu_pool_free(pool);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+// Memory use and speed of a grammar.
+//
+// Usage: bench-grammar PGF CONCRETE [N_REPS] < SENTENCES
+//
+// Reads the grammar and reports the memory that it takes and how long it
+// took to read, then parses each sentence of the input, one per line with
+// the tokens separated by spaces, and linearizes the first tree of each
+// back, N_REPS times. Building the library with and without
+// GU_OPTIMIZE_SIZE and running the same input on both compares the
+// compact grammar representation with the normal one.
+
+#include <libpgf.h>
+#include <gu/file.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_TOKENS 256
+
+static double
+bench_secs(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s PGF CONCRETE [N_REPS]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	int n_reps = argc > 3 ? atoi(argv[3]) : 10;
+
+	GuPool* pool = gu_new_pool();
+	GuExn* err = gu_new_exn(NULL, gu_kind(type), pool);
+	FILE* infile = fopen(argv[1], "rb");
+	if (infile == NULL) {
+		fprintf(stderr, "cannot open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	GuPool* pgf_pool = gu_new_pool();
+	clock_t start = clock();
+	GuIn* in = gu_file_in(infile, pool);
+	PgfPGF* pgf = pgf_read_pgf(in, pgf_pool, err);
+	double read_secs = bench_secs(start);
+	fclose(infile);
+	if (!gu_ok(err)) {
+		fprintf(stderr, "reading %s failed\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	PgfConcr* concr = pgf_pgf_concr(pgf, gu_str_string(argv[2], pool),
+					pool);
+	if (concr == NULL) {
+		fprintf(stderr, "no concrete grammar %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+	printf("%-24s %8.3f s %10.1f MB\n", "read", read_secs,
+	       gu_pool_size(pgf_pool) / 1e6);
+
+	GuBuf* sentences = gu_new_buf(GuStrings, pool);
+	char line[4096];
+	while (fgets(line, sizeof line, stdin) != NULL) {
+		GuString toks[MAX_TOKENS];
+		size_t n_toks = 0;
+		for (char* tok = strtok(line, " \t\r\n");
+		     tok != NULL && n_toks < MAX_TOKENS;
+		     tok = strtok(NULL, " \t\r\n")) {
+			toks[n_toks++] = gu_str_string(tok, pool);
+		}
+		GuStrings sentence = gu_new_seq(GuString, n_toks, pool);
+		memcpy(gu_seq_data(sentence), toks, n_toks * sizeof(GuString));
+		gu_buf_push(sentences, GuStrings, sentence);
+	}
+	size_t n_sentences = gu_buf_length(sentences);
+
+	PgfCat* cat = pgf_pgf_startcat(pgf);
+	PgfParser* parser = pgf_new_parser(concr, pool);
+	PgfLzr* lzr = pgf_new_lzr(concr, pool);
+	size_t n_parsed = 0, n_bytes = 0;
+	double parse_secs = 0, lin_secs = 0;
+	for (int rep = 0; rep < n_reps; rep++) {
+		for (size_t i = 0; i < n_sentences; i++) {
+			GuPool* tmp_pool = gu_new_pool();
+			GuStrings sentence = gu_buf_get(sentences, GuStrings, i);
+			size_t n_toks = gu_seq_length(sentence);
+			start = clock();
+			PgfParse* parse =
+				pgf_parser_parse(parser, cat, 0, tmp_pool);
+			for (size_t j = 0; j < n_toks && parse != NULL; j++) {
+				PgfToken tok = gu_seq_get(sentence, GuString, j);
+				parse = pgf_parse_token(parse, tok, tmp_pool);
+			}
+			PgfExpr expr = gu_null_variant;
+			if (parse != NULL) {
+				GuEnum* exprs = pgf_parse_result(parse,
+								 tmp_pool);
+				gu_enum_next(exprs, &expr, tmp_pool);
+			}
+			parse_secs += bench_secs(start);
+			if (!gu_variant_is_null(expr)) {
+				n_parsed++;
+				start = clock();
+				GuEnum* ctrees =
+					pgf_lzr_concretize(lzr, expr, tmp_pool);
+				PgfCncTree ctree;
+				if (gu_enum_next(ctrees, &ctree, tmp_pool)) {
+					GuByteBuf* buf = gu_new_buf(uint8_t,
+								    tmp_pool);
+					pgf_lzr_linearize_utf8(lzr, ctree, 0,
+							       buf);
+					n_bytes += gu_buf_length(buf);
+				}
+				lin_secs += bench_secs(start);
+			}
+			gu_pool_free(tmp_pool);
+		}
+	}
+	printf("%-24s %8.3f s %10zu parsed\n", "parse", parse_secs,
+	       n_parsed);
+	printf("%-24s %8.3f s %10zu bytes\n", "linearize", lin_secs,
+	       n_bytes);
+
+	gu_pool_free(pgf_pool);
+	gu_pool_free(pool);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,390 @@
+// Copyright 2012 University of Helsinki. Released under LGPL3.
+
+#define _POSIX_C_SOURCE 200809L // For getopt and getline
+
+#include <libpgf.h>
+#include <gu/file.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	GuString catname;
+	GuString ctnt;
+	const char* corpus;
+	const char* infile;
+	const char* outfile;
+	bool rewrite_only;
+} Options;
+
+Options*
+parse_options(int argc, char* argv[], GuPool* pool, GuExn* exn)
+{
+	Options opts = { gu_null_string, gu_null_string, NULL, NULL, NULL,
+			 false };
+	int opt;
+	while ((opt = getopt(argc, argv, "c:F:nv:")) != -1) {
+		switch (opt) {
+		case 'c':
+			opts.catname = gu_str_string(optarg, pool);
+			break;
+		case 'F':
+			opts.ctnt = gu_str_string(optarg, pool);
+			break;
+		case 'n':
+			opts.rewrite_only = true;
+			break;
+		case 'v':
+			opts.corpus = optarg;
+			break;
+		default:
+			gu_raise(exn, void);
+			return NULL;
+		}
+	}
+	if (optind != argc - 2) {
+		gu_raise(exn, void);
+		return NULL;
+	}
+	opts.infile = argv[optind];
+	opts.outfile = argv[optind + 1];
+	Options* ret = gu_new(Options, pool);
+	*ret = opts;
+	return ret;
+}
+
+
+PgfPGF*
+read_pgf(const char* filename, bool keep_layout, long* size,
+	 GuPool* opool, GuExn* exn)
+{
+	FILE* infile = fopen(filename, "r");
+	if (infile == NULL) {
+		gu_raise_i(exn, GuStr, "couldn't open file");
+		return NULL;
+	}
+	GuPool* pool = gu_local_pool();
+	GuIn* in = gu_file_in(infile, pool);
+	PgfPGF* pgf = keep_layout
+		? pgf_read_pgf_keep_layout(in, opool, exn)
+		: pgf_read_pgf(in, opool, exn);
+	gu_pool_free(pool);
+	*size = ftell(infile);
+	fclose(infile);
+	return pgf;
+}
+
+
+//
+// Verification
+//
+// A sentence of the corpus is parsed with each concrete grammar in turn,
+// and every reading is linearized with every concrete grammar, into every
+// constituent. The set of readings and linearizations must be the same
+// with the original and the optimized grammar.
+//
+
+typedef struct {
+	PgfConcr* concr;
+	PgfParser* parser;
+	PgfTokenizer* tzr;
+	PgfLzr* lzr;
+	PgfCtntId ctnt;
+	/**< The constituent that is parsed, or PGF_CTNT_ID_BAD if the
+	 * grammar has no such constituent. */
+	size_t n_ctnts;
+} Lang;
+
+typedef struct {
+	PgfCat* cat;
+	Lang* langs;
+	size_t n_langs;
+} Grammar;
+
+Grammar*
+setup_grammar(PgfPGF* pgf, const Options* opts, GuStrings names,
+	      GuPool* pool, GuExn* exn)
+{
+	PgfCat* cat = pgf_pgf_cat(pgf, opts->catname);
+	if (!cat) {
+		gu_raise_i(exn, GuStr, "Bad -c option, or no startcat in PGF");
+		return NULL;
+	}
+	size_t n_langs = gu_seq_length(names);
+	Grammar* g = gu_new(Grammar, pool);
+	g->cat = cat;
+	g->langs = gu_new_n(Lang, n_langs, pool);
+	g->n_langs = n_langs;
+	for (size_t i = 0; i < n_langs; i++) {
+		GuString name = gu_seq_get(names, GuString, i);
+		Lang* lang = &g->langs[i];
+		lang->concr = pgf_pgf_concr(pgf, name, pool);
+		if (!lang->concr) {
+			gu_raise_i(exn, GuStr, "Concrete grammar is missing");
+			return NULL;
+		}
+		GuStrings ctnts = pgf_concr_cat_ctnts(lang->concr, cat, pool);
+		lang->n_ctnts = gu_seq_is_null(ctnts) ? 0 : gu_seq_length(ctnts);
+		lang->ctnt = PGF_CTNT_ID_BAD;
+		if (!gu_string_is_null(opts->ctnt)) {
+			lang->ctnt = pgf_concr_cat_ctnt_id(lang->concr, cat,
+							   opts->ctnt);
+		} else if (lang->n_ctnts > 0) {
+			lang->ctnt = 0;
+		}
+		lang->parser = pgf_new_parser(lang->concr, pool);
+		lang->tzr = pgf_new_tokenizer(lang->concr, pool);
+		lang->lzr = pgf_new_lzr(lang->concr, pool);
+	}
+	return g;
+}
+
+static void
+push_line(GuBuf* lines, GuByteBuf* buf, GuPool* pool)
+{
+	size_t len = gu_buf_length(buf);
+	char* line = gu_malloc(pool, len + 1);
+	memcpy(line, gu_buf_data(buf), len);
+	line[len] = '\0';
+	gu_buf_push(lines, char*, line);
+}
+
+static int
+cmp_lines(const void* p1, const void* p2)
+{
+	return strcmp(*(char* const*) p1, *(char* const*) p2);
+}
+
+// Get the readings of `sentence` in language `from` and their
+// linearizations, sorted and without duplicates.
+static GuBuf*
+sentence_lines(Grammar* g, size_t from, const char* sentence, GuPool* pool)
+{
+	GuBuf* lines = gu_new_buf(char*, pool);
+	Lang* lang = &g->langs[from];
+	if (lang->ctnt == PGF_CTNT_ID_BAD) {
+		return lines;
+	}
+	GuPool* ppool = gu_local_pool();
+	PgfParse* parse =
+		pgf_parser_parse(lang->parser, g->cat, lang->ctnt, ppool);
+	PgfTokens toks = pgf_tokenize(lang->tzr,
+				      gu_cslice((const uint8_t*) sentence,
+						strlen(sentence)),
+				      ppool);
+	size_t n_toks = gu_seq_length(toks);
+	for (size_t i = 0; parse != NULL && i < n_toks; i++) {
+		parse = pgf_parse_token(parse, gu_seq_get(toks, PgfToken, i),
+					ppool);
+	}
+	if (parse == NULL) {
+		goto end;
+	}
+	GuByteBuf* buf = gu_new_buf(uint8_t, ppool);
+	GuEnum* result = pgf_parse_result(parse, ppool);
+	PgfExpr expr;
+	while (gu_enum_next(result, &expr, ppool)) {
+		gu_buf_trim_n(buf, gu_buf_length(buf));
+		pgf_expr_push_utf8(expr, buf);
+		size_t tree_len = gu_buf_length(buf);
+		push_line(lines, buf, pool);
+		for (size_t j = 0; j < g->n_langs; j++) {
+			Lang* to = &g->langs[j];
+			GuEnum* cts = pgf_lzr_concretize(to->lzr, expr, ppool);
+			PgfCncTree ctree;
+			while (gu_enum_next(cts, &ctree, ppool)) {
+				for (size_t c = 0; c < to->n_ctnts; c++) {
+					gu_buf_trim_n(buf, gu_buf_length(buf)
+						      - tree_len);
+					char prefix[32];
+					int n = snprintf(prefix, sizeof(prefix),
+							 "\t%zu\t%zu\t", j, c);
+					gu_buf_push_n(buf, prefix, n);
+					pgf_lzr_linearize_utf8(to->lzr, ctree,
+							       (PgfCtntId) c,
+							       buf);
+					push_line(lines, buf, pool);
+				}
+			}
+		}
+	}
+end:
+	gu_pool_free(ppool);
+	size_t n_lines = gu_buf_length(lines);
+	char** data = gu_buf_data(lines);
+	qsort(data, n_lines, sizeof(char*), cmp_lines);
+	size_t n_unique = 0;
+	for (size_t i = 0; i < n_lines; i++) {
+		if (n_unique == 0 || strcmp(data[n_unique - 1], data[i]) != 0) {
+			data[n_unique++] = data[i];
+		}
+	}
+	gu_buf_trim_n(lines, n_lines - n_unique);
+	return lines;
+}
+
+static bool
+same_lines(GuBuf* lines1, GuBuf* lines2)
+{
+	size_t n_lines = gu_buf_length(lines1);
+	if (gu_buf_length(lines2) != n_lines) {
+		return false;
+	}
+	for (size_t i = 0; i < n_lines; i++) {
+		if (strcmp(gu_buf_get(lines1, char*, i),
+			   gu_buf_get(lines2, char*, i)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void
+verify(PgfPGF* orig, PgfPGF* optimized, const Options* opts,
+       GuPool* pool, GuExn* exn)
+{
+	FILE* corpus = fopen(opts->corpus, "r");
+	if (corpus == NULL) {
+		gu_raise_i(exn, GuStr, "couldn't open corpus");
+		return;
+	}
+	GuBuf* names = gu_new_buf(GuString, pool);
+	GuEnum* concrs = pgf_pgf_concrs(orig, pool);
+	PgfConcr* concr = NULL;
+	while (gu_enum_next(concrs, &concr, pool)) {
+		gu_buf_push(names, GuString, pgf_concr_id(concr));
+	}
+	GuStrings names_seq = gu_buf_freeze(names, pool);
+	Grammar* g1 = setup_grammar(orig, opts, names_seq, pool, exn);
+	if (!gu_ok(exn)) goto end;
+	Grammar* g2 = setup_grammar(optimized, opts, names_seq, pool, exn);
+	if (!gu_ok(exn)) goto end;
+
+	size_t n_sentences = 0;
+	size_t n_parsed = 0;
+	size_t n_differences = 0;
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_size, corpus)) != -1) {
+		if (len > 0 && line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+		n_sentences++;
+		for (size_t i = 0; i < g1->n_langs; i++) {
+			GuPool* tmp_pool = gu_local_pool();
+			GuBuf* lines1 = sentence_lines(g1, i, line, tmp_pool);
+			GuBuf* lines2 = sentence_lines(g2, i, line, tmp_pool);
+			if (gu_buf_length(lines1) > 0) {
+				n_parsed++;
+			}
+			if (!same_lines(lines1, lines2)) {
+				n_differences++;
+				GuString name = gu_seq_get(names_seq,
+							   GuString, i);
+				GuCSlice utf8 = gu_string_open(
+					name, &(GuShortData){ 0 });
+				fprintf(stderr, "Differs in %.*s: %s\n",
+					(int) utf8.sz, (const char*) utf8.p,
+					line);
+			}
+			gu_pool_free(tmp_pool);
+		}
+	}
+	free(line);
+	fprintf(stderr, "Verified %zu sentences in %zu languages: "
+		"%zu parsed, %zu differed\n",
+		n_sentences, g1->n_langs, n_parsed, n_differences);
+	if (n_differences > 0) {
+		gu_raise_i(exn, GuStr, "Optimized grammar is not equivalent");
+	}
+end:
+	fclose(corpus);
+}
+
+
+static void usage(const char* progname)
+{
+	fprintf(stdout, "\
+Usage: %s [OPTIONS]... PGF-FILE OUT-FILE\n\
+Remove the useless parts of the concrete grammars of PGF-FILE, and write\n\
+the smaller grammar to OUT-FILE.\n\
+\n\
+Options:\n\
+	-n	Don't optimize, just write the grammar again. The output is\n\
+		the same as the input if the input was written by GF\n\
+	-v FILE	Verify that the optimized grammar parses each line of FILE\n\
+		to the same trees, and linearizes them the same way\n\
+	-c CAT	Verify with category CAT instead of the default category\n\
+	-F CTNT	Verify by parsing constituent CTNT instead of the first one\n\
+",
+		progname);
+}
+
+int main(int argc, char* argv[])
+{
+	GuPool* pool = gu_new_pool();
+	GuExn* exn = gu_top_exn(pool);
+	Options* opts = parse_options(argc, argv, pool, exn);
+	if (!gu_ok(exn)) {
+		usage(argv[0]);
+		goto end;
+	}
+
+	long in_size = 0;
+	// The grammar is only written back as it was read if it is not
+	// optimized.
+	PgfPGF* pgf = read_pgf(opts->infile, opts->rewrite_only, &in_size,
+			       pool, exn);
+	if (!gu_ok(exn)) goto end;
+	if (!opts->rewrite_only) {
+		pgf_optimize(pgf, pool);
+	}
+	GuByteBuf* bytes = gu_new_buf(uint8_t, pool);
+	GuOut* bout = gu_buf_out(bytes, pool);
+	pgf_write_pgf(pgf, bout, exn);
+	gu_out_flush(bout, exn);
+	if (!gu_ok(exn)) goto end;
+
+	FILE* outfile = fopen(opts->outfile, "w");
+	if (outfile == NULL) {
+		gu_raise_i(exn, GuStr, "couldn't create output file");
+		goto end;
+	}
+	size_t out_size = gu_buf_length(bytes);
+	size_t n_written = fwrite(gu_buf_data(bytes), 1, out_size, outfile);
+	if (fclose(outfile) != 0 || n_written != out_size) {
+		gu_raise_i(exn, GuStr, "couldn't write output file");
+		goto end;
+	}
+	fprintf(stderr, "%s: %ld bytes, %s: %zu bytes\n",
+		opts->infile, in_size, opts->outfile, out_size);
+
+	if (opts->corpus) {
+		// Verify what was written, not what is in memory, so that the
+		// writer is checked as well.
+		long orig_size = 0;
+		PgfPGF* orig = read_pgf(opts->infile, false, &orig_size,
+					pool, exn);
+		if (!gu_ok(exn)) goto end;
+		GuIn* in = gu_data_in(gu_cslice(gu_buf_data(bytes), out_size),
+				      pool);
+		PgfPGF* optimized = pgf_read_pgf(in, pool, exn);
+		if (!gu_ok(exn)) goto end;
+		verify(orig, optimized, opts, pool, exn);
+	}
+end:;
+	int status = EXIT_FAILURE;
+	GuType* exn_type = gu_exn_caught(exn);
+	if (!exn_type) {
+		status = EXIT_SUCCESS;
+	} else if (exn_type == gu_type(GuStr)) {
+		const GuStr* strp = gu_exn_caught_data(exn);
+		fprintf(stderr, "Error: %s\n", *strp);
+	} else {
+		fprintf(stderr, "Error\n");
+	}
+	gu_pool_free(pool);
+	return status;
+}
@@ -1,18 +1,36 @@
 // Copyright 2011-2012 University of Helsinki. Released under LGPL3.
 
-#define _POSIX_C_SOURCE 2 // For getopt
+#define _POSIX_C_SOURCE 200809L // For getopt and getline
 
+#include "config.h"
 #include <libpgf.h>
 #include <gu/file.h>
 #include <locale.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
 
 typedef struct {
 	GuString catname;
 	GuString from_ctnt;
 	GuString to_ctnt;
 	bool show_expr;
+	bool serve;
+	const char* socket_path;
+	long n_workers;
+	long time_limit_ms;
+	long mem_limit_kb;
 	const char* filename;
 	GuString from;
 	GuString to;
@@ -24,8 +42,9 @@ parse_options(int argc, char* argv[], GuPool* pool, GuExn* exn)
 {
 	Options opts = { gu_null_string };
 	int opt;
-	while ((opt = getopt(argc, argv, "c:F:T:t")) != -1) {
+	while ((opt = getopt(argc, argv, "c:F:T:tsS:j:l:m:")) != -1) {
 		GuString* dst = NULL;
+		long* num = NULL;
 		switch (opt) {
 		case 'c':
 			dst = &opts.catname;
@@ -39,6 +58,22 @@ parse_options(int argc, char* argv[], GuPool* pool, GuExn* exn)
 		case 't':
 			opts.show_expr = true;
 			break;
+		case 's':
+			opts.serve = true;
+			break;
+		case 'S':
+			opts.serve = true;
+			opts.socket_path = optarg;
+			break;
+		case 'j':
+			num = &opts.n_workers;
+			break;
+		case 'l':
+			num = &opts.time_limit_ms;
+			break;
+		case 'm':
+			num = &opts.mem_limit_kb;
+			break;
 		default:
 			gu_raise(exn, void);
 			return NULL;
@@ -46,6 +81,14 @@ parse_options(int argc, char* argv[], GuPool* pool, GuExn* exn)
 		if (dst) {
 			*dst = gu_str_string(optarg, pool);
 		}
+		if (num) {
+			char* end;
+			*num = strtol(optarg, &end, 10);
+			if (*end != '\0' || *num < 0) {
+				gu_raise(exn, void);
+				return NULL;
+			}
+		}
 	}
 	if (optind != argc - 3) {
 		gu_raise(exn, void);
@@ -79,13 +122,14 @@ read_pgf(const char* filename, GuPool* opool, GuExn* exn)
 }
 
 
-void
-doit(PgfPGF* pgf, const Options* opts, GuPool* pool, GuExn* exn)
+// Create the translator that the options ask for.
+PgfTranslator*
+setup(PgfPGF* pgf, const Options* opts, GuPool* pool, GuExn* exn)
 {
 	PgfCat* cat = pgf_pgf_cat(pgf, opts->catname);
 	if (!cat) {
 		gu_raise_i(exn, GuStr, "Bad -c option, or no startcat in PGF");
-		return;
+		return NULL;
 	}
 	PgfConcr* from_concr = pgf_pgf_concr(pgf, opts->from, pool);
 	if (!from_concr) {
@@ -93,7 +137,7 @@ doit(PgfPGF* pgf, const Options* opts, GuPool* pool, GuExn* exn)
 	}
 	if (!from_concr) {
 		gu_raise_i(exn, GuStr, "Unknown source language");
-		return;
+		return NULL;
 	}
 
 	PgfConcr* to_concr = pgf_pgf_concr(pgf, opts->to, pool);
@@ -102,28 +146,550 @@ doit(PgfPGF* pgf, const Options* opts, GuPool* pool, GuExn* exn)
 	}
 	if (!to_concr) {
 		gu_raise_i(exn, GuStr, "Unknown target language");
-		return;
+		return NULL;
 	}
 
 	PgfCtntId from_ctnt =
 		pgf_concr_cat_ctnt_id(from_concr, cat, opts->from_ctnt);
 	if (from_ctnt == PGF_CTNT_ID_BAD) {
 		gu_raise_i(exn, GuStr, "Bad source constituent");
-		return;
+		return NULL;
 	}
 
 	PgfCtntId to_ctnt =
 		pgf_concr_cat_ctnt_id(to_concr, cat, opts->to_ctnt);
 	if (to_ctnt == PGF_CTNT_ID_BAD) {
 		gu_raise_i(exn, GuStr, "Bad target constituent");
+		return NULL;
+	}
+
+	return pgf_new_translator(cat, from_concr, from_ctnt,
+				  to_concr, to_ctnt, pool);
+}
+
+
+#ifdef HAVE_PTHREAD_H
+
+//
+// Server mode
+//
+// Requests are lines of text, and each is answered with a status line
+// followed by the number of lines that the status line announces:
+//
+//     ok N             N translations, one per line
+//     error MESSAGE    the sentence couldn't be translated
+//     stats N          N lines of the form "NAME VALUE"
+//
+// The special request "#stats" asks for the statistics of the server, and
+// "#reload" reloads the grammar file. Requests that are in progress during
+// a reload finish with the old grammar, which is freed after them.
+// Requests are read as soon as they arrive and translated concurrently by
+// a pool of workers, but the responses on a connection are written in the
+// order of the requests.
+
+typedef struct Server Server;
+typedef struct Conn Conn;
+typedef struct Job Job;
+
+typedef struct {
+	unsigned long requests;
+	unsigned long translated;
+	unsigned long failed;
+	unsigned long timeouts;
+	unsigned long mem_exceeded;
+	unsigned long reloads;
+	double busy_secs;
+	double max_secs;
+} Stats;
+
+struct Server {
+	const Options* opts;
+	PgfGrammarHandle* grammar;
+	/**< The current grammar, whose epochs have a #PgfTranslator as
+	 * data. */
+	pthread_mutex_t lock;
+	/**< Protects the queue, `stopping` and `stats`. */
+	pthread_cond_t nonempty;
+	Job* queue_head;
+	Job* queue_tail;
+	size_t queue_length;
+	bool stopping;
+	Stats stats;
+	struct timespec started;
+};
+
+struct Conn {
+	Server* server;
+	FILE* in;
+	int out_fd;
+	pthread_mutex_t lock;
+	/**< Protects the pending jobs and writing to `out_fd`. */
+	pthread_cond_t drained;
+	Job* head;
+	Job* tail;
+	/**< The jobs whose responses have not been written yet, in
+	 * request order. */
+};
+
+struct Job {
+	Job* next_queued;
+	Job* next_pending;
+	Conn* conn;
+	GuPool* pool;
+	GuCSlice text;
+	GuByteBuf* response;
+	bool done;
+};
+
+static double
+elapsed_secs(const struct timespec* since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec)
+		+ (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static void
+push_str(GuByteBuf* buf, const char* str)
+{
+	gu_buf_push_n(buf, str, strlen(str));
+}
+
+static void
+push_fmt(GuByteBuf* buf, const char* fmt, ...)
+{
+	char line[128];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	gu_buf_push_n(buf, line, GU_MIN((size_t) len, sizeof(line) - 1));
+}
+
+typedef enum {
+	LIMIT_OK,
+	LIMIT_TIME,
+	LIMIT_MEM
+} LimitStatus;
+
+// The limits of a single request
+typedef struct {
+	PgfTranslateLimit limit;
+	const Options* opts;
+	struct timespec started;
+	LimitStatus status;
+} JobLimit;
+
+static bool
+job_limit_exceeded(PgfTranslateLimit* self, GuPool* pool)
+{
+	JobLimit* jl = gu_container(self, JobLimit, limit);
+	const Options* opts = jl->opts;
+	if (opts->time_limit_ms > 0
+	    && elapsed_secs(&jl->started) * 1000 > opts->time_limit_ms) {
+		jl->status = LIMIT_TIME;
+	} else if (opts->mem_limit_kb > 0
+		   && gu_pool_size(pool) / 1024 > (size_t) opts->mem_limit_kb) {
+		jl->status = LIMIT_MEM;
+	}
+	return jl->status != LIMIT_OK;
+}
+
+static void
+translate_job(Server* srv, Job* job)
+{
+	JobLimit jl = {
+		.limit = { job_limit_exceeded },
+		.opts = srv->opts,
+		.status = LIMIT_OK
+	};
+	clock_gettime(CLOCK_MONOTONIC, &jl.started);
+	GuPool* pool = gu_new_pool();
+	const char* error = NULL;
+	PgfEpoch* epoch = pgf_grammar_handle_acquire(srv->grammar);
+	PgfTranslator* tr = pgf_epoch_data(epoch);
+
+	PgfTranslations trans =
+		pgf_translate_limited(tr, job->text, &jl.limit, pool);
+	if (jl.status == LIMIT_TIME) {
+		error = "Time limit exceeded";
+	} else if (jl.status == LIMIT_MEM) {
+		error = "Memory limit exceeded";
+	} else if (gu_seq_is_null(trans)) {
+		error = "Unexpected token";
+	}
+	if (error) {
+		push_fmt(job->response, "error %s\n", error);
+	} else {
+		size_t n_trans = gu_seq_length(trans);
+		push_fmt(job->response, "ok %zu\n", n_trans);
+		for (size_t i = 0; i < n_trans; i++) {
+			PgfTranslation* t =
+				gu_seq_index(trans, PgfTranslation, i);
+			if (srv->opts->show_expr) {
+				pgf_expr_push_utf8(t->expr, job->response);
+				gu_buf_push(job->response, uint8_t, '\t');
+			}
+			gu_string_push_utf8(t->lin, job->response);
+			gu_buf_push(job->response, uint8_t, '\n');
+		}
+	}
+
+	double secs = elapsed_secs(&jl.started);
+	pthread_mutex_lock(&srv->lock);
+	Stats* stats = &srv->stats;
+	stats->requests++;
+	if (jl.status == LIMIT_TIME) {
+		stats->timeouts++;
+	} else if (jl.status == LIMIT_MEM) {
+		stats->mem_exceeded++;
+	} else if (error) {
+		stats->failed++;
+	} else {
+		stats->translated++;
+	}
+	stats->busy_secs += secs;
+	stats->max_secs = GU_MAX(stats->max_secs, secs);
+	pthread_mutex_unlock(&srv->lock);
+	gu_pool_free(pool);
+	pgf_epoch_release(epoch);
+}
+
+static void
+stats_job(Server* srv, Job* job)
+{
+	pthread_mutex_lock(&srv->lock);
+	Stats stats = srv->stats;
+	size_t queue_length = srv->queue_length;
+	pthread_mutex_unlock(&srv->lock);
+	GuByteBuf* buf = job->response;
+	push_str(buf, "stats 10\n");
+	push_fmt(buf, "uptime_secs %.3f\n", elapsed_secs(&srv->started));
+	push_fmt(buf, "requests %lu\n", stats.requests);
+	push_fmt(buf, "translated %lu\n", stats.translated);
+	push_fmt(buf, "failed %lu\n", stats.failed);
+	push_fmt(buf, "timeouts %lu\n", stats.timeouts);
+	push_fmt(buf, "mem_exceeded %lu\n", stats.mem_exceeded);
+	push_fmt(buf, "reloads %lu\n", stats.reloads);
+	push_fmt(buf, "busy_secs %.3f\n", stats.busy_secs);
+	push_fmt(buf, "max_request_secs %.3f\n", stats.max_secs);
+	push_fmt(buf, "queued %zu\n", queue_length);
+}
+
+static const char*
+exn_message(GuExn* exn)
+{
+	if (gu_exn_caught(exn) == gu_type(GuStr)) {
+		const GuStr* strp = gu_exn_caught_data(exn);
+		return *strp;
+	}
+	return "Couldn't read grammar";
+}
+
+// Read the grammar into an epoch of its own.
+static PgfEpoch*
+load_epoch(const Options* opts, GuExn* exn)
+{
+	GuPool* pool = gu_new_pool();
+	PgfPGF* pgf = read_pgf(opts->filename, pool, exn);
+	PgfTranslator* tr = gu_ok(exn) ? setup(pgf, opts, pool, exn) : NULL;
+	if (!tr) {
+		gu_pool_free(pool);
+		return NULL;
+	}
+	return pgf_new_epoch(pgf, tr, pool);
+}
+
+static void
+reload_job(Server* srv, Job* job)
+{
+	GuPool* tmp_pool = gu_new_pool();
+	GuExn* exn = gu_new_exn(NULL, gu_kind(type), tmp_pool);
+	PgfEpoch* epoch = load_epoch(srv->opts, exn);
+	if (epoch) {
+		pgf_grammar_handle_publish(srv->grammar, epoch);
+		pthread_mutex_lock(&srv->lock);
+		srv->stats.reloads++;
+		pthread_mutex_unlock(&srv->lock);
+		push_str(job->response, "ok 0\n");
+	} else {
+		push_fmt(job->response, "error %s\n", exn_message(exn));
+	}
+	gu_pool_free(tmp_pool);
+}
+
+static bool
+write_all(int fd, const uint8_t* data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Mark `job` as done, and write out the responses that are no longer
+// waiting for an earlier one.
+static void
+finish_job(Job* job)
+{
+	Conn* conn = job->conn;
+	pthread_mutex_lock(&conn->lock);
+	job->done = true;
+	while (conn->head && conn->head->done) {
+		Job* head = conn->head;
+		// If the client has gone away, the response is dropped.
+		write_all(conn->out_fd, gu_buf_data(head->response),
+			  gu_buf_length(head->response));
+		conn->head = head->next_pending;
+		gu_pool_free(head->pool);
+	}
+	if (conn->head == NULL) {
+		conn->tail = NULL;
+		pthread_cond_broadcast(&conn->drained);
+	}
+	pthread_mutex_unlock(&conn->lock);
+}
+
+static bool
+is_request(Job* job, const char* req)
+{
+	size_t len = strlen(req);
+	return job->text.sz == len && memcmp(job->text.p, req, len) == 0;
+}
+
+static void*
+worker_run(void* arg)
+{
+	Server* srv = arg;
+	while (true) {
+		pthread_mutex_lock(&srv->lock);
+		while (!srv->queue_head && !srv->stopping) {
+			pthread_cond_wait(&srv->nonempty, &srv->lock);
+		}
+		Job* job = srv->queue_head;
+		if (job) {
+			srv->queue_head = job->next_queued;
+			if (!srv->queue_head) {
+				srv->queue_tail = NULL;
+			}
+			srv->queue_length--;
+		}
+		pthread_mutex_unlock(&srv->lock);
+		if (!job) {
+			break;
+		}
+		if (is_request(job, "#stats")) {
+			stats_job(srv, job);
+		} else if (is_request(job, "#reload")) {
+			reload_job(srv, job);
+		} else {
+			translate_job(srv, job);
+		}
+		finish_job(job);
+	}
+	return NULL;
+}
+
+// Read the requests of a connection until end of input, and wait until
+// they have all been answered.
+static void
+serve_conn(Server* srv, FILE* in, int out_fd)
+{
+	Conn conn = {
+		.server = srv,
+		.in = in,
+		.out_fd = out_fd,
+		.head = NULL,
+		.tail = NULL
+	};
+	pthread_mutex_init(&conn.lock, NULL);
+	pthread_cond_init(&conn.drained, NULL);
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_size, in)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n') {
+			len--;
+		}
+		GuPool* pool = gu_new_pool();
+		Job* job = gu_new(Job, pool);
+		uint8_t* text = gu_new_n(uint8_t, len, pool);
+		memcpy(text, line, len);
+		*job = (Job) {
+			.conn = &conn,
+			.pool = pool,
+			.text = gu_cslice(text, len),
+			.response = gu_new_buf(uint8_t, pool)
+		};
+
+		pthread_mutex_lock(&conn.lock);
+		if (conn.tail) {
+			conn.tail->next_pending = job;
+		} else {
+			conn.head = job;
+		}
+		conn.tail = job;
+		pthread_mutex_unlock(&conn.lock);
+
+		pthread_mutex_lock(&srv->lock);
+		if (srv->queue_tail) {
+			srv->queue_tail->next_queued = job;
+		} else {
+			srv->queue_head = job;
+		}
+		srv->queue_tail = job;
+		srv->queue_length++;
+		pthread_cond_signal(&srv->nonempty);
+		pthread_mutex_unlock(&srv->lock);
+	}
+	free(line);
+	pthread_mutex_lock(&conn.lock);
+	while (conn.head) {
+		pthread_cond_wait(&conn.drained, &conn.lock);
+	}
+	pthread_mutex_unlock(&conn.lock);
+	pthread_cond_destroy(&conn.drained);
+	pthread_mutex_destroy(&conn.lock);
+}
+
+typedef struct {
+	Server* srv;
+	int fd;
+} ConnArg;
+
+static void*
+conn_run(void* arg)
+{
+	ConnArg* carg = arg;
+	FILE* in = fdopen(carg->fd, "r");
+	if (in) {
+		serve_conn(carg->srv, in, carg->fd);
+		fclose(in);
+	} else {
+		close(carg->fd);
+	}
+	free(carg);
+	return NULL;
+}
+
+static void
+serve_socket(Server* srv, const char* path, GuExn* exn)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		gu_raise_i(exn, GuStr, "Socket path too long");
+		return;
+	}
+	strcpy(addr.sun_path, path);
+	// A socket that is left over from an earlier server would make
+	// bind fail. Anything else at the path is left alone.
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0
+	    || bind(sock, (struct sockaddr*) &addr, sizeof(addr)) != 0
+	    || listen(sock, SOMAXCONN) != 0) {
+		if (sock >= 0) {
+			close(sock);
+		}
+		gu_raise_i(exn, GuStr, "Couldn't listen on socket");
+		return;
+	}
+	// A client that disconnects early must not kill the server.
+	signal(SIGPIPE, SIG_IGN);
+	while (true) {
+		int fd = accept(sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			gu_raise_i(exn, GuStr, "Couldn't accept connection");
+			break;
+		}
+		ConnArg* carg = malloc(sizeof(ConnArg));
+		pthread_t thread;
+		if (!carg) {
+			close(fd);
+			continue;
+		}
+		*carg = (ConnArg) { srv, fd };
+		if (pthread_create(&thread, NULL, conn_run, carg) != 0) {
+			close(fd);
+			free(carg);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	close(sock);
+}
+
+static void
+serve(const Options* opts, GuPool* pool, GuExn* exn)
+{
+	PgfEpoch* epoch = load_epoch(opts, exn);
+	if (!epoch) {
 		return;
 	}
+	Server* srv = gu_new(Server, pool);
+	*srv = (Server) {
+		.opts = opts,
+		.grammar = pgf_new_grammar_handle(epoch, pool)
+	};
+	pthread_mutex_init(&srv->lock, NULL);
+	pthread_cond_init(&srv->nonempty, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &srv->started);
+	size_t n_workers = opts->n_workers;
+	if (n_workers == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		n_workers = n > 0 ? n : 1;
+	}
+	pthread_t* workers = calloc(n_workers, sizeof(pthread_t));
+	size_t n_started = 0;
+	while (workers && n_started < n_workers
+	       && pthread_create(&workers[n_started], NULL,
+				 worker_run, srv) == 0) {
+		n_started++;
+	}
+	if (n_started == 0) {
+		gu_raise_i(exn, GuStr, "Couldn't start workers");
+	} else if (opts->socket_path) {
+		serve_socket(srv, opts->socket_path, exn);
+	} else {
+		serve_conn(srv, stdin, STDOUT_FILENO);
+	}
+	pthread_mutex_lock(&srv->lock);
+	srv->stopping = true;
+	pthread_cond_broadcast(&srv->nonempty);
+	pthread_mutex_unlock(&srv->lock);
+	for (size_t i = 0; i < n_started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+	pthread_cond_destroy(&srv->nonempty);
+	pthread_mutex_destroy(&srv->lock);
+}
 
-	// Create the parser for the source category
-	PgfParser* parser = pgf_new_parser(from_concr, pool);
+#endif // HAVE_PTHREAD_H
 
-	// Create a linearizer for the destination category
-	PgfLzr* lzr = pgf_new_lzr(to_concr, pool);
+
+void
+doit(PgfPGF* pgf, const Options* opts, GuPool* pool, GuExn* exn)
+{
+	PgfTranslator* tr = setup(pgf, opts, pool, exn);
+	if (!tr) {
+		return;
+	}
 
 	// Create an output stream for stdout
 	GuOut* out = gu_file_out(stdout, pool);
@@ -153,53 +719,36 @@ doit(PgfPGF* pgf, const Options* opts, GuPool* pool, GuExn* exn)
 		// sentence, so our memory usage doesn't increase over time.
 		GuPool* ppool = gu_local_pool();
 
-		// Begin parsing a sentence of the specified category
-		PgfParse* parse =
-			pgf_parser_parse(parser, cat, from_ctnt, ppool);
-		if (parse == NULL) {
-			gu_raise_i(exn, GuStr, "Couldn't begin parsing");
+		// Parse the line, and linearize each concrete syntax tree
+		// of each reading.
+		PgfTranslations trans =
+			pgf_translate_limited(tr, gu_cslice((uint8_t*) line,
+							    strlen(line)),
+					      NULL, ppool);
+		if (gu_seq_is_null(trans)) {
+			gu_raise_i(exn, GuStr, "Unexpected token");
 			goto end_loop;
 		}
 
-		// Just do utterly naive space-separated tokenization
-		char* tok = strtok(line, " \n");
-		while (tok) {
-			GuString tok_s = gu_str_string(tok, pool);
-			gu_debug("parsing token \"%s\"", tok);
-			// feed the token to get a new parse state
-			parse = pgf_parse_token(parse, tok_s, ppool);
-			if (!parse) {
-				gu_raise_i(exn, GuStr, "Unexpected token");
-				goto end_loop;
-			}
-			tok = strtok(NULL, " \n");
-		}
-
-		// Now begin enumerating the resulting syntax trees
-		GuEnum* result = pgf_parse_result(parse, ppool);
-		PgfExpr expr;
-		while (gu_enum_next(result, &expr, ppool)) {
-			if (opts->show_expr) {
+		// The translations of a reading follow each other.
+		void* prev_expr = NULL;
+		size_t n_trans = gu_seq_length(trans);
+		for (size_t i = 0; i < n_trans; i++) {
+			PgfTranslation* t =
+				gu_seq_index(trans, PgfTranslation, i);
+			if (opts->show_expr
+			    && gu_variant_to_ptr(t->expr) != prev_expr) {
 				// Write out the abstract syntax tree
 				gu_putc(' ', wtr, exn);
-				pgf_expr_print(expr, wtr, exn);
+				pgf_expr_print(t->expr, wtr, exn);
 				gu_putc('\n', wtr, exn);
+				prev_expr = gu_variant_to_ptr(t->expr);
 			}
+			gu_puts("  ", wtr, exn);
+			gu_string_write(t->lin, wtr, exn);
+			gu_putc('\n', wtr, exn);
+			gu_writer_flush(wtr, exn);
 			if (!gu_ok(exn)) goto end_loop;
-			// Enumerate the concrete syntax trees corresponding
-			// to the abstract tree.
-			GuEnum* cts = pgf_lzr_concretize(lzr, expr, ppool);
-			PgfCncTree ctree;
-			while (gu_enum_next(cts, &ctree, ppool)) {
-				gu_puts("  ", wtr, exn);
-				// Linearize the concrete tree as a simple
-				// sequence of strings.
-				pgf_lzr_linearize_simple(lzr, ctree, to_ctnt,
-							 wtr, exn);
-				if (!gu_ok(exn)) goto end_loop;
-				gu_putc('\n', wtr, exn);
-				gu_writer_flush(wtr, exn);
-			}
 		}
 	end_loop:
 		gu_pool_free(ppool);
@@ -218,6 +767,19 @@ Options:\n\
 	-t	Show abstract syntax expressions\n\
 	-F CTNT	Parse from constituent CTNT\n\
 	-T CTNT	Linearize to constituent CTNT\n\
+\n\
+Server mode:\n\
+	-s	Serve requests from standard input to standard output\n\
+	-S PATH	Serve requests on a UNIX socket at PATH\n\
+	-j N	Translate with N worker threads (default: one per processor)\n\
+	-l MS	Give up a request after MS milliseconds\n\
+	-m KB	Give up a request whose parse uses more than KB kilobytes\n\
+\n\
+In server mode each line of input is translated as a separate request, and\n\
+answered with a line \"ok N\" followed by N translations, or with a line\n\
+\"error MESSAGE\". The request \"#stats\" is answered with \"stats N\"\n\
+followed by N lines of statistics, and \"#reload\" reloads PGF-FILE without\n\
+interrupting requests in progress. Responses come in the order of requests.\n\
 ", progname);
 
 }
@@ -234,6 +796,14 @@ int main(int argc, char* argv[])
 		usage(argv[0]);
 		goto end;
 	}
+	if (opts->serve) {
+#ifdef HAVE_PTHREAD_H
+		serve(opts, pool, exn);
+#else
+		gu_raise_i(exn, GuStr, "Server mode needs thread support");
+#endif
+		goto end;
+	}
 	PgfPGF* pgf = read_pgf(opts->filename, pool, exn);
 	if (!gu_ok(exn)) goto end;
 	doit(pgf, opts, pool, exn);
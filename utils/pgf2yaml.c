@@ -1,12 +1,64 @@
 // Copyright 2011-2012 University of Helsinki. Released under LGPL3.
 
 #include <pgf/pgf.h>
+#include <pgf/data.h>
 #include <pgf/reader.h>
 
 #include <gu/dump.h>
 #include <gu/file.h>
 #include <gu/utf8.h>
 
+// Symbols are packed into words, so they are dumped as the variants that
+// they are in the file.
+static void
+pgf_dump_symbol(GuFn* self, GuType* type, const void* value, GuDump* ctx)
+{
+	static const char* names[] = {
+		"PGF_SYMBOL_CAT", "PGF_SYMBOL_LIT", "PGF_SYMBOL_VAR",
+		"PGF_SYMBOL_KS", "PGF_SYMBOL_KP"
+	};
+	PgfSymbol sym = *(const PgfSymbol*) value;
+	PgfSymbolTag tag = pgf_symbol_tag(sym);
+	gu_yaml_begin_mapping(ctx->yaml);
+	GuPool* tmp_pool = gu_local_pool();
+	gu_yaml_scalar(ctx->yaml, gu_str_string(names[tag], tmp_pool));
+	gu_pool_free(tmp_pool);
+	switch (tag) {
+	case PGF_SYMBOL_CAT:
+	case PGF_SYMBOL_LIT:
+	case PGF_SYMBOL_VAR: {
+		PgfSymbolIdx sidx = { pgf_symbol_d(sym), pgf_symbol_r(sym) };
+		gu_dump(gu_type(PgfSymbolIdx), &sidx, ctx);
+		break;
+	}
+#ifdef GU_OPTIMIZE_SIZE
+	case PGF_SYMBOL_KS:
+	case PGF_SYMBOL_KP: {
+		// The keywords themselves are dumped with their concrete
+		// grammar.
+		size_t ref = sym.word >> PGF_SYMBOL_TAG_BITS;
+		gu_dump(gu_type(size_t), &ref, ctx);
+		break;
+	}
+#else
+	case PGF_SYMBOL_KS:
+		gu_dump(gu_type(PgfSymbolKS), pgf_symbol_ks(NULL, sym), ctx);
+		break;
+	case PGF_SYMBOL_KP:
+		gu_dump(gu_type(PgfSymbolKP), pgf_symbol_kp(NULL, sym), ctx);
+		break;
+#endif
+	default:
+		gu_impossible();
+	}
+	gu_yaml_end(ctx->yaml);
+}
+
+static GuTypeTable
+pgf_dump_table = GU_TYPETABLE(
+	GU_SLIST(GuTypeTable*, &gu_dump_table),
+	{ gu_kind(PgfSymbol), gu_fn(pgf_dump_symbol) });
+
 int main(void) {
 	GuPool* pool = gu_new_pool();
 	GuExn* err = gu_exn(NULL, type, pool);
@@ -22,7 +74,7 @@ int main(void) {
 	GuOut* bout = gu_out_buffered(out, pool);
 	// GuWriter* wtr = gu_locale_writer(bout, pool);
 	GuWriter* wtr = gu_new_utf8_writer(bout, pool);
-	GuDump* ctx = gu_new_dump(wtr, NULL, err, pool);
+	GuDump* ctx = gu_new_dump(wtr, &pgf_dump_table, err, pool);
 	gu_dump(gu_type(PgfPGF), pgf, ctx);
 	gu_writer_flush(wtr, err);
 fail_read: